@@ -43,6 +43,7 @@
 #include <stdint.h>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace libfreenect2
 {
@@ -68,8 +69,9 @@ namespace libfreenect2
         enum Type
         {
             Color = 1, ///< 1920x1080. BGRX or RGBX.
-            Ir = 2,    ///< 512x424 float. Range is [0.0, 65535.0].
-            Depth = 4  ///< 512x424 float, unit: millimeter. Non-positive, NaN, and infinity are invalid or missing data.
+            Ir = 2,    ///< 512x424 float (256x212 when binning). Range is [0.0, 65535.0].
+            Depth = 4, ///< 512x424 float (256x212 when binning), unit: millimeter. Non-positive, NaN, and infinity are invalid or missing data. UInt16 with 0 for invalid data if Freenect2Device::Config::DepthFormat says so.
+            Confidence = 8 ///< 512x424 float (256x212 when binning). Confidence of the depth phase unwrapping in [0.0, 1.0], 0.0 where it failed. Only sent to listeners that take it.
         };
         
         /** Pixel format. */
@@ -81,6 +83,7 @@ namespace libfreenect2
             BGRX = 4,       ///< 4 bytes of B, G, R, and unused per pixel
             RGBX = 5,       ///< 4 bytes of R, G, B, and unused per pixel
             Gray = 6,       ///< 1 byte of gray per pixel
+            UInt16 = 7,     ///< A 2-byte unsigned integer per pixel
         };
         
         size_t width;           ///< Length of a line (in pixels).
@@ -94,6 +97,7 @@ namespace libfreenect2
         float gain;             ///< From 1.0 (bright) to 1.5 (covered)
         float gamma;            ///< From 1.0 (bright) to 6.4 (covered)
         Format format;          ///< Byte format. Informative only, doesn't indicate errors.
+        uint32_t lost_subsequences; ///< IR, depth and confidence frames: bit i is set if sub-image i of the depth packet was lost, 0 for complete frames. See Freenect2Device::Config::EnablePartialFrames.
         //  bool freeMemory;        ///< Free memory when destruct frame. Default value true
         
         /** Construct a new frame.
@@ -123,12 +127,28 @@ namespace libfreenect2
          * @return true if you want to take ownership of the frame, i.e. reuse/delete it. Will be reused/deleted by caller otherwise.
          */
         virtual bool onNewFrame(Frame::Type type, Frame *frame) = 0;
+        
+        /**
+         * Types of frames this listener takes. Processors may skip the work for other types.
+         * @return Bitwise or of Frame::Type values, Color, Ir and Depth by default.
+         */
+        virtual unsigned int frameTypes() const;
     };
     
     /** @defgroup device Initialization and Device Control
      * Find, open, and control Kinect v2 devices. */
     ///@{
     
+    /** Occupancy of the queue in front of a packet processor, see Freenect2Device::getDepthQueueStatistics(). */
+    struct PacketQueueStatistics
+    {
+        size_t depth;     ///< Number of packets the queue holds, including the one being processed.
+        uint64_t packets; ///< Packets that were offered to the queue.
+        uint64_t dropped; ///< Packets dropped because the queue was full.
+        uint64_t blocked; ///< Packets that had to wait for the queue, with the "block" policy.
+        std::vector<uint64_t> occupancy; ///< occupancy[i] counts the packets that arrived with i packets in the queue.
+    };
+    
     /** Device control. */
     class LIBFREENECT2_API Freenect2Device
     {
@@ -203,13 +223,44 @@ namespace libfreenect2
         /** Configuration of depth processing. */
         struct Config
         {
+            /** SIMD kernels of CPU depth processing, see #DepthKernels. */
+            enum CpuKernels
+            {
+                AutoKernels,   ///< Best kernels supported by the running CPU.
+                ScalarKernels, ///< Per-pixel implementation without SIMD kernels.
+                Sse41Kernels,  ///< SSE4.1 kernels (x86).
+                Avx2Kernels,   ///< AVX2 kernels (x86).
+                NeonKernels    ///< NEON kernels (ARM).
+            };
+
             float MinDepth;             ///< Clip at this minimum distance (meter).
             float MaxDepth;             ///< Clip at this maximum distance (meter).
             
             bool EnableBilateralFilter; ///< Remove some "flying pixels".
             bool EnableEdgeAwareFilter; ///< Remove pixels on edges because ToF cameras produce noisy edges.
             
-            /** Default is 0.5, 4.5, true, true */
+            size_t NumThreads;          ///< Threads used by CPU depth processing. 1 processes serially, 0 uses all hardware threads.
+            bool EnableTiledProcessing; ///< Run all CPU depth stages on small tiles, keeping intermediate data in cache, instead of one stage after the other on the whole image.
+            bool EnableFastMath;        ///< Approximate atan2, sqrt and exp in CPU depth processing. Faster, but depth differs slightly from the exact computation.
+            bool EnableDealiasingLut;   ///< Take the phase unwrapping decisions of CPU depth processing from a small table on the phase differences instead of computing them. Depth only differs for pixels on a decision boundary. Speeds up the scalar path, the SIMD kernels keep computing.
+            CpuKernels DepthKernels;    ///< SIMD kernels of CPU depth processing. AutoKernels picks the best the CPU supports; unsupported choices fall back to it with a warning.
+            bool EnableHugePages;       ///< Back the intermediate buffers of CPU depth processing with huge pages, which saves TLB misses. Falls back to normal pages where the OS has none.
+            bool EnableCompactTrigTables; ///< Keep cos and sin of the per-pixel phase offsets in CPU depth processing, 5MB, and add the modulation phases in stage 1, instead of tables of all 9 phase sums, 15MB.
+            bool EnableBinning;         ///< Average the IR measurements of 2x2 pixel blocks before computing the phases, and output 256x212 IR and depth frames. Less noise at range, a quarter of the filter cost.
+            bool EnableTemporalFilter;  ///< Average the depth of each pixel over time. A cheap alternative to the bilateral filter for static scenes.
+            float TemporalFilterAlpha;  ///< Weight of the newest frame in the temporal average, in (0, 1]. Lower is smoother but slower to follow motion.
+            float TemporalFilterMaxJump; ///< Depth change, relative to the depth, above which a pixel restarts its temporal average.
+            bool EnablePartialFrames;   ///< Deliver IR and depth frames with lost sub-images, marked in Frame::lost_subsequences, instead of dropping them. Their depth comes from the complete frequencies, invalid where there are less than two, and is not filtered by the bilateral or edge-aware filter. Only the CPU pipeline without binning supports them; others warn and keep dropping them.
+            
+            size_t RoiX;                ///< Left column of the region of interest of the IR and depth images, in output pixels.
+            size_t RoiY;                ///< Top row of the region of interest of the IR and depth images.
+            size_t RoiWidth;            ///< Width of the region of interest, 0 selects the whole image.
+            size_t RoiHeight;           ///< Height of the region of interest, 0 selects the whole image.
+            bool CropToRoi;             ///< Crop the IR and depth frames to the region of interest, instead of setting the pixels outside of it to 0. Registration needs the full frames.
+            
+            Frame::Format DepthFormat;  ///< Frame::Float, or Frame::UInt16 for depth frames of rounded millimeters with 0 for invalid data, half the size. Registration needs Frame::Float.
+            
+            /** Default is 0.5, 4.5, false, false, 1, false, false, false, AutoKernels, false, true, false, false, 0.3, 0.03, false, 0, 0, 0, 0, false, Frame::Float */
             LIBFREENECT2_API Config();
         };
         
@@ -242,6 +293,25 @@ namespace libfreenect2
         /** Configure depth processing. */
         virtual void setConfiguration(const Config &config) = 0;
         
+        /** Number of times a sub-image was lost from a depth packet that was partly
+         * received, since the device was opened. Packets lost completely are not counted.
+         * Frames with lost sub-images are dropped unless Config::EnablePartialFrames is set.
+         * @param subsequence Sub-image number, 0 to 9.
+         */
+        virtual uint32_t getLostSubsequences(int subsequence) = 0;
+        
+        /** Statistics of the queue in front of color decoding, since the device was opened.
+         * The queue is set with the environment variables LIBFREENECT2_RGB_QUEUE_DEPTH and
+         * LIBFREENECT2_RGB_QUEUE_POLICY.
+         */
+        virtual PacketQueueStatistics getRgbQueueStatistics() = 0;
+        
+        /** Statistics of the queue in front of depth processing, since the device was opened.
+         * The queue is set with the environment variables LIBFREENECT2_DEPTH_QUEUE_DEPTH and
+         * LIBFREENECT2_DEPTH_QUEUE_POLICY.
+         */
+        virtual PacketQueueStatistics getDepthQueueStatistics() = 0;
+        
         /** Provide your listener to receive color frames. */
         virtual void setColorFrameListener(FrameListener* rgb_frame_listener) = 0;
         
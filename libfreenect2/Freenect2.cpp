@@ -289,6 +289,10 @@ namespace libfreenect2 {
     {
         if (name == "cpu")
             return new CpuPacketPipeline();
+        if (name == "cpu-kde")
+            return new CpuKdePacketPipeline();
+        if (name == "cpu-fixed")
+            return new CpuFixedPacketPipeline();
         if (name == "dump")
             return new DumpPacketPipeline();
         if (name == "cl")
@@ -9,6 +9,7 @@
 #include "Freenect2Device.h"
 
 #include <libfreenect2/Freenect2.h>
+#include <libfreenect2/table_cache.h>
 
 namespace libfreenect2 {
 
@@ -16,7 +17,25 @@ namespace libfreenect2 {
         MinDepth(0.5f),
         MaxDepth(4.5f), //set to > 8000 for best performance when using the kde pipeline
         EnableBilateralFilter(false),
-        EnableEdgeAwareFilter(false)
+        EnableEdgeAwareFilter(false),
+        NumThreads(1),
+        EnableTiledProcessing(false),
+        EnableFastMath(false),
+        EnableDealiasingLut(false),
+        DepthKernels(AutoKernels),
+        EnableHugePages(false),
+        EnableCompactTrigTables(true),
+        EnableBinning(false),
+        EnableTemporalFilter(false),
+        TemporalFilterAlpha(0.3f),
+        TemporalFilterMaxJump(0.03f),
+        EnablePartialFrames(false),
+        RoiX(0),
+        RoiY(0),
+        RoiWidth(0),
+        RoiHeight(0),
+        CropToRoi(false),
+        DepthFormat(Frame::Float)
     {}
 
     Freenect2Device::~Freenect2Device()
@@ -36,7 +55,8 @@ namespace libfreenect2 {
         command_seq_(0),
         pipeline_(pipeline),
         serial_(serial),
-        firmware_("<unknown>")
+        firmware_("<unknown>"),
+        num_threads_(1)
     {
         rgb_transfer_pool_.setCallback(pipeline_->getRgbPacketParser());
         ir_transfer_pool_.setCallback(pipeline_->getIrPacketParser());
@@ -101,11 +121,16 @@ namespace libfreenect2 {
     
     void Freenect2DeviceImpl::setIrCameraParams(const Freenect2Device::IrCameraParams &params)
     {
-        ir_camera_params_ = params;
+        std::unique_ptr<WorkerPool> pool(num_threads_ != 1 ? new WorkerPool(num_threads_) : 0);
+        setIrCameraTables(IrCameraTables(params, pool.get()));
+    }
+    
+    void Freenect2DeviceImpl::setIrCameraTables(const IrCameraTables &tables)
+    {
+        ir_camera_params_ = tables;
         DepthPacketProcessor *proc = pipeline_->getDepthPacketProcessor();
         if (proc != 0)
         {
-            IrCameraTables tables(params);
             proc->loadXZTables(&tables.xtable[0], &tables.ztable[0]);
             proc->loadLookupTable(&tables.lut[0]);
         }
@@ -114,9 +139,43 @@ namespace libfreenect2 {
     
     void Freenect2DeviceImpl::setConfiguration(const Freenect2Device::Config &config)
     {
+        num_threads_ = config.NumThreads;
         DepthPacketProcessor *proc = pipeline_->getDepthPacketProcessor();
         if (proc != 0)
             proc->setConfiguration(config);
+        
+        // the processor decides after its configuration, e.g. binning has no partial frames
+        const bool partial_frames = config.EnablePartialFrames && proc != 0 && proc->supportsPartialPackets();
+        if (config.EnablePartialFrames && !partial_frames)
+            LOG_WARNING << "partial frames are not supported by the " << (proc != 0 ? proc->name() : "missing") << " depth processor in this configuration, dropping them";
+        
+        DepthPacketStreamParser *parser = getDepthPacketParser();
+        if (parser != 0)
+            parser->setPartialPackets(partial_frames);
+    }
+    
+    uint32_t Freenect2DeviceImpl::getLostSubsequences(int subsequence)
+    {
+        DepthPacketStreamParser *parser = getDepthPacketParser();
+        if (parser == 0 || subsequence < 0 || subsequence >= DepthPacketStreamParser::NUM_SUBSEQUENCES)
+            return 0;
+        return parser->getLostSubsequences(subsequence);
+    }
+    
+    PacketQueueStatistics Freenect2DeviceImpl::getRgbQueueStatistics()
+    {
+        return pipeline_->getRgbQueueStatistics();
+    }
+    
+    PacketQueueStatistics Freenect2DeviceImpl::getDepthQueueStatistics()
+    {
+        return pipeline_->getDepthQueueStatistics();
+    }
+    
+    /** The depth stream parser of the pipeline, NULL for pipelines with another parser. */
+    DepthPacketStreamParser *Freenect2DeviceImpl::getDepthPacketParser()
+    {
+        return dynamic_cast<DepthPacketStreamParser *>(pipeline_->getIrPacketParser());
     }
     
     void Freenect2DeviceImpl::setColorFrameListener(libfreenect2::FrameListener* rgb_frame_listener)
@@ -231,15 +290,40 @@ namespace libfreenect2 {
             LOG_WARNING << "serial number reported by libusb " << serial_ << " differs from serial number " << new_serial << " in device protocol! ";
         }
         
-        if (!command_tx_.execute(ReadDepthCameraParametersCommand(nextCommandSeq()), result)) return false;
-        setIrCameraParams(DepthCameraParamsResponse(result).toIrCameraParams());
-        
-        if (!command_tx_.execute(ReadP0TablesCommand(nextCommandSeq()), result)) return false;
-        if(pipeline_->getDepthPacketProcessor() != 0)
-            pipeline_->getDepthPacketProcessor()->loadP0TablesFromCommandResponse(&result[0], result.size());
+        DepthPacketProcessor *proc = pipeline_->getDepthPacketProcessor();
+        TableCache cache(serial_, firmware_);
         
-        if (!command_tx_.execute(ReadRgbCameraParametersCommand(nextCommandSeq()), result)) return false;
-        setColorCameraParams(RgbCameraParamsResponse(result).toColorCameraParams());
+        if (cache.load())
+        {
+            // the processors only read the P0 tables, so they can use the read-only mapping
+            ir_camera_params_ = cache.irCameraParams();
+            if (proc != 0)
+            {
+                proc->loadXZTables(cache.xTable(), cache.zTable());
+                proc->loadLookupTable(cache.lookupTable());
+                proc->loadP0TablesFromCommandResponse(const_cast<unsigned char *>(cache.p0Tables()), cache.p0TablesSize());
+            }
+            setColorCameraParams(cache.colorCameraParams());
+        }
+        else
+        {
+            CommandTransaction::Result p0_result;
+            
+            if (!command_tx_.execute(ReadDepthCameraParametersCommand(nextCommandSeq()), result)) return false;
+            std::unique_ptr<WorkerPool> pool(num_threads_ != 1 ? new WorkerPool(num_threads_) : 0);
+            IrCameraTables tables(DepthCameraParamsResponse(result).toIrCameraParams(), pool.get());
+            setIrCameraTables(tables);
+            
+            if (!command_tx_.execute(ReadP0TablesCommand(nextCommandSeq()), p0_result)) return false;
+            if (proc != 0)
+                proc->loadP0TablesFromCommandResponse(&p0_result[0], p0_result.size());
+            
+            if (!command_tx_.execute(ReadRgbCameraParametersCommand(nextCommandSeq()), result)) return false;
+            setColorCameraParams(RgbCameraParamsResponse(result).toColorCameraParams());
+            
+            if (cache.enabled())
+                cache.store(ir_camera_params_, rgb_camera_params_, &p0_result[0], p0_result.size(), &tables.xtable[0], &tables.ztable[0], &tables.lut[0]);
+        }
         
         if (!command_tx_.execute(SetModeEnabledWith0x00640064Command(nextCommandSeq()), result)) return false;
         if (!command_tx_.execute(SetModeDisabledCommand(nextCommandSeq()), result)) return false;
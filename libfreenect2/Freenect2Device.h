@@ -25,9 +25,11 @@
 
 #include <libfreenect2/packet_pipeline.h>
 #include <libfreenect2/depth_packet_processor.h>
+#include <libfreenect2/depth_packet_stream_parser.h>
 #include <libfreenect2/rgb_packet_processor.h>
 
 #include <libfreenect2/logging.h>
+#include <libfreenect2/worker_pool.h>
 
 
 namespace libfreenect2 {
@@ -85,7 +87,11 @@ namespace libfreenect2 {
         std::vector<float> ztable;
         std::vector<short> lut;
         
-        IrCameraTables(const Freenect2Device::IrCameraParams &parent):
+        /**
+         * @param parent Parameters of the IR camera.
+         * @param pool Threads computing bands of the x/z tables, NULL to compute them serially.
+         */
+        IrCameraTables(const Freenect2Device::IrCameraParams &parent, WorkerPool *pool = 0):
         Freenect2Device::IrCameraParams(parent),
         xtable(DepthPacketProcessor::TABLE_SIZE),
         ztable(DepthPacketProcessor::TABLE_SIZE),
@@ -93,21 +99,36 @@ namespace libfreenect2 {
         {
             const double scaling_factor = 8192;
             const double unambigious_dist = 6250.0/3;
-            size_t divergence = 0;
-            for (size_t i = 0; i < DepthPacketProcessor::TABLE_SIZE; i++)
+            const size_t num_bands = pool != 0 ? pool->size() * 4 : 1;
+            std::vector<size_t> divergence(num_bands, 0);
+            
+            // the undistortion iterations vary between pixels, several bands per thread balance them
+            auto fill_band = [&](size_t band)
             {
-                size_t xi = i % 512;
-                size_t yi = i / 512;
-                double xd = (xi + 0.5 - cx)/fx;
-                double yd = (yi + 0.5 - cy)/fy;
-                double xu, yu;
-                divergence += !undistort(xd, yd, xu, yu);
-                xtable[i] = scaling_factor*xu;
-                ztable[i] = unambigious_dist/sqrt(xu*xu + yu*yu + 1);
-            }
+                const size_t end = (band + 1) * DepthPacketProcessor::TABLE_SIZE / num_bands;
+                for (size_t i = band * DepthPacketProcessor::TABLE_SIZE / num_bands; i < end; i++)
+                {
+                    size_t xi = i % 512;
+                    size_t yi = i / 512;
+                    double xd = (xi + 0.5 - cx)/fx;
+                    double yd = (yi + 0.5 - cy)/fy;
+                    double xu, yu;
+                    divergence[band] += !undistort(xd, yd, xu, yu);
+                    xtable[i] = scaling_factor*xu;
+                    ztable[i] = unambigious_dist/sqrt(xu*xu + yu*yu + 1);
+                }
+            };
             
-            if (divergence > 0)
-                LOG_ERROR << divergence << " pixels in x/ztable have incorrect undistortion.";
+            if (pool != 0)
+                pool->run(num_bands, fill_band);
+            else
+                fill_band(0);
+            
+            size_t total_divergence = 0;
+            for (size_t band = 0; band < num_bands; band++)
+                total_divergence += divergence[band];
+            if (total_divergence > 0)
+                LOG_ERROR << total_divergence << " pixels in x/ztable have incorrect undistortion.";
             
             short y = 0;
             for (int x = 0; x < 1024; x++)
@@ -213,8 +234,12 @@ namespace libfreenect2 {
         
         const PacketPipeline *pipeline_;
         std::string serial_, firmware_;
+        size_t num_threads_; ///< Config::NumThreads, also used to compute the x/z tables.
         Freenect2Device::IrCameraParams ir_camera_params_;
         Freenect2Device::ColorCameraParams rgb_camera_params_;
+        
+        void setIrCameraTables(const IrCameraTables &tables);
+        DepthPacketStreamParser *getDepthPacketParser();
     public:
         Freenect2DeviceImpl(Freenect2Impl *context, const PacketPipeline *pipeline, libusb_device *usb_device, libusb_device_handle *usb_device_handle, const std::string &serial);
         virtual ~Freenect2DeviceImpl();
@@ -229,6 +254,9 @@ namespace libfreenect2 {
         virtual void setColorCameraParams(const Freenect2Device::ColorCameraParams &params);
         virtual void setIrCameraParams(const Freenect2Device::IrCameraParams &params);
         virtual void setConfiguration(const Freenect2Device::Config &config);
+        virtual uint32_t getLostSubsequences(int subsequence);
+        virtual PacketQueueStatistics getRgbQueueStatistics();
+        virtual PacketQueueStatistics getDepthQueueStatistics();
         
         int nextCommandSeq();
         
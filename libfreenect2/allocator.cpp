@@ -29,6 +29,8 @@
 #include <libfreenect2/allocator.h>
 #include <libfreenect2/threading.h>
 
+#include <vector>
+
 namespace libfreenect2
 {
 class NewAllocator: public Allocator
@@ -57,66 +59,87 @@ class PoolAllocatorImpl: public Allocator
 {
 private:
   Allocator *allocator;
-  Buffer *buffers[2];
-  bool used[2];
+  std::vector<Buffer *> buffers;
+  std::vector<bool> used;
+  size_t capacity;
   mutex used_lock;
   condition_variable available_cond;
+
+  /* Index of an unused buffer below the capacity, or the capacity if there is none. */
+  size_t findUnused() const
+  {
+    size_t i = 0;
+    while (i < capacity && used[i])
+      ++i;
+    return i;
+  }
 public:
-  PoolAllocatorImpl(Allocator *a): allocator(a), buffers(), used() {}
+  PoolAllocatorImpl(Allocator *a, size_t n): allocator(a), capacity(0) { setCapacity(n); }
+
+  void setCapacity(size_t n)
+  {
+    lock_guard guard(used_lock);
+    capacity = n;
+    if (buffers.size() < n) {
+      buffers.resize(n, NULL);
+      used.resize(n, false);
+    }
+    // unused buffers above the capacity go now, the others when they are freed
+    for (size_t i = n; i < buffers.size(); ++i) {
+      if (!used[i]) {
+        allocator->free(buffers[i]);
+        buffers[i] = NULL;
+      }
+    }
+    available_cond.notify_all();
+  }
 
   Buffer *allocate(size_t size)
   {
     unique_lock guard(used_lock);
-    while (used[0] && used[1])
+    size_t i;
+    while ((i = findUnused()) == capacity)
       WAIT_CONDITION(available_cond, used_lock, guard);
 
-    if (!used[0]) {
-      if (buffers[0] == NULL)
-        buffers[0] = allocator->allocate(size);
-      buffers[0]->length = 0;
-      buffers[0]->allocator = this;
-      used[0] = true;
-      return buffers[0];
-    } else if (!used[1]) {
-      if (buffers[1] == NULL)
-        buffers[1] = allocator->allocate(size);
-      buffers[1]->length = 0;
-      buffers[1]->allocator = this;
-      used[1] = true;
-      return buffers[1];
-    } else {
-      // should never happen
-      return NULL;
-    }
+    if (buffers[i] == NULL)
+      buffers[i] = allocator->allocate(size);
+    buffers[i]->length = 0;
+    buffers[i]->allocator = this;
+    used[i] = true;
+    return buffers[i];
   }
 
   void free(Buffer *b)
   {
     lock_guard guard(used_lock);
-    if (b == buffers[0]) {
-      used[0] = false;
-      available_cond.notify_one();
-    } else if (b == buffers[1]) {
-      used[1] = false;
-      available_cond.notify_one();
+    for (size_t i = 0; i < buffers.size(); ++i) {
+      if (b != NULL && b == buffers[i]) {
+        used[i] = false;
+        if (i >= capacity) {
+          allocator->free(buffers[i]);
+          buffers[i] = NULL;
+        }
+        available_cond.notify_one();
+        return;
+      }
     }
   }
 
   ~PoolAllocatorImpl()
   {
-    allocator->free(buffers[0]);
-    allocator->free(buffers[1]);
+    for (size_t i = 0; i < buffers.size(); ++i)
+      allocator->free(buffers[i]);
     delete allocator;
   }
 };
 
-PoolAllocator::PoolAllocator():
-  impl_(new PoolAllocatorImpl(new NewAllocator))
+PoolAllocator::PoolAllocator(size_t capacity):
+  impl_(new PoolAllocatorImpl(new NewAllocator, capacity))
 {
 }
 
-PoolAllocator::PoolAllocator(Allocator *a):
-  impl_(new PoolAllocatorImpl(a))
+PoolAllocator::PoolAllocator(Allocator *a, size_t capacity):
+  impl_(new PoolAllocatorImpl(a, capacity))
 {
 }
 
@@ -134,4 +157,9 @@ void PoolAllocator::free(Buffer *b)
 {
   impl_->free(b);
 }
+
+void PoolAllocator::setCapacity(size_t capacity)
+{
+  impl_->setCapacity(capacity);
+}
 } // namespace libfreenect2
@@ -62,11 +62,14 @@ namespace libfreenect2
     class PoolAllocator: public Allocator
     {
     public:
-        /* Use new as the inner allocator. */
-        PoolAllocator();
+        /* Use new as the inner allocator.
+         * The pool holds at most capacity buffers, two by default: one for
+         * the stream parser to fill and one for the processor to read.
+         */
+        PoolAllocator(size_t capacity = 2);
         
         /* This inner allocator will be freed by PoolAllocator. */
-        PoolAllocator(Allocator *inner);
+        PoolAllocator(Allocator *inner, size_t capacity = 2);
         
         virtual ~PoolAllocator();
         
@@ -91,6 +94,14 @@ namespace libfreenect2
          * free() can be called from different threads than allocate().
          */
         virtual void free(Buffer *b);
+        
+        /* setCapacity() changes the number of buffers in the pool, e.g. to
+         * one more than the packets a queue can hold.
+         *
+         * Raising it unblocks pending allocation. Buffers above a lowered
+         * capacity are released to the inner allocator once they are free.
+         */
+        void setCapacity(size_t capacity);
     private:
         PoolAllocatorImpl *impl_;
     };
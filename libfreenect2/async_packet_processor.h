@@ -29,14 +29,32 @@
 #ifndef ASYNC_PACKET_PROCESSOR_H_
 #define ASYNC_PACKET_PROCESSOR_H_
 
+#include <include/libfreenect2.h>
 #include <libfreenect2/threading.h>
 #include <libfreenect2/packet_processor.h>
+#include <libfreenect2/logging.h>
+
+#include <deque>
+#include <vector>
+#include <stdint.h>
 
 namespace libfreenect2
 {
 
+/** What AsyncPacketProcessor does with a packet that arrives while its queue is full. */
+enum AsyncQueuePolicy
+{
+  DropNewestPacket, ///< ready() is false, the stream parser drops the new packet.
+  DropOldestPacket, ///< The oldest packet that is still waiting is dropped for the new one.
+  BlockOnFullQueue  ///< process() waits for the processing thread, which stalls the stream parser.
+};
+
 /**
  * Packet processor that runs asynchronously.
+ *
+ * Packets wait in a queue of a fixed depth for the processing thread, so a
+ * slow packet does not have to cost the next one. The wrapped processor is
+ * given one buffer more than the depth, for the stream parser to fill.
  * @tparam PacketT Type of the packet being processed.
  */
 template<typename PacketT>
@@ -48,34 +66,64 @@ public:
   /**
    * Constructor.
    * @param processor Object performing the processing.
+   * @param depth Number of packets in the queue, including the one being processed.
+   * @param policy What to do with packets while the queue is full.
    */
-  AsyncPacketProcessor(PacketProcessorPtr processor) :
+  AsyncPacketProcessor(PacketProcessorPtr processor, size_t depth = 1, AsyncQueuePolicy policy = DropNewestPacket) :
     processor_(processor),
-    current_packet_available_(false),
-    shutdown_(false),
-    thread_(&AsyncPacketProcessor<PacketT>::static_execute, this)
+    depth_(depth < 1 ? 1 : depth),
+    policy_(policy),
+    processing_(false),
+    shutdown_(false)
   {
+    processor_->setBufferCount(depth_ + 1);
+
+    statistics_.depth = depth_;
+    statistics_.packets = 0;
+    statistics_.dropped = 0;
+    statistics_.blocked = 0;
+    statistics_.occupancy.resize(depth_ + 1, 0);
+
+    thread_ = libfreenect2::thread(&AsyncPacketProcessor<PacketT>::static_execute, this);
   }
 
   virtual ~AsyncPacketProcessor()
   {
-    shutdown_ = true;
+    {
+      libfreenect2::lock_guard l(packet_mutex_);
+      shutdown_ = true;
+    }
     packet_condition_.notify_one();
+    space_condition_.notify_all();
 
     thread_.join();
+
+    while(!queue_.empty())
+    {
+      releaseBuffer(queue_.front());
+      queue_.pop_front();
+    }
+
+    if(statistics_.packets != 0)
+      LOG_INFO << processor_->name() << " queue of depth " << depth_ << ": " << statistics_.packets << " packets, "
+               << statistics_.dropped << " dropped, " << statistics_.blocked << " blocked, mean occupancy " << meanOccupancy();
   }
 
   virtual bool ready()
   {
-    // try to aquire lock, if we succeed the background thread is waiting on packet_condition_
-    bool locked = packet_mutex_.try_lock();
+    libfreenect2::lock_guard l(packet_mutex_);
 
-    if(locked)
-    {
-      packet_mutex_.unlock();
-    }
+    if(policy_ != DropNewestPacket)
+      return true;
+
+    // process() is not called for packets the parser drops, count them here
+    const size_t occupancy = this->occupancy();
+    if(occupancy < depth_)
+      return true;
 
-    return locked;
+    countPacket(occupancy);
+    statistics_.dropped++;
+    return false;
   }
 
   virtual bool good()
@@ -86,9 +134,33 @@ public:
   virtual void process(const PacketT &packet)
   {
     {
-      libfreenect2::lock_guard l(packet_mutex_);
-      current_packet_ = packet;
-      current_packet_available_ = true;
+      libfreenect2::unique_lock l(packet_mutex_);
+      countPacket(occupancy());
+
+      if(occupancy() >= depth_ && policy_ == BlockOnFullQueue)
+      {
+        statistics_.blocked++;
+        while(occupancy() >= depth_ && !shutdown_)
+          WAIT_CONDITION(space_condition_, packet_mutex_, l);
+      }
+
+      if(occupancy() >= depth_ && !shutdown_ && policy_ == DropOldestPacket && !queue_.empty())
+      {
+        releaseBuffer(queue_.front());
+        queue_.pop_front();
+        statistics_.dropped++;
+      }
+
+      if(occupancy() >= depth_ || shutdown_)
+      {
+        // the buffer was handed over with the packet
+        PacketT dropped = packet;
+        releaseBuffer(dropped);
+        statistics_.dropped++;
+        return;
+      }
+
+      queue_.push_back(packet);
     }
     packet_condition_.notify_one();
   }
@@ -103,16 +175,48 @@ public:
     processor_->releaseBuffer(p);
   }
 
+  /** Copy of the queue statistics. */
+  PacketQueueStatistics getStatistics()
+  {
+    libfreenect2::lock_guard l(packet_mutex_);
+    return statistics_;
+  }
+
 private:
   PacketProcessorPtr processor_;  ///< The processing routine, executed in the asynchronous thread.
-  bool current_packet_available_; ///< Whether #current_packet_ still needs processing.
-  PacketT current_packet_;        ///< Packet being processed.
+  const size_t depth_;            ///< Capacity of the queue, including the packet being processed.
+  const AsyncQueuePolicy policy_;
+  std::deque<PacketT> queue_;     ///< Packets waiting for processing.
+  bool processing_;               ///< Whether the thread is processing a packet taken off #queue_.
+  PacketQueueStatistics statistics_;
 
   bool shutdown_;
-  libfreenect2::mutex packet_mutex_; ///< Mutex indicating a new packet can be stored in #current_packet_.
-  libfreenect2::condition_variable packet_condition_; ///< Mutex indicating processing is blocked on lack of packets.
+  libfreenect2::mutex packet_mutex_; ///< Mutex protecting #queue_, #processing_ and #statistics_.
+  libfreenect2::condition_variable packet_condition_; ///< Condition indicating a packet was queued.
+  libfreenect2::condition_variable space_condition_; ///< Condition indicating a packet was processed.
   libfreenect2::thread thread_; ///< Asynchronous thread.
 
+  /** Number of packets in the queue, including the one being processed. Call with #packet_mutex_ held. */
+  size_t occupancy() const
+  {
+    return queue_.size() + (processing_ ? 1 : 0);
+  }
+
+  /** Count a packet that arrived with \a occupancy packets in the queue. Call with #packet_mutex_ held. */
+  void countPacket(size_t occupancy)
+  {
+    statistics_.packets++;
+    statistics_.occupancy[occupancy < depth_ ? occupancy : depth_]++;
+  }
+
+  double meanOccupancy() const
+  {
+    uint64_t sum = 0;
+    for(size_t i = 0; i < statistics_.occupancy.size(); ++i)
+      sum += i * statistics_.occupancy[i];
+    return double(sum) / statistics_.packets;
+  }
+
   /**
    * Wrapper function to start the thread.
    * @param data The #AsyncPacketProcessor object to use.
@@ -122,7 +226,7 @@ private:
     static_cast<AsyncPacketProcessor<PacketT> *>(data)->execute();
   }
 
-  /** Asynchronously process a provided packet. */
+  /** Asynchronously process the queued packets. */
   void execute()
   {
     this_thread::set_name(processor_->name());
@@ -130,25 +234,31 @@ private:
 
     while(!shutdown_)
     {
-      WAIT_CONDITION(packet_condition_, packet_mutex_, l);
-
-      if(current_packet_available_)
+      if(queue_.empty())
       {
-        // invoke process impl
-        if (processor_->good())
-          processor_->process(current_packet_);
-        /*
-         * The stream parser passes the buffer asynchronously to processors so
-         * it can not wait after process() finishes and free the buffer.  In
-         * theory releaseBuffer() should be called as soon as the access to it
-         * is finished, but right now no new allocateBuffer() will be called
-         * before ready() becomes true, so releaseBuffer() in the main loop of
-         * the async processor is OK.
-         */
-        releaseBuffer(current_packet_);
-
-        current_packet_available_ = false;
+        WAIT_CONDITION(packet_condition_, packet_mutex_, l);
+        continue;
       }
+
+      PacketT packet = queue_.front();
+      queue_.pop_front();
+      processing_ = true;
+      l.unlock();
+
+      // invoke process impl
+      if (processor_->good())
+        processor_->process(packet);
+      /*
+       * The stream parser passes the buffer asynchronously to processors so
+       * it can not wait after process() finishes and free the buffer. The
+       * pool has a buffer for each packet in the queue and one for the
+       * parser, so releasing it after process() never starves allocateBuffer().
+       */
+      releaseBuffer(packet);
+
+      l.lock();
+      processing_ = false;
+      space_condition_.notify_one();
     }
   }
 };
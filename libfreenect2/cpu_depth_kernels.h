@@ -0,0 +1,109 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+/** @file cpu_depth_kernels.h Vectorized kernels of the CPU depth processor. */
+
+#ifndef CPU_DEPTH_KERNELS_H_
+#define CPU_DEPTH_KERNELS_H_
+
+#include <stdint.h>
+
+#include <libfreenect2/depth_packet_processor.h>
+
+namespace libfreenect2
+{
+
+/**
+ * Input and output rows of stage 1 (see CpuDepthPacketProcessorImpl::processPixelStage1()).
+ * All pointers point to the first pixel to process.
+ */
+struct CpuDepthStage1Row
+{
+  const int16_t *raw[9];   ///< Unpacked measurements, 3 phases of each of the 3 frequencies.
+  const float *trig[3][6]; ///< Trigonometry tables of each frequency (3 cos rows, followed by 3 sin rows).
+  const float *p0_trig[3][2]; ///< Compact tables of each frequency (cos(p0) and sin(p0) rows).
+  float phase_cos[3];      ///< cos of the 3 phases, for the compact tables.
+  float phase_sin[3];      ///< sin of the 3 phases, for the compact tables.
+  const float *z;          ///< Row of the z table.
+  float *out[9];           ///< IR a, IR b and IR amplitude of each frequency.
+};
+
+/**
+ * Input and output rows of stage 2 (see CpuDepthPacketProcessorImpl::processPixelStage2()).
+ * All pointers point to the first pixel to process.
+ */
+struct CpuDepthStage2Row
+{
+  const float *m[9];       ///< IR a, IR b and IR amplitude of each frequency.
+  const float *x, *z;      ///< Rows of the x and z tables.
+  float *ir;               ///< IR output, may be NULL.
+  float *depth;            ///< Depth output.
+  float *ir_sum;           ///< Sum of the amplitudes, may be NULL.
+  float *confidence;       ///< Unwrapping confidence, may be NULL.
+};
+
+/** Set of vectorized kernels for one instruction set. */
+struct CpuDepthKernels
+{
+  const char *name;
+  int width; ///< Number of pixels processed per instruction; kernels process multiples of it.
+
+  void (*stage1)(const DepthPacketProcessor::Parameters &params, const CpuDepthStage1Row &row, int n);
+  void (*stage1_compact)(const DepthPacketProcessor::Parameters &params, const CpuDepthStage1Row &row, int n); ///< stage1 with the compact tables.
+  void (*stage2)(const DepthPacketProcessor::Parameters &params, const CpuDepthStage2Row &row, int n);
+  void (*stage2_fast)(const DepthPacketProcessor::Parameters &params, const CpuDepthStage2Row &row, int n); ///< stage2 with approximated atan2 and sqrt.
+  void (*temporal)(float *state, float *depth, int n, float alpha, float max_jump); ///< Temporal depth filter (see DepthPacketProcessor::sendDepthFrame()).
+  void (*sincos)(const float *angle, float *cos_out, float *sin_out, int n); ///< cos and sin of angles below 8192 rad, for the trigonometry tables.
+};
+
+/**
+ * Unpack one row of a sub-image of a depth packet.
+ *
+ * A row stores the 512 11 bit values of its pixels as one little-endian bit
+ * stream, in the order x = 0, 4, 8, ..., 508, 1, 5, ..., 511. Every 11 bytes
+ * hold 8 values of the same quarter, so they are unpacked in groups of 8.
+ * The border columns 0 and 511 are invalid and get lut11to16[0].
+ * @param in Packed row of 704 bytes.
+ * @param lut11to16 Lookup table of DepthPacketProcessor::LUT_SIZE values.
+ * @param [out] out Row of 512 measurements.
+ */
+void unpackDepthRow(const unsigned char *in, const int16_t *lut11to16, int16_t *out);
+
+/* Each getter returns NULL if the kernels are not compiled for the target architecture. */
+const CpuDepthKernels *getSse41DepthKernels();
+const CpuDepthKernels *getAvx2DepthKernels();
+const CpuDepthKernels *getNeonDepthKernels();
+
+/**
+ * Pick the kernels of the CPU depth processor.
+ * @param requested Kernels from Freenect2Device::Config::DepthKernels. AutoKernels,
+ *        or kernels the running CPU does not support, select the best supported ones.
+ * @return NULL to use the scalar per-pixel implementation.
+ */
+const CpuDepthKernels *selectCpuDepthKernels(DepthPacketProcessor::Config::CpuKernels requested = DepthPacketProcessor::Config::AutoKernels);
+
+} /* namespace libfreenect2 */
+#endif /* CPU_DEPTH_KERNELS_H_ */
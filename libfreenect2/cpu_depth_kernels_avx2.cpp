@@ -0,0 +1,139 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+/** @file cpu_depth_kernels_avx2.cpp AVX2 kernels of the CPU depth processor. */
+
+#include <libfreenect2/cpu_depth_kernels.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+
+namespace libfreenect2
+{
+
+/** 8 float lanes in AVX registers. */
+struct VecAvx2
+{
+  typedef __m256 f;
+  typedef __m256 mask;
+  enum { Width = 8 };
+
+  static inline f load(const float *p) { return _mm256_loadu_ps(p); }
+  static inline void store(float *p, f v) { _mm256_storeu_ps(p, v); }
+  static inline f set1(float v) { return _mm256_set1_ps(v); }
+  static inline f cvt(const int16_t *p) { return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)))); }
+
+  static inline f add(f a, f b) { return _mm256_add_ps(a, b); }
+  static inline f sub(f a, f b) { return _mm256_sub_ps(a, b); }
+  static inline f mul(f a, f b) { return _mm256_mul_ps(a, b); }
+  static inline f div(f a, f b) { return _mm256_div_ps(a, b); }
+  static inline f min(f a, f b) { return _mm256_min_ps(a, b); }
+  static inline f max(f a, f b) { return _mm256_max_ps(a, b); }
+  static inline f sqrt(f a) { return _mm256_sqrt_ps(a); }
+  static inline f rsqrt(f a) { return _mm256_rsqrt_ps(a); }
+  static inline f floor(f a) { return _mm256_floor_ps(a); }
+  static inline f abs(f a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+
+  static inline mask lt(f a, f b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+  static inline mask le(f a, f b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+  static inline mask gt(f a, f b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+  static inline mask ge(f a, f b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+  static inline mask eq(f a, f b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+  static inline mask mand(mask a, mask b) { return _mm256_and_ps(a, b); }
+  static inline mask mor(mask a, mask b) { return _mm256_or_ps(a, b); }
+  static inline f select(mask m, f a, f b) { return _mm256_blendv_ps(b, a, m); }
+
+  static inline f pow2n(f n)
+  {
+    __m256i e = _mm256_add_epi32(_mm256_cvttps_epi32(n), _mm256_set1_epi32(127));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(e, 23));
+  }
+
+  static inline f frexp(f x, f &e)
+  {
+    __m256i bits = _mm256_castps_si256(x);
+    __m256i exponent = _mm256_and_si256(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(0xff));
+    e = _mm256_cvtepi32_ps(_mm256_sub_epi32(exponent, _mm256_set1_epi32(126)));
+    bits = _mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x807fffff)), _mm256_set1_epi32(0x3f000000));
+    return _mm256_castsi256_ps(bits);
+  }
+
+  /** Clear the upper halves of the ymm registers, so the SSE code of the caller does not pay for the AVX state. */
+  static inline void leave() { _mm256_zeroupper(); }
+};
+
+} /* namespace libfreenect2 */
+
+#include <libfreenect2/cpu_depth_kernels_impl.h>
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+namespace libfreenect2
+{
+
+const CpuDepthKernels *getAvx2DepthKernels()
+{
+  static const CpuDepthKernels kernels =
+  {
+    "avx2",
+    VecAvx2::Width,
+    processPixelStage1<VecAvx2, false>,
+    processPixelStage1<VecAvx2, true>,
+    processPixelStage2<VecAvx2, false>,
+    processPixelStage2<VecAvx2, true>,
+    filterPixelTemporal<VecAvx2>,
+    sinCos<VecAvx2>
+  };
+  return &kernels;
+}
+
+} /* namespace libfreenect2 */
+
+#else
+
+namespace libfreenect2
+{
+
+const CpuDepthKernels *getAvx2DepthKernels()
+{
+  return 0;
+}
+
+} /* namespace libfreenect2 */
+
+#endif
@@ -0,0 +1,468 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+/** @file cpu_depth_kernels_impl.h Generic implementation of the vectorized CPU depth kernels.
+ *
+ * The kernels are written against a vector type V which wraps the intrinsics
+ * of one instruction set. This file is included by one translation unit per
+ * instruction set, after that unit has enabled code generation for it, so it
+ * must only contain templates or declarations with internal linkage.
+ *
+ * V provides:
+ * - typedefs `f` (float vector) and `mask` (lane mask), enum `Width`,
+ * - load/store/set1 and cvt (load int16 as float),
+ * - add, sub, mul, div, min, max, sqrt, floor, abs,
+ * - rsqrt (estimate of 1 / sqrt with at least 11 bits),
+ * - lt, le, gt, ge, eq (ordered comparisons), mand, mor, select(mask, a, b),
+ * - pow2n (2^n for integral n) and frexp (mantissa in [0.5, 1) and exponent),
+ * - leave (called before each kernel returns to scalar code).
+ */
+
+#ifndef CPU_DEPTH_KERNELS_IMPL_H_
+#define CPU_DEPTH_KERNELS_IMPL_H_
+
+#include <libfreenect2/cpu_depth_kernels.h>
+
+namespace libfreenect2
+{
+namespace
+{
+
+/** 1 where @a m is set, 0 elsewhere. */
+template<typename V>
+inline typename V::f maskToFloat(typename V::mask m)
+{
+  return V::select(m, V::set1(1.0f), V::set1(0.0f));
+}
+
+/** Arc tangent for x >= 0, Cephes atanf. */
+template<typename V>
+inline typename V::f atanPositive(typename V::f x)
+{
+  typedef typename V::f f;
+
+  typename V::mask big = V::gt(x, V::set1(2.414213562373095f));
+  typename V::mask medium = V::mand(V::gt(x, V::set1(0.4142135623730950f)), V::le(x, V::set1(2.414213562373095f)));
+
+  f offset = V::select(big, V::set1(1.5707963267948966f), V::select(medium, V::set1(0.7853981633974483f), V::set1(0.0f)));
+  x = V::select(big, V::div(V::set1(-1.0f), x),
+      V::select(medium, V::div(V::sub(x, V::set1(1.0f)), V::add(x, V::set1(1.0f))), x));
+
+  f z = V::mul(x, x);
+  f y = V::set1(8.05374449538e-2f);
+  y = V::sub(V::mul(y, z), V::set1(1.38776856032e-1f));
+  y = V::add(V::mul(y, z), V::set1(1.99777106478e-1f));
+  y = V::sub(V::mul(y, z), V::set1(3.33329491539e-1f));
+  y = V::add(V::mul(V::mul(y, z), x), x);
+
+  return V::add(offset, y);
+}
+
+/**
+ * Phase angle of (x, y) in [0, 2 pi), like std::atan2() mapped to positive
+ * angles. Undefined angles (0, 0) return 0.
+ */
+template<typename V>
+inline typename V::f phaseAngle(typename V::f y, typename V::f x)
+{
+  typedef typename V::f f;
+
+  f t = atanPositive<V>(V::div(V::abs(y), V::abs(x)));
+  t = V::select(V::lt(x, V::set1(0.0f)), V::sub(V::set1(3.14159265358979f), t), t);
+  t = V::select(V::lt(y, V::set1(0.0f)), V::sub(V::set1(6.28318530717959f), t), t);
+
+  // 0/0 is NaN
+  return V::select(V::eq(t, t), t, V::set1(0.0f));
+}
+
+/**
+ * Faster phaseAngle() with a polynomial arc tangent on [0, 1]
+ * (Abramowitz and Stegun 4.4.49, error below 1e-5 rad).
+ */
+template<typename V>
+inline typename V::f fastPhaseAngle(typename V::f y, typename V::f x)
+{
+  typedef typename V::f f;
+
+  f abs_x = V::abs(x), abs_y = V::abs(y);
+  f r = V::div(V::min(abs_x, abs_y), V::max(abs_x, abs_y));
+  f s = V::mul(r, r);
+
+  f t = V::set1(0.0208351f);
+  t = V::add(V::mul(t, s), V::set1(-0.0851330f));
+  t = V::add(V::mul(t, s), V::set1(0.1801410f));
+  t = V::add(V::mul(t, s), V::set1(-0.3302995f));
+  t = V::add(V::mul(t, s), V::set1(0.9998660f));
+  t = V::mul(t, r);
+
+  t = V::select(V::gt(abs_y, abs_x), V::sub(V::set1(1.57079632679490f), t), t);
+  t = V::select(V::lt(x, V::set1(0.0f)), V::sub(V::set1(3.14159265358979f), t), t);
+  t = V::select(V::lt(y, V::set1(0.0f)), V::sub(V::set1(6.28318530717959f), t), t);
+
+  // 0/0 is NaN
+  return V::select(V::eq(t, t), t, V::set1(0.0f));
+}
+
+/** Square root from the reciprocal square root estimate and one Newton step, 0 for x <= 0. */
+template<typename V>
+inline typename V::f fastSqrt(typename V::f x)
+{
+  typedef typename V::f f;
+
+  f y = V::rsqrt(x);
+  y = V::mul(y, V::sub(V::set1(1.5f), V::mul(V::mul(V::set1(0.5f), x), V::mul(y, y))));
+
+  return V::select(V::gt(x, V::set1(0.0f)), V::mul(x, y), V::set1(0.0f));
+}
+
+/** Natural logarithm for x > 0, Cephes logf. */
+template<typename V>
+inline typename V::f logv(typename V::f x)
+{
+  typedef typename V::f f;
+
+  f e;
+  x = V::frexp(x, e);
+
+  typename V::mask small = V::lt(x, V::set1(0.707106781186547524f));
+  e = V::select(small, V::sub(e, V::set1(1.0f)), e);
+  x = V::sub(V::select(small, V::add(x, x), x), V::set1(1.0f));
+
+  f z = V::mul(x, x);
+  f y = V::set1(7.0376836292e-2f);
+  y = V::sub(V::mul(y, x), V::set1(1.1514610310e-1f));
+  y = V::add(V::mul(y, x), V::set1(1.1676998740e-1f));
+  y = V::sub(V::mul(y, x), V::set1(1.2420140846e-1f));
+  y = V::add(V::mul(y, x), V::set1(1.4249322787e-1f));
+  y = V::sub(V::mul(y, x), V::set1(1.6668057665e-1f));
+  y = V::add(V::mul(y, x), V::set1(2.0000714765e-1f));
+  y = V::sub(V::mul(y, x), V::set1(2.4999993993e-1f));
+  y = V::add(V::mul(y, x), V::set1(3.3333331174e-1f));
+  y = V::mul(V::mul(y, x), z);
+
+  y = V::add(y, V::mul(e, V::set1(-2.12194440e-4f)));
+  y = V::sub(y, V::mul(z, V::set1(0.5f)));
+  x = V::add(x, y);
+  return V::add(x, V::mul(e, V::set1(0.693359375f)));
+}
+
+/** Natural exponential, Cephes expf. */
+template<typename V>
+inline typename V::f expv(typename V::f x)
+{
+  typedef typename V::f f;
+
+  x = V::min(V::max(x, V::set1(-87.3365447505f)), V::set1(88.3762626647949f));
+
+  f fx = V::floor(V::add(V::mul(x, V::set1(1.44269504088896341f)), V::set1(0.5f)));
+  x = V::sub(x, V::mul(fx, V::set1(0.693359375f)));
+  x = V::add(x, V::mul(fx, V::set1(2.12194440e-4f)));
+
+  f z = V::mul(x, x);
+  f y = V::set1(1.9875691500e-4f);
+  y = V::add(V::mul(y, x), V::set1(1.3981999507e-3f));
+  y = V::add(V::mul(y, x), V::set1(8.3334519073e-3f));
+  y = V::add(V::mul(y, x), V::set1(4.1665795894e-2f));
+  y = V::add(V::mul(y, x), V::set1(1.6666665459e-1f));
+  y = V::add(V::mul(y, x), V::set1(5.0000001201e-1f));
+  y = V::add(V::add(V::mul(y, z), x), V::set1(1.0f));
+
+  return V::mul(y, V::pow2n(fx));
+}
+
+/**
+ * Vectorized CpuDepthPacketProcessorImpl::processMeasurementTriple().
+ * @tparam CompactTables Use the p0_trig rows instead of the trig rows.
+ */
+template<typename V, bool CompactTables>
+inline void processMeasurementTriple(const DepthPacketProcessor::Parameters &params, const CpuDepthStage1Row &row, int frq, int x)
+{
+  typedef typename V::f f;
+
+  f m0 = V::cvt(row.raw[frq * 3 + 0] + x);
+  f m1 = V::cvt(row.raw[frq * 3 + 1] + x);
+  f m2 = V::cvt(row.raw[frq * 3 + 2] + x);
+
+  f ir_image_a, ir_image_b;
+
+  if(CompactTables)
+  {
+    f c = V::add(V::add(V::mul(V::set1(row.phase_cos[0]), m0), V::mul(V::set1(row.phase_cos[1]), m1)), V::mul(V::set1(row.phase_cos[2]), m2));
+    f s = V::add(V::add(V::mul(V::set1(row.phase_sin[0]), m0), V::mul(V::set1(row.phase_sin[1]), m1)), V::mul(V::set1(row.phase_sin[2]), m2));
+    f cos_p0 = V::load(row.p0_trig[frq][0] + x), sin_p0 = V::load(row.p0_trig[frq][1] + x);
+
+    // the sums of the patent formula below with angle addition
+    ir_image_a = V::sub(V::mul(cos_p0, c), V::mul(sin_p0, s));
+    ir_image_b = V::sub(V::set1(0.0f), V::add(V::mul(sin_p0, c), V::mul(cos_p0, s)));
+  }
+  else
+  {
+    const float * const *trig = row.trig[frq];
+
+    // formula given in Patent US 8,587,771 B2
+    ir_image_a = V::add(V::add(V::mul(V::load(trig[0] + x), m0), V::mul(V::load(trig[1] + x), m1)), V::mul(V::load(trig[2] + x), m2));
+    ir_image_b = V::add(V::add(V::mul(V::load(trig[3] + x), m0), V::mul(V::load(trig[4] + x), m1)), V::mul(V::load(trig[5] + x), m2));
+  }
+
+  f ab_multiplier_per_frq = V::set1(params.ab_multiplier_per_frq[frq]);
+  ir_image_a = V::mul(ir_image_a, ab_multiplier_per_frq);
+  ir_image_b = V::mul(ir_image_b, ab_multiplier_per_frq);
+
+  f ir_amplitude = V::mul(V::sqrt(V::add(V::mul(ir_image_a, ir_image_a), V::mul(ir_image_b, ir_image_b))), V::set1(params.ab_multiplier));
+
+  f saturation = V::set1(32767.0f);
+  typename V::mask saturated = V::mor(V::mor(V::eq(m0, saturation), V::eq(m1, saturation)), V::eq(m2, saturation));
+  typename V::mask valid = V::lt(V::set1(0.0f), V::load(row.z + x));
+
+  f zero = V::set1(0.0f);
+  ir_image_a = V::select(saturated, zero, ir_image_a);
+  ir_image_b = V::select(saturated, zero, ir_image_b);
+  ir_amplitude = V::select(saturated, V::set1(65535.0f), ir_amplitude);
+
+  V::store(row.out[frq * 3 + 0] + x, V::select(valid, ir_image_a, zero));
+  V::store(row.out[frq * 3 + 1] + x, V::select(valid, ir_image_b, zero));
+  V::store(row.out[frq * 3 + 2] + x, V::select(valid, ir_amplitude, zero));
+}
+
+template<typename V, bool CompactTables>
+void processPixelStage1(const DepthPacketProcessor::Parameters &params, const CpuDepthStage1Row &row, int n)
+{
+  for(int x = 0; x < n; x += V::Width)
+  {
+    processMeasurementTriple<V, CompactTables>(params, row, 0, x);
+    processMeasurementTriple<V, CompactTables>(params, row, 1, x);
+    processMeasurementTriple<V, CompactTables>(params, row, 2, x);
+  }
+
+  V::leave();
+}
+
+/**
+ * Vectorized CpuDepthPacketProcessorImpl::processPixelStage2().
+ * @tparam FastMath Use fastPhaseAngle() and fastSqrt().
+ */
+template<typename V, bool FastMath>
+void processPixelStage2(const DepthPacketProcessor::Parameters &params, const CpuDepthStage2Row &row, int n)
+{
+  typedef typename V::f f;
+  typedef typename V::mask mask;
+
+  const f zero = V::set1(0.0f);
+  const f two_pi = V::set1(6.28318530717959f);
+
+  for(int x = 0; x < n; x += V::Width)
+  {
+    f phase0, phase1, phase2, ir0, ir1, ir2;
+    {
+      f a = V::load(row.m[0] + x), b = V::load(row.m[1] + x);
+      f norm2 = V::add(V::mul(a, a), V::mul(b, b));
+      phase0 = FastMath ? fastPhaseAngle<V>(b, a) : phaseAngle<V>(b, a);
+      ir0 = V::mul(FastMath ? fastSqrt<V>(norm2) : V::sqrt(norm2), V::set1(params.ab_multiplier));
+    }
+    {
+      f a = V::load(row.m[3] + x), b = V::load(row.m[4] + x);
+      f norm2 = V::add(V::mul(a, a), V::mul(b, b));
+      phase1 = FastMath ? fastPhaseAngle<V>(b, a) : phaseAngle<V>(b, a);
+      ir1 = V::mul(FastMath ? fastSqrt<V>(norm2) : V::sqrt(norm2), V::set1(params.ab_multiplier));
+    }
+    {
+      f a = V::load(row.m[6] + x), b = V::load(row.m[7] + x);
+      f norm2 = V::add(V::mul(a, a), V::mul(b, b));
+      phase2 = FastMath ? fastPhaseAngle<V>(b, a) : phaseAngle<V>(b, a);
+      ir2 = V::mul(FastMath ? fastSqrt<V>(norm2) : V::sqrt(norm2), V::set1(params.ab_multiplier));
+    }
+
+    f ir_sum = V::add(V::add(ir0, ir1), ir2);
+    f ir_min = V::min(V::min(ir0, ir1), ir2);
+    f ir_max = V::max(V::max(ir0, ir1), ir2);
+
+    mask invalid = V::mor(V::lt(ir_min, V::set1(params.individual_ab_threshold)), V::lt(ir_sum, V::set1(params.ab_threshold)));
+
+    f t0 = V::mul(V::div(phase0, two_pi), V::set1(3.0f));
+    f t1 = V::mul(V::div(phase1, two_pi), V::set1(15.0f));
+    f t2 = V::mul(V::div(phase2, two_pi), V::set1(2.0f));
+
+    f t5 = V::add(V::mul(V::floor(V::add(V::mul(V::sub(t1, t0), V::set1(0.333333f)), V::set1(0.5f))), V::set1(3.0f)), t0);
+    f t3 = V::sub(t5, t2);
+    f t4 = V::add(t3, t3);
+
+    mask c1 = V::ge(t4, V::sub(zero, t4)); // true if t4 positive
+
+    f f1 = V::select(c1, V::set1(2.0f), V::set1(-2.0f));
+    f f2 = V::select(c1, V::set1(0.5f), V::set1(-0.5f));
+    t3 = V::mul(t3, f2);
+    t3 = V::mul(V::sub(t3, V::floor(t3)), f1);
+
+    f abs_t3 = V::abs(t3);
+    mask c2 = V::mand(V::lt(V::set1(0.5f), abs_t3), V::lt(abs_t3, V::set1(1.5f)));
+
+    f t6 = V::select(c2, V::add(t5, V::set1(15.0f)), t5);
+    f t7 = V::select(c2, V::add(t1, V::set1(15.0f)), t1);
+
+    f t8 = V::mul(V::add(V::mul(V::floor(V::add(V::mul(V::sub(t6, t2), V::set1(0.5f)), V::set1(0.5f))), V::set1(2.0f)), t2), V::set1(0.5f));
+
+    t6 = V::mul(t6, V::set1(0.333333f)); // = / 3
+    t7 = V::mul(t7, V::set1(0.066667f)); // = / 15
+
+    f t9 = V::add(V::add(t8, t6), t7); // transformed phase measurements
+    f t10 = V::mul(t9, V::set1(0.333333f));
+
+    t6 = V::mul(t6, two_pi);
+    t7 = V::mul(t7, two_pi);
+    t8 = V::mul(t8, two_pi);
+
+    // some cross product
+    f t8_new = V::sub(V::mul(t7, V::set1(0.826977f)), V::mul(t8, V::set1(0.110264f)));
+    f t6_new = V::sub(V::mul(t8, V::set1(0.551318f)), V::mul(t6, V::set1(0.826977f)));
+    f t7_new = V::sub(V::mul(t6, V::set1(0.110264f)), V::mul(t7, V::set1(0.551318f)));
+
+    f norm = V::add(V::add(V::mul(t8_new, t8_new), V::mul(t6_new, t6_new)), V::mul(t7_new, t7_new));
+    t10 = V::mul(t10, maskToFloat<V>(V::ge(t9, zero)));
+
+    f ir_x = 0 < params.ab_confidence_slope ? ir_min : ir_max;
+
+    ir_x = logv<V>(ir_x);
+    ir_x = V::mul(V::add(V::mul(ir_x, V::set1(params.ab_confidence_slope * 0.301030f)), V::set1(params.ab_confidence_offset)), V::set1(3.321928f));
+    ir_x = expv<V>(ir_x);
+    ir_x = V::min(V::set1(params.max_dealias_confidence), V::max(V::set1(params.min_dealias_confidence), ir_x));
+    ir_x = V::mul(ir_x, ir_x);
+
+    f phase_final = V::mul(t10, maskToFloat<V>(V::ge(ir_x, norm)));
+    phase_final = V::select(invalid, zero, phase_final);
+
+    if(row.confidence != 0)
+      V::store(row.confidence + x, V::select(V::lt(zero, phase_final), V::sub(V::set1(1.0f), V::div(norm, ir_x)), zero));
+
+    // this seems to be the phase to depth mapping :)
+    f zmultiplier = V::load(row.z + x);
+    f xmultiplier = V::load(row.x + x);
+
+    phase_final = V::select(V::lt(zero, phase_final), V::add(phase_final, V::set1(params.phase_offset)), phase_final);
+
+    f depth_linear = V::mul(zmultiplier, phase_final);
+    f max_depth = V::mul(V::mul(phase_final, V::set1(params.unambigious_dist)), V::set1(2.0f));
+
+    mask cond1 = V::mand(V::lt(zero, depth_linear), V::lt(zero, max_depth));
+
+    xmultiplier = V::div(V::mul(xmultiplier, V::set1(90.0f)), V::mul(V::mul(max_depth, max_depth), V::set1(8192.0f)));
+
+    f depth_fit = V::div(depth_linear, V::add(V::mul(V::sub(zero, depth_linear), xmultiplier), V::set1(1.0f)));
+    depth_fit = V::select(V::lt(depth_fit, zero), zero, depth_fit);
+
+    V::store(row.depth + x, V::select(cond1, depth_fit, depth_linear));
+
+    if(row.ir_sum != 0)
+      V::store(row.ir_sum + x, ir_sum);
+
+    if(row.ir != 0)
+    {
+      f amplitude = V::add(V::add(V::load(row.m[2] + x), V::load(row.m[5] + x)), V::load(row.m[8] + x));
+      V::store(row.ir + x, V::min(V::mul(V::mul(amplitude, V::set1(0.3333333f)), V::set1(params.ab_output_multiplier)), V::set1(65535.0f)));
+    }
+  }
+
+  V::leave();
+}
+
+/**
+ * Temporal filter of a depth row, see DepthPacketProcessor::sendDepthFrame().
+ * @param n Number of pixels, a multiple of V::Width.
+ */
+template<typename V>
+void filterPixelTemporal(float *state, float *depth, int n, float alpha, float max_jump)
+{
+  typedef typename V::f f;
+  typedef typename V::mask mask;
+
+  const f zero = V::set1(0.0f);
+
+  for(int x = 0; x < n; x += V::Width)
+  {
+    f d = V::load(depth + x), s = V::load(state + x);
+
+    mask valid = V::lt(zero, d);
+    mask reset = V::mor(V::le(s, zero), V::gt(V::abs(V::sub(d, s)), V::mul(d, V::set1(max_jump))));
+    f filtered = V::select(reset, d, V::add(s, V::mul(V::set1(alpha), V::sub(d, s))));
+
+    V::store(state + x, V::select(valid, filtered, s));
+    V::store(depth + x, V::select(valid, filtered, d));
+  }
+
+  V::leave();
+}
+
+/**
+ * cos and sin of a row of angles, Cephes sinf and cosf.
+ * Accurate to about 1 ulp for |angle| < 8192.
+ * @param n Number of angles, a multiple of V::Width.
+ */
+template<typename V>
+void sinCos(const float *angle, float *cos_out, float *sin_out, int n)
+{
+  typedef typename V::f f;
+  typedef typename V::mask mask;
+
+  for(int i = 0; i < n; i += V::Width)
+  {
+    f x = V::load(angle + i);
+    f ax = V::abs(x);
+
+    // j: floor(ax / (pi / 4)) rounded up to even, q: quadrant (j / 2) mod 4
+    f j = V::floor(V::mul(ax, V::set1(1.27323954473516f)));
+    j = V::add(j, V::sub(j, V::mul(V::floor(V::mul(j, V::set1(0.5f))), V::set1(2.0f))));
+    f q = V::sub(V::mul(j, V::set1(0.5f)), V::mul(V::floor(V::mul(j, V::set1(0.125f))), V::set1(4.0f)));
+
+    // extended precision ax - j * pi / 4
+    f r = V::sub(ax, V::mul(j, V::set1(0.78515625f)));
+    r = V::sub(r, V::mul(j, V::set1(2.4187564849853515625e-4f)));
+    r = V::sub(r, V::mul(j, V::set1(3.77489497744594108e-8f)));
+
+    f z = V::mul(r, r);
+    f yc = V::set1(2.443315711809948e-5f);
+    yc = V::sub(V::mul(yc, z), V::set1(1.388731625493765e-3f));
+    yc = V::add(V::mul(yc, z), V::set1(4.166664568298827e-2f));
+    yc = V::add(V::sub(V::mul(V::mul(yc, z), z), V::mul(z, V::set1(0.5f))), V::set1(1.0f));
+    f ys = V::set1(-1.9515295891e-4f);
+    ys = V::add(V::mul(ys, z), V::set1(8.3321608736e-3f));
+    ys = V::sub(V::mul(ys, z), V::set1(1.6666654611e-1f));
+    ys = V::add(V::mul(V::mul(ys, z), r), r);
+
+    mask swap = V::mor(V::eq(q, V::set1(1.0f)), V::eq(q, V::set1(3.0f)));
+    f cos_sign = V::select(V::mor(V::eq(q, V::set1(1.0f)), V::eq(q, V::set1(2.0f))), V::set1(-1.0f), V::set1(1.0f));
+    // sin is odd
+    f sin_sign = V::mul(V::select(V::ge(q, V::set1(2.0f)), V::set1(-1.0f), V::set1(1.0f)),
+                        V::select(V::lt(x, V::set1(0.0f)), V::set1(-1.0f), V::set1(1.0f)));
+
+    V::store(cos_out + i, V::mul(V::select(swap, ys, yc), cos_sign));
+    V::store(sin_out + i, V::mul(V::select(swap, yc, ys), sin_sign));
+  }
+
+  V::leave();
+}
+
+} /* namespace */
+} /* namespace libfreenect2 */
+#endif /* CPU_DEPTH_KERNELS_IMPL_H_ */
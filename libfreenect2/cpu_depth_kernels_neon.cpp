@@ -0,0 +1,131 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+/** @file cpu_depth_kernels_neon.cpp NEON kernels of the CPU depth processor. */
+
+#include <libfreenect2/cpu_depth_kernels.h>
+
+// ARMv7 NEON lacks vector division, square root and rounding
+#if defined(__aarch64__)
+
+#include <arm_neon.h>
+
+namespace libfreenect2
+{
+
+/** 4 float lanes in NEON registers. */
+struct VecNeon
+{
+  typedef float32x4_t f;
+  typedef uint32x4_t mask;
+  enum { Width = 4 };
+
+  static inline f load(const float *p) { return vld1q_f32(p); }
+  static inline void store(float *p, f v) { vst1q_f32(p, v); }
+  static inline f set1(float v) { return vdupq_n_f32(v); }
+  static inline f cvt(const int16_t *p) { return vcvtq_f32_s32(vmovl_s16(vld1_s16(p))); }
+
+  static inline f add(f a, f b) { return vaddq_f32(a, b); }
+  static inline f sub(f a, f b) { return vsubq_f32(a, b); }
+  static inline f mul(f a, f b) { return vmulq_f32(a, b); }
+  static inline f div(f a, f b) { return vdivq_f32(a, b); }
+  static inline f min(f a, f b) { return vminq_f32(a, b); }
+  static inline f max(f a, f b) { return vmaxq_f32(a, b); }
+  static inline f sqrt(f a) { return vsqrtq_f32(a); }
+  static inline f rsqrt(f a)
+  {
+    // the estimate has 8 bits, one step gets past the 11 the kernels expect
+    f e = vrsqrteq_f32(a);
+    return vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(a, e), e));
+  }
+  static inline f floor(f a) { return vrndmq_f32(a); }
+  static inline f abs(f a) { return vabsq_f32(a); }
+
+  static inline mask lt(f a, f b) { return vcltq_f32(a, b); }
+  static inline mask le(f a, f b) { return vcleq_f32(a, b); }
+  static inline mask gt(f a, f b) { return vcgtq_f32(a, b); }
+  static inline mask ge(f a, f b) { return vcgeq_f32(a, b); }
+  static inline mask eq(f a, f b) { return vceqq_f32(a, b); }
+  static inline mask mand(mask a, mask b) { return vandq_u32(a, b); }
+  static inline mask mor(mask a, mask b) { return vorrq_u32(a, b); }
+  static inline f select(mask m, f a, f b) { return vbslq_f32(m, a, b); }
+
+  static inline f pow2n(f n)
+  {
+    int32x4_t e = vaddq_s32(vcvtq_s32_f32(n), vdupq_n_s32(127));
+    return vreinterpretq_f32_s32(vshlq_n_s32(e, 23));
+  }
+
+  static inline f frexp(f x, f &e)
+  {
+    uint32x4_t bits = vreinterpretq_u32_f32(x);
+    int32x4_t exponent = vreinterpretq_s32_u32(vandq_u32(vshrq_n_u32(bits, 23), vdupq_n_u32(0xff)));
+    e = vcvtq_f32_s32(vsubq_s32(exponent, vdupq_n_s32(126)));
+    bits = vorrq_u32(vandq_u32(bits, vdupq_n_u32(0x807fffff)), vdupq_n_u32(0x3f000000));
+    return vreinterpretq_f32_u32(bits);
+  }
+
+  static inline void leave() {}
+};
+
+} /* namespace libfreenect2 */
+
+#include <libfreenect2/cpu_depth_kernels_impl.h>
+
+namespace libfreenect2
+{
+
+const CpuDepthKernels *getNeonDepthKernels()
+{
+  static const CpuDepthKernels kernels =
+  {
+    "neon",
+    VecNeon::Width,
+    processPixelStage1<VecNeon, false>,
+    processPixelStage1<VecNeon, true>,
+    processPixelStage2<VecNeon, false>,
+    processPixelStage2<VecNeon, true>,
+    filterPixelTemporal<VecNeon>,
+    sinCos<VecNeon>
+  };
+  return &kernels;
+}
+
+} /* namespace libfreenect2 */
+
+#else
+
+namespace libfreenect2
+{
+
+const CpuDepthKernels *getNeonDepthKernels()
+{
+  return 0;
+}
+
+} /* namespace libfreenect2 */
+
+#endif
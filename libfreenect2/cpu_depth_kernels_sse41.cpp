@@ -0,0 +1,138 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+/** @file cpu_depth_kernels_sse41.cpp SSE4.1 kernels of the CPU depth processor. */
+
+#include <libfreenect2/cpu_depth_kernels.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <smmintrin.h>
+
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("sse4.1"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+#endif
+
+namespace libfreenect2
+{
+
+/** 4 float lanes in SSE registers. */
+struct VecSse41
+{
+  typedef __m128 f;
+  typedef __m128 mask;
+  enum { Width = 4 };
+
+  static inline f load(const float *p) { return _mm_loadu_ps(p); }
+  static inline void store(float *p, f v) { _mm_storeu_ps(p, v); }
+  static inline f set1(float v) { return _mm_set1_ps(v); }
+  static inline f cvt(const int16_t *p) { return _mm_cvtepi32_ps(_mm_cvtepi16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(p)))); }
+
+  static inline f add(f a, f b) { return _mm_add_ps(a, b); }
+  static inline f sub(f a, f b) { return _mm_sub_ps(a, b); }
+  static inline f mul(f a, f b) { return _mm_mul_ps(a, b); }
+  static inline f div(f a, f b) { return _mm_div_ps(a, b); }
+  static inline f min(f a, f b) { return _mm_min_ps(a, b); }
+  static inline f max(f a, f b) { return _mm_max_ps(a, b); }
+  static inline f sqrt(f a) { return _mm_sqrt_ps(a); }
+  static inline f rsqrt(f a) { return _mm_rsqrt_ps(a); }
+  static inline f floor(f a) { return _mm_floor_ps(a); }
+  static inline f abs(f a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+
+  static inline mask lt(f a, f b) { return _mm_cmplt_ps(a, b); }
+  static inline mask le(f a, f b) { return _mm_cmple_ps(a, b); }
+  static inline mask gt(f a, f b) { return _mm_cmpgt_ps(a, b); }
+  static inline mask ge(f a, f b) { return _mm_cmpge_ps(a, b); }
+  static inline mask eq(f a, f b) { return _mm_cmpeq_ps(a, b); }
+  static inline mask mand(mask a, mask b) { return _mm_and_ps(a, b); }
+  static inline mask mor(mask a, mask b) { return _mm_or_ps(a, b); }
+  static inline f select(mask m, f a, f b) { return _mm_blendv_ps(b, a, m); }
+
+  static inline f pow2n(f n)
+  {
+    __m128i e = _mm_add_epi32(_mm_cvttps_epi32(n), _mm_set1_epi32(127));
+    return _mm_castsi128_ps(_mm_slli_epi32(e, 23));
+  }
+
+  static inline f frexp(f x, f &e)
+  {
+    __m128i bits = _mm_castps_si128(x);
+    __m128i exponent = _mm_and_si128(_mm_srli_epi32(bits, 23), _mm_set1_epi32(0xff));
+    e = _mm_cvtepi32_ps(_mm_sub_epi32(exponent, _mm_set1_epi32(126)));
+    bits = _mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x807fffff)), _mm_set1_epi32(0x3f000000));
+    return _mm_castsi128_ps(bits);
+  }
+
+  static inline void leave() {}
+};
+
+} /* namespace libfreenect2 */
+
+#include <libfreenect2/cpu_depth_kernels_impl.h>
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+namespace libfreenect2
+{
+
+const CpuDepthKernels *getSse41DepthKernels()
+{
+  static const CpuDepthKernels kernels =
+  {
+    "sse4.1",
+    VecSse41::Width,
+    processPixelStage1<VecSse41, false>,
+    processPixelStage1<VecSse41, true>,
+    processPixelStage2<VecSse41, false>,
+    processPixelStage2<VecSse41, true>,
+    filterPixelTemporal<VecSse41>,
+    sinCos<VecSse41>
+  };
+  return &kernels;
+}
+
+} /* namespace libfreenect2 */
+
+#else
+
+namespace libfreenect2
+{
+
+const CpuDepthKernels *getSse41DepthKernels()
+{
+  return 0;
+}
+
+} /* namespace libfreenect2 */
+
+#endif
@@ -29,6 +29,8 @@
 #include <libfreenect2/depth_packet_processor.h>
 #include <libfreenect2/protocol/response.h>
 #include <libfreenect2/logging.h>
+#include <libfreenect2/worker_pool.h>
+#include <libfreenect2/cpu_depth_kernels.h>
 
 #include <fstream>
 
@@ -37,19 +39,26 @@
 #define _USE_MATH_DEFINES
 #include <math.h>
 
+#include <algorithm>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <limits>
+#include <string>
+#include <vector>
 
-/**
- * Vector class.
- * @tparam ScalarT Type of the elements.
- * @tparam Size Number of elements in the vector.
- */
-template<typename ScalarT, int Size>
-struct Vec
-{
-  ScalarT val[Size];
-};
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+#ifdef __APPLE__
+#include <mach/vm_statistics.h>
+#endif
 
 /**
  * Matrix class.
@@ -59,7 +68,10 @@ template<typename ScalarT>
 struct Mat
 {
 private:
+  static const size_t ALIGNMENT = 64; ///< Alignment of owned buffers, a cache line.
+
   bool owns_buffer; ///< Whether the matrix owns the data buffer (and should dispose it when deleted).
+  unsigned char *allocation_; ///< Allocated memory containing the owned buffer.
   unsigned char *buffer_; ///< Data buffer of the matrix (row major).
   unsigned char *buffer_end_; ///< End of the buffer (just after the last element).
   int width_;  ///< Number of elements in the matrix.
@@ -84,10 +96,12 @@ private:
 
     if(owns_buffer)
     {
-      buffer_ = new unsigned char[y_step * height];
+      allocation_ = new unsigned char[y_step * height + ALIGNMENT - 1];
+      buffer_ = allocation_ + (ALIGNMENT - 1 - (reinterpret_cast<size_t>(allocation_) + ALIGNMENT - 1) % ALIGNMENT);
     }
     else
     {
+      allocation_ = 0;
       buffer_ = external_buffer;
     }
     buffer_end_ = buffer_ + (y_step * height);
@@ -97,8 +111,9 @@ private:
   {
     if(owns_buffer && buffer_ != 0)
     {
-      delete[] buffer_;
+      delete[] allocation_;
       owns_buffer = false;
+      allocation_ = 0;
       buffer_ = 0;
       buffer_end_ = 0;
     }
@@ -106,7 +121,7 @@ private:
 
 public:
   /** Default constructor. */
-  Mat():buffer_(0), buffer_end_(0)
+  Mat():owns_buffer(false), allocation_(0), buffer_(0), buffer_end_(0), width_(0), height_(0), x_step(0), y_step(0)
   {
   }
 
@@ -115,7 +130,7 @@ public:
    * @param height Height of the image.
    * @param width Width of the image.
    */
-  Mat(int height, int width) : owns_buffer(false), buffer_(0)
+  Mat(int height, int width) : owns_buffer(false), allocation_(0), buffer_(0)
   {
     create(height, width);
   }
@@ -161,11 +176,12 @@ public:
    * Construct a new image buffer
    * @param height Height of the new image.
    * @param width Width of the new image.
+   * @param external_buffer If not \c null, use the provided buffer, else make a new one.
    */
-  void create(int height, int width)
+  void create(int height, int width, unsigned char *external_buffer = 0)
   {
     deallocate();
-    allocate(width, height);
+    allocate(width, height, external_buffer);
   }
 
   /**
@@ -229,6 +245,87 @@ public:
   }
 };
 
+/**
+ * Planar (structure of arrays) image of 512 pixel wide planes.
+ * Every plane is contiguous and every row starts on a cache line, so
+ * each stage only streams the planes it needs. The planes either hold the
+ * whole image or a window of consecutive rows, which is addressed with
+ * image row numbers as well.
+ * @tparam ScalarT Element type of the planes.
+ */
+template<typename ScalarT>
+struct Planes
+{
+  Mat<ScalarT> data; ///< All planes, #height rows per plane.
+  int y_begin;       ///< Image row of the first row of the window.
+  int height;        ///< Number of rows of each plane.
+
+  Planes() : y_begin(0), height(0)
+  {
+  }
+
+  /**
+   * Get the size of a buffer for planes.
+   * @param num_planes Number of planes.
+   * @param height Number of rows of each plane.
+   * @return Number of bytes, a multiple of 64.
+   */
+  static size_t sizeInBytes(int num_planes, int height = 424)
+  {
+    return size_t(num_planes) * height * 512 * sizeof(ScalarT);
+  }
+
+  /**
+   * Allocate the planes, starting at image row 0.
+   * @param num_planes Number of planes.
+   * @param height Number of rows of each plane.
+   * @param external_buffer If not \c null, use the provided buffer of sizeInBytes() bytes.
+   */
+  void create(int num_planes, int height = 424, unsigned char *external_buffer = 0)
+  {
+    this->height = height;
+    y_begin = 0;
+    data.create(num_planes * height, 512, external_buffer);
+  }
+
+  /**
+   * Move the window down to start at image row \a y. The rows the old and
+   * new window have in common keep their content.
+   * @param y New first image row, not smaller than the current one.
+   */
+  void slide(int y)
+  {
+    const int keep = y_begin + height - y;
+
+    if(y != y_begin && keep > 0)
+    {
+      for(int plane = 0; plane < data.height() / height; ++plane)
+        std::memmove(data.ptr(plane * height, 0), row(plane, y), keep * 512 * sizeof(ScalarT));
+    }
+    y_begin = y;
+  }
+
+  ScalarT *row(int plane, int y)
+  {
+    return data.ptr(plane * height + y - y_begin, 0);
+  }
+
+  const ScalarT *row(int plane, int y) const
+  {
+    return data.ptr(plane * height + y - y_begin, 0);
+  }
+
+  ScalarT &at(int plane, int y, int x)
+  {
+    return *data.ptr(plane * height + y - y_begin, x);
+  }
+
+  const ScalarT &at(int plane, int y, int x) const
+  {
+    return *data.ptr(plane * height + y - y_begin, x);
+  }
+};
+
 /**
  * Copy and flip buffer upside-down (upper part to bottom, bottom part to top).
  * @tparam ScalarT Type of the element of the buffer.
@@ -266,320 +363,1720 @@ inline int bfi(int width, int offset, int src2, int src3)
   return ((src2 << offset) & bitmask) | (src3 & ~bitmask);
 }
 
+/**
+ * Phase angle of (x, y) in [0, 2 pi), like std::atan2() mapped to positive
+ * angles, with a polynomial arc tangent on [0, 1] (Abramowitz and Stegun
+ * 4.4.49, error below 1e-5 rad). Undefined angles (0, 0) return 0.
+ */
+inline float fastPhaseAngle(float y, float x)
+{
+  float abs_x = std::abs(x), abs_y = std::abs(y);
+  float r = std::min(abs_x, abs_y) / std::max(abs_x, abs_y);
+  float s = r * r;
+
+  float t = r * (0.9998660f + s * (-0.3302995f + s * (0.1801410f + s * (-0.0851330f + s * 0.0208351f))));
+
+  t = abs_y > abs_x ? 1.57079632679490f - t : t;
+  t = x < 0.0f ? 3.14159265358979f - t : t;
+  t = y < 0.0f ? 6.28318530717959f - t : t;
+
+  return t == t ? t : 0.0f;
+}
+
+/**
+ * 1 / sqrt(x) for x >= 0 from the hardware estimate and Newton steps,
+ * relative error below 1e-6. Infinity for 0 like the exact division.
+ */
+inline float fastRsqrt(float x)
+{
+  if(x == 0.0f)
+    return std::numeric_limits<float>::infinity();
+
+#if defined(__SSE__)
+  float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+  return y * (1.5f - 0.5f * x * y * y);
+#elif defined(__aarch64__)
+  float y = vrsqrtes_f32(x);
+  y = y * vrsqrtss_f32(x * y, y);
+  return y * vrsqrtss_f32(x * y, y);
+#else
+  return 1.0f / std::sqrt(x);
+#endif
+}
+
+/** 2^x with a polynomial for the fractional part, relative error below 1e-5. */
+inline float fastExp2(float x)
+{
+  x = std::min(std::max(x, -126.0f), 127.0f);
+
+  // adding 1.5 * 2^23 rounds to the nearest integer, which ends up in the low mantissa bits
+  float t = x + 12582912.0f;
+  float f = x - (t - 12582912.0f);
+
+  uint32_t bits;
+  std::memcpy(&bits, &t, sizeof(bits));
+  bits = (bits + 127) << 23;
+
+  float scale;
+  std::memcpy(&scale, &bits, sizeof(scale));
+
+  float p = 1.0f + f * (0.6931472f + f * (0.2402265f + f * (0.05550411f + f * (0.009618129f + f * 0.001333355f))));
+  return p * scale;
+}
+
+void unpackDepthRow(const unsigned char *in, const int16_t *lut11to16, int16_t *out)
+{
+  for(int group = 0; group < 64; ++group, in += 11)
+  {
+    uint64_t lo;
+    uint32_t hi;
+    // bits 0..63 and 56..87 of the group
+    std::memcpy(&lo, in, sizeof(lo));
+    std::memcpy(&hi, in + 7, sizeof(hi));
+
+    int16_t *o = out + (group & 15) * 32 + (group >> 4);
+
+    o[0]  = lut11to16[lo & 2047];
+    o[4]  = lut11to16[(lo >> 11) & 2047];
+    o[8]  = lut11to16[(lo >> 22) & 2047];
+    o[12] = lut11to16[(lo >> 33) & 2047];
+    o[16] = lut11to16[(lo >> 44) & 2047];
+    o[20] = lut11to16[((lo >> 55) | (hi << 1)) & 2047];
+    o[24] = lut11to16[(hi >> 10) & 2047];
+    o[28] = lut11to16[(hi >> 21) & 2047];
+  }
+
+  // the border columns are invalid
+  out[0] = lut11to16[0];
+  out[511] = lut11to16[0];
+}
+
+/**
+ * Phase unwrapping hypotheses ranked by the KDE processing, the numbers of
+ * periods (k, n, m) of the three modulation frequencies for every hypothesis.
+ */
+static const int KDE_NUM_HYPOTHESES = 30;
+static const float kde_k_list[KDE_NUM_HYPOTHESES] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1};
+static const float kde_n_list[KDE_NUM_HYPOTHESES] = {0, 0, 1, 1, 2, 1, 2, 2, 3, 3, 4, 4, 3, 4, 4, 5, 5, 5, 6, 5, 6, 6, 7, 7, 8, 8, 7, 8, 9, 9};
+static const float kde_m_list[KDE_NUM_HYPOTHESES] = {0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13, 14};
+
 class CpuDepthPacketProcessorImpl: public WithPerfLogging
 {
 public:
   Mat<uint16_t> p0_table0, p0_table1, p0_table2;
   Mat<float> x_table, z_table;
+  Mat<float> binned_x_table, binned_z_table; ///< Tables of stage 2 when binning, see DepthPacketProcessor::binXZTables().
 
   int16_t lut11to16[2048];
 
-  float trig_table0[512*424][6];
-  float trig_table1[512*424][6];
-  float trig_table2[512*424][6];
+  static const int NUM_MEASUREMENTS = 9; ///< Sub-images used by stage 1; the 10th is not used.
+  Planes<int16_t> measurements; ///< Unpacked sub-images after lut11to16.
+
+  /** Trigonometry tables of one frequency, 3 cos tables followed by 3 sin tables; planar, so the vectorized kernels can load consecutive pixels. */
+  typedef float TrigTable[6][512*424];
+  TrigTable *trig_tables; ///< Tables of the 3 frequencies, NULL unless used, see #compact_trig_tables.
+
+  /**
+   * cos(p0) and sin(p0) of each frequency, a third of the size of #trig_tables.
+   * Stage 1 adds the phases with angle addition.
+   */
+  float p0_trig_tables[3][2][512*424];
+  float phase_cos[3], phase_sin[3]; ///< cos and sin of #phase_in_rad parameters.
+
+  bool compact_trig_tables; ///< Use #p0_trig_tables instead of #trig_tables, Config::EnableCompactTrigTables.
 
   bool enable_bilateral_filter, enable_edge_filter;
   DepthPacketProcessor::Parameters params;
 
-  Frame *ir_frame, *depth_frame;
+  Frame *ir_frame, *depth_frame, *confidence_frame;
 
   bool flip_ptables;
 
+
+  // intermediate buffers, allocated once in #buffers and reused for every packet
+  Planes<float> m;                   ///< IR a, IR b and IR amplitude of each frequency.
+  Planes<float> m_filtered;          ///< Bilateral filtered IR a and IR b of each frequency.
+  Planes<float> depth_ir_sum;        ///< Raw depth, raw depth passing the max edge test and amplitude sum.
+  Mat<unsigned char> m_max_edge_test;
+
+  unsigned char *buffers;
+  size_t buffers_size;
+  bool buffers_mapped; ///< Whether #buffers was allocated with mmap() instead of new[].
+  bool huge_pages;     ///< Whether #buffers were asked for with huge pages, Config::EnableHugePages.
+
+  /** Rectangle in processing order, columns [x_begin, x_end) of rows [y_begin, y_end); rows are flipped in the output images. */
+  struct Region
+  {
+    int x_begin, x_end, y_begin, y_end;
+
+    /**
+     * Grow the region by a border, within the image.
+     * @param border Pixels added on each side.
+     * @param align The columns are rounded out to multiples of it, for the vectorized kernels.
+     * @param width Width of the image.
+     * @param height Height of the image.
+     */
+    Region grow(int border, int align, int width, int height) const
+    {
+      Region r;
+      r.x_begin = std::max(x_begin - border, 0) / align * align;
+      r.x_end = std::min((x_end + border + align - 1) / align * align, width);
+      r.y_begin = std::max(y_begin - border, 0);
+      r.y_end = std::min(y_end + border, height);
+      return r;
+    }
+  };
+
+  bool enable_binning; ///< Average 2x2 blocks of the stage 1 output, the later stages process 256x212 images.
+  int width, height;   ///< Size of the images of stage 2, the filters and the output, 512x424 or 256x212 when binning.
+
+  Region roi;           ///< Pixels of the output images, set by setRoi().
+  Region stage2_region; ///< Pixels of stage 2 and the bilateral filter, #roi and the halo of the edge-aware or KDE filter.
+  Region stage1_region; ///< Pixels of stage 1, #stage2_region and the halo of the bilateral filter.
+  Region raw_region;    ///< Measurements stage 1 processes, #stage1_region at full resolution.
+
+  bool enable_tiled_processing; ///< Use processBandTiled() instead of processStages().
+  bool output_ir; ///< Whether the listener takes IR frames, set for each packet; stage 2 skips the IR otherwise.
+  bool output_confidence; ///< Whether the listener takes confidence frames, set for each packet.
+  Mat<float> out_confidence; ///< Confidence image, on the data of #confidence_frame.
+  bool enable_fast_math; ///< Approximate atan2, sqrt and exp in stage 2 and the bilateral filter.
+  bool enable_dealias_lut; ///< Take the wrap counts of the per-pixel stage 2 from #dealias_lut instead of rounding. The vectorized kernels compute them faster than per-lane lookups.
+
+  /** Cells of #dealias_lut along t1 - t0 and t0 - t2, see dealiasLutIndex(). */
+  static const int DEALIAS_LUT_D1_CELLS = 7, DEALIAS_LUT_D2_CELLS = 10;
+
+  /** Integral offsets of the scaled phases t0, t1 and t2 unwrapping one cell. */
+  struct DealiasOffsets
+  {
+    float t0, t1, t2;
+  };
+  DealiasOffsets dealias_lut[DEALIAS_LUT_D1_CELLS * DEALIAS_LUT_D2_CELLS];
+
+  // instantiations for the configured filters, see selectInstantiations()
+  typedef void (CpuDepthPacketProcessorImpl::*StagesFunction)(const unsigned char *data, Mat<float> &out_ir, Mat<float> &out_depth);
+  typedef void (CpuDepthPacketProcessorImpl::*BandFunction)(const unsigned char *data, int band_begin, int band_end, Mat<float> &out_ir, Mat<float> &out_depth);
+  typedef void (CpuDepthPacketProcessorImpl::*FilterRowFunction)(int y, const Planes<float> &m, Planes<float> &m_out, unsigned char *max_edge_test);
+  StagesFunction process_stages;
+  BandFunction process_band_tiled;
+  FilterRowFunction filter_row_stage1;
+
+  /** Rows of each tile of processBandTiled(), with its halo about 300KB of intermediate data. */
+  static const int TILE_ROWS = 8;
+
+  /** Sliding windows of the intermediate buffers of one band of processBandTiled(). */
+  struct TileBuffers
+  {
+    Planes<int16_t> measurements;        ///< Unpacked measurements of the stage 1 row.
+    Planes<float> m;                     ///< Stage 1 output of the tile and two halo rows on each side.
+    Planes<float> m_filtered;            ///< Bilateral filter output of the stage 2 row.
+    Planes<float> depth_ir_sum;          ///< Stage 2 output of the tile and one halo row on each side.
+    Planes<unsigned char> max_edge_test; ///< Max edge test, same rows as #depth_ir_sum.
+
+    TileBuffers()
+    {
+      measurements.create(NUM_MEASUREMENTS, 1);
+      m.create(9, TILE_ROWS + 4);
+      m_filtered.create(6, 1);
+      depth_ir_sum.create(3, TILE_ROWS + 2);
+      max_edge_test.create(1, TILE_ROWS + 2);
+    }
+  };
+
+  std::vector<TileBuffers *> free_tile_buffers; ///< Tile buffers not used by a band, one per thread after the first packet.
+  libfreenect2::mutex tile_buffers_mutex;
+
+  WorkerPool *pool; ///< Threads processing horizontal bands of the image, NULL to process serially.
+
+  const CpuDepthKernels *kernels; ///< Vectorized stage 1 and stage 2, NULL to use the per-pixel functions.
+  DepthPacketProcessor::Config::CpuKernels requested_kernels; ///< Config::DepthKernels #kernels were selected for.
+
+  bool enable_kde; ///< Unwrap the phases with processKde() instead of the stage 2 dealiasing.
+
+  Planes<float> kde_phase_conf; ///< Phase of each hypothesis, followed by the confidence of each hypothesis.
+  std::vector<float> kde_gauss_kernel; ///< Separable spatial weights of the KDE neighbourhood.
+
   CpuDepthPacketProcessorImpl()
   {
     newIrFrame();
     newDepthFrame();
+    newConfidenceFrame();
 
     enable_bilateral_filter = true;
     enable_edge_filter = true;
+    enable_tiled_processing = false;
+    enable_fast_math = false;
+    enable_dealias_lut = false;
+    fillDealiasLut();
+    enable_kde = false;
+    enable_binning = false;
+    width = 512;
+    height = 424;
+    output_ir = true;
+    output_confidence = false;
+    selectInstantiations();
 
     flip_ptables = true;
+
+    pool = 0;
+
+    kernels = 0;
+    requested_kernels = DepthPacketProcessor::Config::ScalarKernels;
+    setKernels(DepthPacketProcessor::Config::AutoKernels);
+
+    setRoi(0, 0, 512, 424);
+
+    measurements.create(NUM_MEASUREMENTS);
+
+    allocateBuffers(false);
+
+    compact_trig_tables = true;
+    trig_tables = 0;
   }
 
-  /** Allocate a new IR frame. */
-  void newIrFrame()
+  /**
+   * Allocate the intermediate buffers in one block.
+   * @param huge_pages Try to back the block with huge pages, which saves
+   *        TLB misses when streaming the planes. Falls back to normal pages.
+   */
+  void allocateBuffers(bool huge_pages)
   {
-    ir_frame = new Frame(512 * 424 * 4);
-    ir_frame->width = 512;
-    ir_frame->height = 424;
-    ir_frame->bytes_per_pixel = 4;
-    ir_frame->format = Frame::Float;
+    this->huge_pages = huge_pages;
+    const size_t num_planes = 9 + 6 + 3;
+    buffers_size = Planes<float>::sizeInBytes(num_planes) + 512 * 424;
+    buffers = 0;
+    buffers_mapped = false;
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if(huge_pages)
+    {
+      void *mapping = mmap(0, buffers_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if(mapping != MAP_FAILED)
+      {
+        buffers = static_cast<unsigned char *>(mapping);
+        buffers_mapped = true;
+        if(madvise(mapping, buffers_size, MADV_HUGEPAGE) != 0)
+          LOG_WARNING << "huge pages not available for depth buffers";
+      }
+    }
+#elif defined(__APPLE__) && defined(VM_FLAGS_SUPERPAGE_SIZE_2MB)
+    if(huge_pages)
+    {
+      // superpages need a size multiple of 2MB
+      buffers_size = (buffers_size + (2 << 20) - 1) & ~size_t((2 << 20) - 1);
+      void *mapping = mmap(0, buffers_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, VM_FLAGS_SUPERPAGE_SIZE_2MB, 0);
+      if(mapping != MAP_FAILED)
+      {
+        buffers = static_cast<unsigned char *>(mapping);
+        buffers_mapped = true;
+      }
+      else
+      {
+        LOG_WARNING << "huge pages not available for depth buffers";
+      }
+    }
+#else
+    if(huge_pages)
+      LOG_WARNING << "huge pages not supported on this platform";
+#endif
+
+    if(buffers == 0)
+      buffers = new unsigned char[buffers_size + 63];
+
+    // planes are multiples of 64 bytes, so they all stay aligned
+    unsigned char *next = buffers_mapped ? buffers : buffers + (63 - (reinterpret_cast<size_t>(buffers) + 63) % 64);
+    m.create(9, 424, next);
+    next += Planes<float>::sizeInBytes(9);
+    m_filtered.create(6, 424, next);
+    next += Planes<float>::sizeInBytes(6);
+    depth_ir_sum.create(3, 424, next);
+    next += Planes<float>::sizeInBytes(3);
+    m_max_edge_test.create(424, 512, next);
   }
 
-  ~CpuDepthPacketProcessorImpl()
+  void freeBuffers()
   {
-    delete ir_frame;
-    delete depth_frame;
+#ifndef _WIN32
+    if(buffers_mapped)
+    {
+      munmap(buffers, buffers_size);
+      return;
+    }
+#endif
+    delete[] buffers;
   }
 
-  /** Allocate a new depth frame. */
-  void newDepthFrame()
+  /**
+   * Allocate the intermediate buffers again if Config::EnableHugePages changed.
+   * @param huge_pages See allocateBuffers().
+   */
+  void setHugePages(bool huge_pages)
   {
-    depth_frame = new Frame(512 * 424 * 4);
-    depth_frame->width = 512;
-    depth_frame->height = 424;
-    depth_frame->bytes_per_pixel = 4;
-    depth_frame->format = Frame::Float;
+    if(huge_pages == this->huge_pages)
+      return;
+
+    freeBuffers();
+    allocateBuffers(huge_pages);
   }
 
-  int32_t decodePixelMeasurement(unsigned char* data, int sub, int x, int y)
+  /**
+   * Select the vectorized kernels, followed by setRoi() as the regions are aligned to their width.
+   * @param requested Config::DepthKernels.
+   */
+  void setKernels(DepthPacketProcessor::Config::CpuKernels requested)
   {
-    if (x < 1 || y < 0 || 510 < x || 423 < y)
-    {
-      return lut11to16[0];
-    }
+    if(requested == requested_kernels)
+      return;
 
-    int r1zi = (x >> 2) + ((x & 0x3) << 7); // Range 1..510
-    r1zi = r1zi * 11L; // Range 11..5610
-
-    // 298496 = 512 * 424 * 11 / 8 = number of bytes per sub image
-    uint16_t *ptr = reinterpret_cast<uint16_t *>(data + 298496 * sub);
-    int i = y < 212 ? y + 212 : 423 - y;
-    ptr += 352*i;
+    requested_kernels = requested;
+    kernels = selectCpuDepthKernels(requested);
+    LOG_INFO << "using " << (kernels != 0 ? kernels->name : "scalar") << " kernels";
+  }
 
-    int r1yi = r1zi >> 4; // Range 0..350
-    r1zi = r1zi & 15;
+  /**
+   * Set the number of threads processing the image.
+   * @param num_threads 1 processes serially, 0 uses all hardware threads.
+   */
+  void setNumThreads(size_t num_threads)
+  {
+    if(num_threads == 0)
+      num_threads = libfreenect2::thread::hardware_concurrency();
 
-    int i1 = ptr[r1yi];
-    int i2 = ptr[r1yi + 1];
-    i1 = i1 >> r1zi;
-    i2 = i2 << (16 - r1zi);
+    size_t current = pool != 0 ? pool->size() : 1;
+    if(num_threads == current)
+      return;
 
-    return lut11to16[((i1 | i2) & 2047)];
+    delete pool;
+    pool = num_threads > 1 ? new WorkerPool(num_threads) : 0;
   }
 
   /**
-   * Initialize cos and sin trigonometry tables for each of the three #phase_in_rad parameters.
-   * @param p0table Angle at every (x, y) position.
-   * @param [out] trig_table (3 cos tables, followed by 3 sin tables for the three phases.
+   * Run @a f over horizontal bands covering the rows of a region.
+   * Each call of @a f must only write rows in [y_begin, y_end). The 3x3 filters
+   * read one row above and below their band, this halo is complete because
+   * each stage is finished on all bands before the next one starts.
+   * @param region Region whose rows are split.
+   * @param f Callable with arguments (int y_begin, int y_end).
+   * @param bands_per_thread Several bands per thread balance uneven per-row cost.
    */
-  void fillTrigTable(Mat<uint16_t> &p0table, float trig_table[512*424][6])
+  template<typename Function>
+  void forEachBand(const Region &region, const Function &f, size_t bands_per_thread = 4)
   {
-    int i = 0;
-
-    for(int y = 0; y < 424; ++y)
-      for(int x = 0; x < 512; ++x, ++i)
-      {
-        float p0 = -((float)p0table.at(y, x)) * 0.000031 * M_PI;
+    const int rows = region.y_end - region.y_begin;
 
-        float tmp0 = p0 + params.phase_in_rad[0];
-        float tmp1 = p0 + params.phase_in_rad[1];
-        float tmp2 = p0 + params.phase_in_rad[2];
+    if(pool == 0)
+    {
+      f(region.y_begin, region.y_end);
+      return;
+    }
 
-        trig_table[i][0] = std::cos(tmp0);
-        trig_table[i][1] = std::cos(tmp1);
-        trig_table[i][2] = std::cos(tmp2);
+    const size_t num_bands = pool->size() * bands_per_thread;
+    pool->run(num_bands, [&](size_t band)
+    {
+      f(region.y_begin + int(band * rows / num_bands), region.y_begin + int((band + 1) * rows / num_bands));
+    });
+  }
 
-        trig_table[i][3] = std::sin(-tmp0);
-        trig_table[i][4] = std::sin(-tmp1);
-        trig_table[i][5] = std::sin(-tmp2);
-      }
+  /**
+   * Restrict processing to a region of interest of the output images.
+   * Pixels outside of it are left unchanged in the output.
+   * @param x Left column.
+   * @param y Top row.
+   * @param width Width of the region.
+   * @param height Height of the region.
+   */
+  void setRoi(int x, int y, int roi_width, int roi_height)
+  {
+    roi.x_begin = x;
+    roi.x_end = x + roi_width;
+    roi.y_begin = height - y - roi_height;
+    roi.y_end = height - y;
+    updateRegions();
   }
 
   /**
-   * Process measurement (all three layers).
-   * @param [in] trig_table Trigonometry tables.
-   * @param abMultiplierPerFrq Multiplier.
-   * @param x X position in the image.
-   * @param y Y position in the image.
-   * @param m Measurement.
-   * @param [out] m_out Processed measurement (IR a, IR b, IR amplitude).
+   * Switch between full resolution and binned processing, followed by setRoi().
+   * @param binning Output 256x212 images.
    */
-  void processMeasurementTriple(float trig_table[512*424][6], float abMultiplierPerFrq, int x, int y, const int32_t* m, float* m_out)
+  void setBinning(bool binning)
   {
-    float zmultiplier = z_table.at(y, x);
-    if (0 < zmultiplier)
-    {
-      bool saturated = (m[0] == 32767 || m[1] == 32767 || m[2] == 32767);
-      if (!saturated)
-      {
-        int offset = y * 512 + x;
-        float cos_tmp0 = trig_table[offset][0];
-        float cos_tmp1 = trig_table[offset][1];
-        float cos_tmp2 = trig_table[offset][2];
+    enable_binning = binning;
+    width = binning ? 256 : 512;
+    height = binning ? 212 : 424;
+  }
 
-        float sin_negtmp0 = trig_table[offset][3];
-        float sin_negtmp1 = trig_table[offset][4];
-        float sin_negtmp2 = trig_table[offset][5];
+  /** Compute the regions of the stages from #roi and the enabled filters. */
+  void updateRegions()
+  {
+    const int align = kernels != 0 ? kernels->width : 1;
+    const int halo = enable_kde ? int(params.kde_neigborhood_size) : enable_edge_filter ? 1 : 0;
 
-        // formula given in Patent US 8,587,771 B2
-        float ir_image_a = cos_tmp0 * m[0] + cos_tmp1 * m[1] + cos_tmp2 * m[2];
-        float ir_image_b = sin_negtmp0 * m[0] + sin_negtmp1 * m[1] + sin_negtmp2 * m[2];
+    stage2_region = roi.grow(halo, align, width, height);
+    stage1_region = stage2_region.grow(enable_bilateral_filter ? 1 : 0, align, width, height);
 
-        // only if modeMask & 32 != 0;
-        if(true)//(modeMask & 32) != 0)
-        {
-            ir_image_a *= abMultiplierPerFrq;
-            ir_image_b *= abMultiplierPerFrq;
-        }
-        float ir_amplitude = std::sqrt(ir_image_a * ir_image_a + ir_image_b * ir_image_b) * params.ab_multiplier;
+    raw_region = stage1_region;
+    if(enable_binning)
+    {
+      raw_region.x_begin *= 2;
+      raw_region.x_end *= 2;
+      raw_region.y_begin *= 2;
+      raw_region.y_end *= 2;
+    }
+  }
 
-        m_out[0] = ir_image_a;
-        m_out[1] = ir_image_b;
-        m_out[2] = ir_amplitude;
-      }
-      else
+  /**
+   * Select the instantiations of processStages(), processBandTiled() and
+   * filterRowStage1() for the filter configuration, so the flags are not
+   * tested in the loops.
+   */
+  void selectInstantiations()
+  {
+    static const StagesFunction stages[2][2] = {
+      {&CpuDepthPacketProcessorImpl::processStages<false, false>, &CpuDepthPacketProcessorImpl::processStages<false, true>},
+      {&CpuDepthPacketProcessorImpl::processStages<true, false>, &CpuDepthPacketProcessorImpl::processStages<true, true>}
+    };
+    static const BandFunction bands[2][2] = {
+      {&CpuDepthPacketProcessorImpl::processBandTiled<false, false>, &CpuDepthPacketProcessorImpl::processBandTiled<false, true>},
+      {&CpuDepthPacketProcessorImpl::processBandTiled<true, false>, &CpuDepthPacketProcessorImpl::processBandTiled<true, true>}
+    };
+
+    process_stages = stages[enable_bilateral_filter][enable_edge_filter];
+    process_band_tiled = bands[enable_bilateral_filter][enable_edge_filter];
+    filter_row_stage1 = enable_fast_math ? &CpuDepthPacketProcessorImpl::filterRowStage1<true> : &CpuDepthPacketProcessorImpl::filterRowStage1<false>;
+  }
+
+  /**
+   * Process a packet with the configured strategy.
+   * @param data Depth packet.
+   * @param [out] out_ir IR image.
+   * @param [out] out_depth Depth image.
+   */
+  void processPacket(const unsigned char *data, Mat<float> &out_ir, Mat<float> &out_depth)
+  {
+    if(enable_kde)
+    {
+      processKde(data, out_ir, out_depth);
+    }
+    else if(enable_tiled_processing && !enable_binning)
+    {
+      // fewer, larger bands, each recomputes the halo rows of its first and last tile
+      forEachBand(roi, [&](int y_begin, int y_end)
       {
-        // Saturated pixel.
-        m_out[0] = 0;
-        m_out[1] = 0;
-        m_out[2] = 65535.0;
-      }
+        (this->*process_band_tiled)(data, y_begin, y_end, out_ir, out_depth);
+      }, 2);
     }
     else
     {
-      // Invalid pixel.
-      m_out[0] = 0;
-      m_out[1] = 0;
-      m_out[2] = 0;
+      (this->*process_stages)(data, out_ir, out_depth);
     }
   }
 
   /**
-   * Transform measurement.
-   * @param [in, out] m Measurement.
+   * Get the output row of an image row.
+   * @param out_ir IR image.
+   * @param y Vertical position in the processing order.
+   * @return Row of \a out_ir, NULL if the listener takes no IR.
    */
-  void transformMeasurements(float* m)
+  float *irRow(Mat<float> &out_ir, int y)
   {
-    float tmp0 = std::atan2((m[1]), (m[0]));
-    tmp0 = tmp0 < 0 ? tmp0 + M_PI * 2.0f : tmp0;
-    tmp0 = (tmp0 != tmp0) ? 0 : tmp0;
-
-    float tmp1 = std::sqrt(m[0] * m[0] + m[1] * m[1]) * params.ab_multiplier;
-
-    m[0] = tmp0; // phase
-    m[1] = tmp1; // ir amplitude - (possibly bilateral filtered)
+    return output_ir ? out_ir.ptr(height - 1 - y, 0) : 0;
   }
 
   /**
-   * Process first pixel stage.
-   * @param x Horizontal position.
-   * @param y Vertical position.
-   * @param data data
-   * @param [out] m0_out First layer output.
-   * @param [out] m1_out Second layer output.
-   * @param [out] m2_out Third layer output.
+   * Get the output row of an image row in the confidence image.
+   * @param y Vertical position in the processing order.
+   * @return Row of #out_confidence, NULL if the listener takes no confidence.
    */
-  void processPixelStage1(int x, int y, unsigned char* data, float *m0_out, float *m1_out, float *m2_out)
+  float *confidenceRow(int y)
   {
-    int32_t m0_raw[3], m1_raw[3], m2_raw[3];
-
-    m0_raw[0] = decodePixelMeasurement(data, 0, x, y);
-    m0_raw[1] = decodePixelMeasurement(data, 1, x, y);
-    m0_raw[2] = decodePixelMeasurement(data, 2, x, y);
-    m1_raw[0] = decodePixelMeasurement(data, 3, x, y);
-    m1_raw[1] = decodePixelMeasurement(data, 4, x, y);
-    m1_raw[2] = decodePixelMeasurement(data, 5, x, y);
-    m2_raw[0] = decodePixelMeasurement(data, 6, x, y);
-    m2_raw[1] = decodePixelMeasurement(data, 7, x, y);
-    m2_raw[2] = decodePixelMeasurement(data, 8, x, y);
-
-    processMeasurementTriple(trig_table0, params.ab_multiplier_per_frq[0], x, y, m0_raw, m0_out);
-    processMeasurementTriple(trig_table1, params.ab_multiplier_per_frq[1], x, y, m1_raw, m1_out);
-    processMeasurementTriple(trig_table2, params.ab_multiplier_per_frq[2], x, y, m2_raw, m2_out);
+    return output_confidence ? out_confidence.ptr(height - 1 - y, 0) : 0;
   }
 
   /**
-   * Filter pixels in stage 1.
-   * @param x Horizontal position.
-   * @param y Vertical position.
-   * @param m Input data?
-   * @param [out] m_out data.
-   * @param [out] bilateral_max_edge_test Whether the accumulated distance of each image stayed within limits.
+   * Compute only the IR image of a packet, skipping stage 2 and the filters.
+   * @param data Depth packet.
+   * @param [out] out_ir IR image.
    */
-  void filterPixelStage1(int x, int y, const Mat<Vec<float, 9> >& m, float* m_out, bool& bilateral_max_edge_test)
+  void processIr(const unsigned char *data, Mat<float> &out_ir)
   {
-    const float *m_ptr = (m.ptr(y, x)->val);
-    bilateral_max_edge_test = true;
+    processStage1(data);
 
-    if(x < 1 || y < 1 || x > 510 || y > 422)
-    {
-      for(int i = 0; i < 9; ++i)
-        m_out[i] = m_ptr[i];
-    }
-    else
+    forEachBand(roi, [&](int y_begin, int y_end)
     {
-      float m_normalized[2];
-      float other_m_normalized[2];
+      for(int y = y_begin; y < y_end; ++y)
+      {
+        const float *amplitude0 = m.row(2, y), *amplitude1 = m.row(5, y), *amplitude2 = m.row(8, y);
+        float *ir_out = out_ir.ptr(height - 1 - y, 0);
 
-      int offset = 0;
+        for(int x = roi.x_begin; x < roi.x_end; ++x)
+          ir_out[x] = std::min((amplitude0[x] + amplitude1[x] + amplitude2[x]) * 0.3333333f * params.ab_output_multiplier, 65535.0f);
+      }
+    });
+  }
 
-      for(int i = 0; i < 3; ++i, m_ptr += 3, m_out += 3, offset += 3)
+  /**
+   * Process stage 1 of the rows of #stage1_region into #m. When binning,
+   * each pair of rows is processed into tile buffers and averaged into a
+   * row of #m by binRowStage1().
+   * @param data Depth packet.
+   */
+  void processStage1(const unsigned char *data)
+  {
+    if(!enable_binning)
+    {
+      forEachBand(stage1_region, [&](int y_begin, int y_end)
       {
-        float norm2 = m_ptr[0] * m_ptr[0] + m_ptr[1] * m_ptr[1];
-        float inv_norm = 1.0f / std::sqrt(norm2);
-        inv_norm = (inv_norm == inv_norm) ? inv_norm : std::numeric_limits<float>::infinity();
-
-        m_normalized[0] = m_ptr[0] * inv_norm;
-        m_normalized[1] = m_ptr[1] * inv_norm;
+        unpackMeasurements(data, y_begin, y_end, measurements);
 
-        int j = 0;
+        for(int y = y_begin; y < y_end; ++y)
+          processRowStage1(y, measurements, m, compact_trig_tables);
+      });
+      return;
+    }
 
-        float weight_acc = 0.0f;
-        float weighted_m_acc[2] = {0.0f, 0.0f};
+    forEachBand(stage1_region, [&](int y_begin, int y_end)
+    {
+      TileBuffers *tile = acquireTileBuffers();
 
-        float threshold = (params.joint_bilateral_ab_threshold * params.joint_bilateral_ab_threshold) / (params.ab_multiplier * params.ab_multiplier);
-        float joint_bilateral_exp = params.joint_bilateral_exp;
+      for(int y = y_begin; y < y_end; ++y)
+      {
+        tile->m.y_begin = 2 * y;
 
-        if(norm2 < threshold)
+        for(int raw_y = 2 * y; raw_y < 2 * y + 2; ++raw_y)
         {
-          threshold = 0.0f;
-          joint_bilateral_exp = 0.0f;
+          tile->measurements.y_begin = raw_y;
+          unpackMeasurements(data, raw_y, raw_y + 1, tile->measurements);
+          processRowStage1(raw_y, tile->measurements, tile->m, compact_trig_tables);
         }
 
-        float dist_acc = 0.0f;
+        binRowStage1(y, tile->m, m);
+      }
 
-        for(int yi = -1; yi < 2; ++yi)
+      releaseTileBuffers(tile);
+    });
+  }
+
+  /**
+   * Average 2x2 blocks of the stage 1 output into one binned row. IR a and
+   * IR b are averaged over the valid pixels of a block and the amplitude is
+   * computed again from the averages, so noise cancels before the phases
+   * are computed. A block with a saturated pixel is saturated, a block
+   * without valid pixels is invalid.
+   * @param y Binned row.
+   * @param m Stage 1 planes of the full resolution rows 2 * y and 2 * y + 1.
+   * @param [out] m_out Binned stage 1 planes.
+   */
+  void binRowStage1(int y, const Planes<float> &m, Planes<float> &m_out)
+  {
+    const float *z0 = z_table.ptr(2 * y, 0), *z1 = z_table.ptr(2 * y + 1, 0);
+
+    for(int f = 0; f < 3; ++f)
+    {
+      const float *a0 = m.row(3 * f + 0, 2 * y), *a1 = m.row(3 * f + 0, 2 * y + 1);
+      const float *b0 = m.row(3 * f + 1, 2 * y), *b1 = m.row(3 * f + 1, 2 * y + 1);
+      const float *n0 = m.row(3 * f + 2, 2 * y), *n1 = m.row(3 * f + 2, 2 * y + 1);
+      float *a_out = m_out.row(3 * f + 0, y), *b_out = m_out.row(3 * f + 1, y), *n_out = m_out.row(3 * f + 2, y);
+
+      for(int x = stage1_region.x_begin; x < stage1_region.x_end; ++x)
+      {
+        const int x0 = 2 * x, x1 = 2 * x + 1;
+        // saturated pixels have amplitude 65535 and no IR a and IR b, invalid pixels no z
+        const bool saturated = n0[x0] == 65535.0f || n0[x1] == 65535.0f || n1[x0] == 65535.0f || n1[x1] == 65535.0f;
+        const int count = (z0[x0] > 0.0f) + (z0[x1] > 0.0f) + (z1[x0] > 0.0f) + (z1[x1] > 0.0f);
+
+        if(saturated || count == 0)
+        {
+          a_out[x] = 0.0f;
+          b_out[x] = 0.0f;
+          n_out[x] = saturated ? 65535.0f : 0.0f;
+          continue;
+        }
+
+        // invalid pixels have IR a and IR b of 0
+        const float a = (a0[x0] + a0[x1] + a1[x0] + a1[x1]) / count;
+        const float b = (b0[x0] + b0[x1] + b1[x0] + b1[x1]) / count;
+
+        a_out[x] = a;
+        b_out[x] = b;
+        n_out[x] = std::sqrt(a * a + b * b) * params.ab_multiplier;
+      }
+    }
+  }
+
+  /**
+   * Process a packet stage by stage, each stage over the whole image.
+   * @param data Depth packet.
+   * @param [out] out_ir IR image.
+   * @param [out] out_depth Depth image.
+   */
+  template<bool BilateralFilter, bool EdgeFilter>
+  void processStages(const unsigned char *data, Mat<float> &out_ir, Mat<float> &out_depth)
+  {
+    processStage1(data);
+
+    const Planes<float> *m_stage2_filtered = BilateralFilter ? &m_filtered : 0;
+
+    // bilateral filtering
+    if(BilateralFilter)
+    {
+      forEachBand(stage2_region, [&](int y_begin, int y_end)
+      {
+        for(int y = y_begin; y < y_end; ++y)
+          (this->*filter_row_stage1)(y, m, m_filtered, m_max_edge_test.ptr(y, 0));
+      });
+    }
+
+    if(EdgeFilter)
+    {
+      // without the bilateral filter there is no max edge test, let every pixel pass
+      if(!BilateralFilter)
+        std::fill(m_max_edge_test.buffer(), m_max_edge_test.buffer() + 512 * 424, 1);
+
+      forEachBand(stage2_region, [&](int y_begin, int y_end)
+      {
+        for(int y = y_begin; y < y_end; ++y)
+        {
+          const unsigned char *max_edge_test = m_max_edge_test.ptr(y, 0);
+          float *raw_depth = depth_ir_sum.row(0, y), *edge_test_depth = depth_ir_sum.row(1, y);
+
+          processRowStage2(y, m, m_stage2_filtered, irRow(out_ir, y), raw_depth, depth_ir_sum.row(2, y), confidenceRow(y));
+
+          for(int x = stage2_region.x_begin; x < stage2_region.x_end; ++x)
+            edge_test_depth[x] = max_edge_test[x] == 1 ? raw_depth[x] : 0;
+        }
+      });
+
+      forEachBand(roi, [&](int y_begin, int y_end)
+      {
+        for(int y = y_begin; y < y_end; ++y)
+          filterRowStage2(y, depth_ir_sum, m_max_edge_test.ptr(y, 0), out_depth.ptr(height - 1 - y, 0));
+      });
+    }
+    else
+    {
+      forEachBand(roi, [&](int y_begin, int y_end)
+      {
+        for(int y = y_begin; y < y_end; ++y)
+          processRowStage2(y, m, m_stage2_filtered, irRow(out_ir, y), out_depth.ptr(height - 1 - y, 0), 0, confidenceRow(y));
+      });
+    }
+  }
+
+  /**
+   * Process the rows [band_begin, band_end) of a packet tile by tile, running
+   * all stages on a few rows at a time so the intermediate data stays in
+   * cache. The tile buffers are windows that slide down the band, keeping the
+   * rows the 3x3 filters of the next tile still need. Only the halo rows at
+   * both ends of the band are computed twice, by this band and its neighbour.
+   * @param data Depth packet.
+   * @param band_begin First row.
+   * @param band_end Row after the last one.
+   * @param [out] out_ir IR image.
+   * @param [out] out_depth Depth image.
+   */
+  template<bool BilateralFilter, bool EdgeFilter>
+  void processBandTiled(const unsigned char *data, int band_begin, int band_end, Mat<float> &out_ir, Mat<float> &out_depth)
+  {
+    TileBuffers *tile = acquireTileBuffers();
+
+    // rows above and below needed by the edge-aware filter and the bilateral filter
+    const int edge_halo = EdgeFilter ? 1 : 0, bilateral_halo = BilateralFilter ? 1 : 0;
+
+    int stage2_y = std::max(band_begin - edge_halo, 0);
+    int stage1_y = std::max(stage2_y - bilateral_halo, 0);
+
+    tile->m.y_begin = stage1_y;
+    tile->depth_ir_sum.y_begin = stage2_y;
+    tile->max_edge_test.y_begin = stage2_y;
+
+    for(int y_begin = band_begin; y_begin < band_end; y_begin += TILE_ROWS)
+    {
+      const int y_end = std::min(y_begin + TILE_ROWS, band_end);
+      const int stage2_end = std::min(y_end + edge_halo, 424);
+      const int stage1_end = std::min(stage2_end + bilateral_halo, 424);
+
+      tile->m.slide(std::max(y_begin - edge_halo - bilateral_halo, 0));
+      tile->depth_ir_sum.slide(std::max(y_begin - edge_halo, 0));
+      tile->max_edge_test.slide(std::max(y_begin - edge_halo, 0));
+
+      for(; stage1_y < stage1_end; ++stage1_y)
+      {
+        tile->measurements.y_begin = stage1_y;
+        unpackMeasurements(data, stage1_y, stage1_y + 1, tile->measurements);
+        processRowStage1(stage1_y, tile->measurements, tile->m, compact_trig_tables);
+      }
+
+      for(; stage2_y < stage2_end; ++stage2_y)
+      {
+        const int y = stage2_y;
+        // halo rows belong to the neighbouring bands, which write their IR and confidence
+        float *ir_out = band_begin <= y && y < band_end ? irRow(out_ir, y) : 0;
+        float *confidence_out = band_begin <= y && y < band_end ? confidenceRow(y) : 0;
+        unsigned char *max_edge_test = tile->max_edge_test.row(0, y);
+
+        if(BilateralFilter)
+        {
+          tile->m_filtered.y_begin = y;
+          (this->*filter_row_stage1)(y, tile->m, tile->m_filtered, max_edge_test);
+        }
+        else
+        {
+          std::fill(max_edge_test, max_edge_test + 512, 1);
+        }
+
+        const Planes<float> *m_stage2_filtered = BilateralFilter ? &tile->m_filtered : 0;
+
+        if(EdgeFilter)
+        {
+          float *raw_depth = tile->depth_ir_sum.row(0, y), *edge_test_depth = tile->depth_ir_sum.row(1, y);
+
+          processRowStage2(y, tile->m, m_stage2_filtered, ir_out, raw_depth, tile->depth_ir_sum.row(2, y), confidence_out);
+
+          for(int x = stage2_region.x_begin; x < stage2_region.x_end; ++x)
+            edge_test_depth[x] = max_edge_test[x] == 1 ? raw_depth[x] : 0;
+        }
+        else
+        {
+          processRowStage2(y, tile->m, m_stage2_filtered, ir_out, out_depth.ptr(423 - y, 0), 0, confidence_out);
+        }
+      }
+
+      if(EdgeFilter)
+      {
+        for(int y = y_begin; y < y_end; ++y)
+          filterRowStage2(y, tile->depth_ir_sum, tile->max_edge_test.row(0, y), out_depth.ptr(423 - y, 0));
+      }
+    }
+
+    releaseTileBuffers(tile);
+  }
+
+  /**
+   * Use the KDE phase unwrapping of "Efficient Phase Unwrapping using Kernel
+   * Density Estimation", ECCV 2016, Felix Järemo Lawin, Per-Erik Forssen and
+   * Hannes Ovren for all following packets.
+   * Keeps Parameters::num_hyps hypotheses per pixel, limited to the
+   * implemented 2 or 3.
+   */
+  void enableKde()
+  {
+    enable_kde = true;
+    params.num_hyps = std::min(std::max(params.num_hyps, size_t(2)), size_t(3));
+    kde_phase_conf.create(2 * int(params.num_hyps));
+    updateRegions();
+
+    const int radius = int(params.kde_neigborhood_size);
+    const float sigma = 0.5f * radius;
+    kde_gauss_kernel.resize(2 * radius + 1);
+
+    for(int i = -radius; i <= radius; ++i)
+      kde_gauss_kernel[i + radius] = std::exp(-0.5f * i * i / (sigma * sigma));
+  }
+
+  /**
+   * Process a packet with the KDE phase unwrapping. Stage 1 and the bilateral
+   * filter are the same as in processStages(), the dealiasing and the
+   * edge-aware filter of stage 2 are replaced by ranking the unwrapping
+   * hypotheses of each pixel and choosing the one best supported by its
+   * neighbourhood.
+   * @param data Depth packet.
+   * @param [out] out_ir IR image.
+   * @param [out] out_depth Depth image.
+   */
+  void processKde(const unsigned char *data, Mat<float> &out_ir, Mat<float> &out_depth)
+  {
+    processStage1(data);
+
+    if(enable_bilateral_filter)
+    {
+      forEachBand(stage2_region, [&](int y_begin, int y_end)
+      {
+        for(int y = y_begin; y < y_end; ++y)
+          (this->*filter_row_stage1)(y, m, m_filtered, 0);
+      });
+    }
+
+    const Planes<float> *m_kde_filtered = enable_bilateral_filter ? &m_filtered : 0;
+
+    forEachBand(stage2_region, [&](int y_begin, int y_end)
+    {
+      for(int y = y_begin; y < y_end; ++y)
+        processRowKdePhase(y, m, m_kde_filtered, irRow(out_ir, y));
+    });
+
+    // the KDE neighbourhood is larger than the filters, most time is spent here
+    forEachBand(roi, [&](int y_begin, int y_end)
+    {
+      for(int y = y_begin; y < y_end; ++y)
+      {
+        float *confidence_out = confidenceRow(y);
+
+        for(int x = roi.x_begin; x < roi.x_end; ++x)
+          filterPixelKde(x, y, out_depth.ptr(height - 1 - y, x), confidence_out != 0 ? confidence_out + x : 0);
+      }
+    });
+  }
+
+  /**
+   * Process a packet with missing sub-images with processPixelPartial().
+   * There are no filters in this path, the caller checks that binning and
+   * KDE are off.
+   * @param data Depth packet.
+   * @param frequencies Bit f is set if the 3 sub-images of frequency f were received.
+   * @param [out] out_ir IR image.
+   * @param [out] out_depth Depth image, NULL to compute only the IR image.
+   */
+  void processPartial(const unsigned char *data, unsigned int frequencies, Mat<float> &out_ir, Mat<float> *out_depth)
+  {
+    forEachBand(roi, [&](int y_begin, int y_end)
+    {
+      unpackMeasurements(data, y_begin, y_end, measurements);
+
+      for(int y = y_begin; y < y_end; ++y)
+      {
+        float *ir_out = irRow(out_ir, y);
+        float *depth_out = out_depth != 0 ? out_depth->ptr(height - 1 - y, 0) : 0;
+        float *confidence_out = out_depth != 0 ? confidenceRow(y) : 0;
+
+        for(int x = roi.x_begin; x < roi.x_end; ++x)
+          processPixelPartial(x, y, frequencies, ir_out != 0 ? ir_out + x : 0, depth_out != 0 ? depth_out + x : 0, confidence_out != 0 ? confidence_out + x : 0);
+      }
+    });
+  }
+
+  /**
+   * Stage 1 and stage 2 of a pixel from the frequencies that were received.
+   *
+   * The phases of the frequencies repeat every 3, 15 and 2 units of the
+   * 30 unit range of processPixelStage2(). Two frequencies are unwrapped
+   * onto the least common multiple of their periods, 15 without the third
+   * frequency, 6 without the second and the full 30 without the first, and
+   * farther pixels alias into that range. The dealiasing confidence compares
+   * the two unwrapped phases the same way processPixelStage2() compares
+   * three. Pixels with less than two frequencies are invalid.
+   * @param x Horizontal position.
+   * @param y Vertical position.
+   * @param frequencies Bit f is set if the 3 sub-images of frequency f were received.
+   * @param [out] ir_out IR output, may be NULL.
+   * @param [out] depth_out Depth output, may be NULL.
+   * @param [out] confidence_out Unwrapping confidence output, may be NULL.
+   */
+  void processPixelPartial(int x, int y, unsigned int frequencies, float *ir_out, float *depth_out, float *confidence_out)
+  {
+    static const float periods[3] = { 3.0f, 15.0f, 2.0f };
+
+    float m[3][3];
+    int available[3], num_available = 0;
+    float ir_amplitude_sum = 0.0f;
+
+    for(int f = 0; f < 3; ++f)
+    {
+      if((frequencies & (1u << f)) == 0)
+        continue;
+
+      const int32_t raw[3] = { measurements.at(3 * f + 0, y, x), measurements.at(3 * f + 1, y, x), measurements.at(3 * f + 2, y, x) };
+      processMeasurementTriple(f, compact_trig_tables, x, y, raw, m[f]);
+      transformMeasurements(m[f]);
+
+      available[num_available++] = f;
+      ir_amplitude_sum += m[f][2];
+    }
+
+    if(ir_out != 0)
+      *ir_out = num_available > 0 ? std::min(ir_amplitude_sum / num_available * params.ab_output_multiplier, 65535.0f) : 0.0f;
+
+    if(depth_out == 0)
+      return;
+
+    float phase = 0.0f, confidence = 0.0f;
+
+    if(num_available >= 2)
+    {
+      // unwrap the frequency with the longer period, the other one picks the wrap
+      const int a = periods[available[0]] > periods[available[1]] ? available[0] : available[1];
+      const int b = a == available[0] ? available[1] : available[0];
+      const int missing = 3 - a - b;
+
+      const float ir_min = std::min(m[a][1], m[b][1]);
+      const float ir_max = std::max(m[a][1], m[b][1]);
+
+      if(ir_min >= params.individual_ab_threshold && (m[a][1] + m[b][1]) * 1.5f >= params.ab_threshold)
+      {
+        const float t_a = m[a][0] / (2.0f * M_PI) * periods[a];
+        const float t_b = m[b][0] / (2.0f * M_PI) * periods[b];
+        const float range = a == 1 && b == 0 ? 15.0f : b == 2 && a == 0 ? 6.0f : 30.0f;
+
+        float unwrapped_a = t_a, unwrapped_b = t_b, best_distance = periods[b];
+
+        for(float candidate = t_a; candidate < range; candidate += periods[a])
         {
-          for(int xi = -1; xi < 2; ++xi, ++j)
+          float d = candidate - t_b;
+          d -= std::floor(d / periods[b] + 0.5f) * periods[b];
+
+          if(std::abs(d) < best_distance)
           {
-            if(yi == 0 && xi == 0)
-            {
-              weight_acc += params.gaussian_kernel[j];
+            best_distance = std::abs(d);
+            unwrapped_a = candidate;
+            unwrapped_b = candidate - d;
+          }
+        }
 
-              weighted_m_acc[0] += params.gaussian_kernel[j] * m_ptr[0];
-              weighted_m_acc[1] += params.gaussian_kernel[j] * m_ptr[1];
-              continue;
-            }
+        // the phase noise scales with the period, weight the estimates by its inverse
+        const float t = (unwrapped_a / periods[a] + unwrapped_b / periods[b]) / (1.0f / periods[a] + 1.0f / periods[b]);
+
+        // the phases of processPixelStage2(), divided by their periods, with the missing one from the estimate
+        float u[3];
+        u[a] = unwrapped_a / periods[a];
+        u[b] = unwrapped_b / periods[b];
+        u[missing] = t / periods[missing];
+
+        const float t9 = u[0] + u[1] + u[2];
+
+        const float u6 = u[0] * 2.0f * M_PI, u7 = u[1] * 2.0f * M_PI, u8 = u[2] * 2.0f * M_PI;
+        const float v8 = u7 * 0.826977f - u8 * 0.110264f;
+        const float v6 = u8 * 0.551318f - u6 * 0.826977f;
+        const float v7 = u6 * 0.110264f - u7 * 0.551318f;
+        const float norm = v8 * v8 + v6 * v6 + v7 * v7;
+
+        float ir_x = 0 < params.ab_confidence_slope ? ir_min : ir_max;
+
+        ir_x = std::log(ir_x);
+        ir_x = (ir_x * params.ab_confidence_slope * 0.301030f + params.ab_confidence_offset) * 3.321928f;
+        ir_x = std::exp(ir_x);
+        ir_x = std::min(params.max_dealias_confidence, std::max(params.min_dealias_confidence, ir_x));
+        ir_x *= ir_x;
+
+        if(t9 >= 0.0f && norm <= ir_x)
+        {
+          phase = t9 * 0.333333f;
+          confidence = 1.0f - norm / ir_x;
+        }
+      }
+    }
+
+    *depth_out = phaseToDepth(x, y, phase);
+
+    if(confidence_out != 0)
+      *confidence_out = confidence;
+  }
+
+  /**
+   * Get tile buffers for a band, allocating new ones if all are in use.
+   * @return Buffers to give back with releaseTileBuffers().
+   */
+  TileBuffers *acquireTileBuffers()
+  {
+    {
+      libfreenect2::lock_guard guard(tile_buffers_mutex);
+
+      if(!free_tile_buffers.empty())
+      {
+        TileBuffers *tile = free_tile_buffers.back();
+        free_tile_buffers.pop_back();
+        return tile;
+      }
+    }
+
+    return new TileBuffers();
+  }
+
+  void releaseTileBuffers(TileBuffers *tile)
+  {
+    libfreenect2::lock_guard guard(tile_buffers_mutex);
+    free_tile_buffers.push_back(tile);
+  }
+
+  /** Allocate a new confidence frame. */
+  void newConfidenceFrame()
+  {
+    confidence_frame = new Frame(512 * 424 * 4);
+    confidence_frame->width = 512;
+    confidence_frame->height = 424;
+    confidence_frame->bytes_per_pixel = 4;
+    confidence_frame->format = Frame::Float;
+  }
+
+  /** Allocate a new IR frame. */
+  void newIrFrame()
+  {
+    ir_frame = new Frame(512 * 424 * 4);
+    ir_frame->width = 512;
+    ir_frame->height = 424;
+    ir_frame->bytes_per_pixel = 4;
+    ir_frame->format = Frame::Float;
+  }
+
+  ~CpuDepthPacketProcessorImpl()
+  {
+    for(size_t i = 0; i < free_tile_buffers.size(); ++i)
+      delete free_tile_buffers[i];
+
+    freeBuffers();
+    delete[] trig_tables;
+    delete pool;
+    delete ir_frame;
+    delete depth_frame;
+    delete confidence_frame;
+  }
+
+  /** Allocate a new depth frame. */
+  void newDepthFrame()
+  {
+    depth_frame = new Frame(512 * 424 * 4);
+    depth_frame->width = 512;
+    depth_frame->height = 424;
+    depth_frame->bytes_per_pixel = 4;
+    depth_frame->format = Frame::Float;
+  }
+
+  /**
+   * Unpack rows [y_begin, y_end) of all sub-images used by stage 1.
+   * @param data Depth packet.
+   * @param [out] out One plane per sub-image.
+   */
+  void unpackMeasurements(const unsigned char *data, int y_begin, int y_end, Planes<int16_t> &out)
+  {
+    for(int sub = 0; sub < NUM_MEASUREMENTS; ++sub)
+    {
+      // 298496 = 512 * 424 * 11 / 8 = number of bytes per sub image
+      const unsigned char *sub_image = data + 298496 * sub;
+
+      for(int y = y_begin; y < y_end; ++y)
+      {
+        int i = y < 212 ? y + 212 : 423 - y;
+        unpackDepthRow(sub_image + 704 * i, lut11to16, out.row(sub, y));
+      }
+    }
+  }
+
+  /**
+   * Switch between #p0_trig_tables and #trig_tables. The full tables are
+   * allocated, and filled if the P0 tables are loaded, when they are needed.
+   * @param compact Config::EnableCompactTrigTables.
+   */
+  void setCompactTrigTables(bool compact)
+  {
+    if(compact == compact_trig_tables)
+      return;
+
+    compact_trig_tables = compact;
+    LOG_INFO << "using " << (compact ? "compact" : "full") << " trigonometry tables";
+
+    if(!compact && trig_tables == 0)
+    {
+      trig_tables = new TrigTable[3];
+      if(p0_table0.height() != 0)
+        fillTrigTables();
+    }
+    else if(compact)
+    {
+      delete[] trig_tables;
+      trig_tables = 0;
+    }
+  }
+
+  /**
+   * Fill the trigonometry tables of the three frequencies from the P0 tables.
+   * The rows are split into bands over #pool, and each row is computed with
+   * the vectorized sincos kernel when there is one.
+   */
+  void fillTrigTables()
+  {
+    for(int i = 0; i < 3; ++i)
+    {
+      phase_cos[i] = std::cos(params.phase_in_rad[i]);
+      phase_sin[i] = std::sin(params.phase_in_rad[i]);
+    }
+
+    Region image = { 0, 512, 0, 424 };
+    forEachBand(image, [&](int y_begin, int y_end)
+    {
+      for(int y = y_begin; y < y_end; ++y)
+      {
+        fillCompactTrigTableRow(p0_table0, p0_trig_tables[0], y);
+        fillCompactTrigTableRow(p0_table1, p0_trig_tables[1], y);
+        fillCompactTrigTableRow(p0_table2, p0_trig_tables[2], y);
+
+        if(trig_tables != 0)
+        {
+          fillTrigTableRow(p0_table0, trig_tables[0], y);
+          fillTrigTableRow(p0_table1, trig_tables[1], y);
+          fillTrigTableRow(p0_table2, trig_tables[2], y);
+        }
+      }
+    }, 1);
+  }
+
+  /**
+   * Compute cos and sin of a row of angles.
+   * @param angle Angles of a row.
+   * @param [out] cos_out cos of each angle.
+   * @param [out] sin_out sin of each angle.
+   */
+  void sinCosRow(const float *angle, float *cos_out, float *sin_out)
+  {
+    if(kernels != 0)
+    {
+      kernels->sincos(angle, cos_out, sin_out, 512);
+      return;
+    }
+
+    for(int x = 0; x < 512; ++x)
+    {
+      cos_out[x] = std::cos(angle[x]);
+      sin_out[x] = std::sin(angle[x]);
+    }
+  }
 
-            const float *other_m_ptr = (m.ptr(y + yi, x + xi)->val) + offset;
-            float other_norm2 = other_m_ptr[0] * other_m_ptr[0] + other_m_ptr[1] * other_m_ptr[1];
-            // TODO: maybe fix numeric problems when norm = 0 - original code uses reciprocal square root, which returns +inf for +0
-            float other_inv_norm = 1.0f / std::sqrt(other_norm2);
-            other_inv_norm = (other_inv_norm == other_inv_norm) ? other_inv_norm : std::numeric_limits<float>::infinity();
+  /**
+   * Compute a row of the cos and sin trigonometry tables for each of the three #phase_in_rad parameters.
+   * @param p0table Angle at every (x, y) position.
+   * @param y Row to compute.
+   * @param [out] trig_rows 3 cos rows, followed by 3 sin rows for the three phases.
+   */
+  void computeTrigRow(Mat<uint16_t> &p0table, int y, float *const trig_rows[6])
+  {
+    float angle[512];
+
+    for(int phase = 0; phase < 3; ++phase)
+    {
+      // cos(p0 + phase) and sin(-(p0 + phase)) are cos and sin of the negated angle
+      for(int x = 0; x < 512; ++x)
+      {
+        float p0 = -((float)p0table.at(y, x)) * 0.000031 * M_PI;
+        angle[x] = -(p0 + params.phase_in_rad[phase]);
+      }
+
+      sinCosRow(angle, trig_rows[phase], trig_rows[phase + 3]);
+    }
+  }
+
+  /**
+   * Initialize a row of the cos and sin trigonometry tables for each of the three #phase_in_rad parameters.
+   * @param p0table Angle at every (x, y) position.
+   * @param [out] trig_table (3 cos tables, followed by 3 sin tables for the three phases.
+   * @param y Row to fill.
+   */
+  void fillTrigTableRow(Mat<uint16_t> &p0table, float trig_table[6][512*424], int y)
+  {
+    float *trig_rows[6];
+
+    for(int i = 0; i < 6; ++i)
+      trig_rows[i] = trig_table[i] + y * 512;
+
+    computeTrigRow(p0table, y, trig_rows);
+  }
+
+  /**
+   * Initialize a row of the compact trigonometry tables of one frequency.
+   * @param p0table Angle at every (x, y) position.
+   * @param [out] p0_trig_table cos(p0) table, followed by the sin(p0) table.
+   * @param y Row to fill.
+   */
+  void fillCompactTrigTableRow(Mat<uint16_t> &p0table, float p0_trig_table[2][512*424], int y)
+  {
+    const int offset = y * 512;
+    float angle[512];
+
+    for(int x = 0; x < 512; ++x)
+      angle[x] = -((float)p0table.at(y, x)) * 0.000031 * M_PI;
+
+    sinCosRow(angle, p0_trig_table[0] + offset, p0_trig_table[1] + offset);
+  }
+
+  /**
+   * Process measurement (all three layers).
+   * @param frequency Index of the modulation frequency.
+   * @param compact Use the compact trigonometry tables.
+   * @param x X position in the image.
+   * @param y Y position in the image.
+   * @param m Measurement.
+   * @param [out] m_out Processed measurement (IR a, IR b, IR amplitude).
+   */
+  void processMeasurementTriple(int frequency, bool compact, int x, int y, const int32_t* m, float* m_out)
+  {
+    const float abMultiplierPerFrq = params.ab_multiplier_per_frq[frequency];
+
+    float zmultiplier = z_table.at(y, x);
+    if (0 < zmultiplier)
+    {
+      bool saturated = (m[0] == 32767 || m[1] == 32767 || m[2] == 32767);
+      if (!saturated)
+      {
+        int offset = y * 512 + x;
+        float ir_image_a, ir_image_b;
+
+        if(compact)
+        {
+          // cos(p0 + phase) = cos(p0) cos(phase) - sin(p0) sin(phase)
+          // sin(-(p0 + phase)) = -sin(p0) cos(phase) - cos(p0) sin(phase)
+          float cos_p0 = p0_trig_tables[frequency][0][offset];
+          float sin_p0 = p0_trig_tables[frequency][1][offset];
+
+          float c = phase_cos[0] * m[0] + phase_cos[1] * m[1] + phase_cos[2] * m[2];
+          float s = phase_sin[0] * m[0] + phase_sin[1] * m[1] + phase_sin[2] * m[2];
+
+          ir_image_a = cos_p0 * c - sin_p0 * s;
+          ir_image_b = -(sin_p0 * c + cos_p0 * s);
+        }
+        else
+        {
+          const TrigTable &trig_table = trig_tables[frequency];
+          float cos_tmp0 = trig_table[0][offset];
+          float cos_tmp1 = trig_table[1][offset];
+          float cos_tmp2 = trig_table[2][offset];
+
+          float sin_negtmp0 = trig_table[3][offset];
+          float sin_negtmp1 = trig_table[4][offset];
+          float sin_negtmp2 = trig_table[5][offset];
+
+          // formula given in Patent US 8,587,771 B2
+          ir_image_a = cos_tmp0 * m[0] + cos_tmp1 * m[1] + cos_tmp2 * m[2];
+          ir_image_b = sin_negtmp0 * m[0] + sin_negtmp1 * m[1] + sin_negtmp2 * m[2];
+        }
+
+        // only if modeMask & 32 != 0;
+        if(true)//(modeMask & 32) != 0)
+        {
+            ir_image_a *= abMultiplierPerFrq;
+            ir_image_b *= abMultiplierPerFrq;
+        }
+        float ir_amplitude = std::sqrt(ir_image_a * ir_image_a + ir_image_b * ir_image_b) * params.ab_multiplier;
+
+        m_out[0] = ir_image_a;
+        m_out[1] = ir_image_b;
+        m_out[2] = ir_amplitude;
+      }
+      else
+      {
+        // Saturated pixel.
+        m_out[0] = 0;
+        m_out[1] = 0;
+        m_out[2] = 65535.0;
+      }
+    }
+    else
+    {
+      // Invalid pixel.
+      m_out[0] = 0;
+      m_out[1] = 0;
+      m_out[2] = 0;
+    }
+  }
+
+  /**
+   * Transform measurement.
+   * @param [in, out] m Measurement.
+   */
+  void transformMeasurements(float* m)
+  {
+    float tmp0, tmp1;
+
+    if(enable_fast_math)
+    {
+      float norm2 = m[0] * m[0] + m[1] * m[1];
+      tmp0 = fastPhaseAngle(m[1], m[0]);
+      tmp1 = (0.0f < norm2 ? norm2 * fastRsqrt(norm2) : 0.0f) * params.ab_multiplier;
+    }
+    else
+    {
+      tmp0 = std::atan2((m[1]), (m[0]));
+      tmp0 = tmp0 < 0 ? tmp0 + M_PI * 2.0f : tmp0;
+      tmp0 = (tmp0 != tmp0) ? 0 : tmp0;
+
+      tmp1 = std::sqrt(m[0] * m[0] + m[1] * m[1]) * params.ab_multiplier;
+    }
+
+    m[0] = tmp0; // phase
+    m[1] = tmp1; // ir amplitude - (possibly bilateral filtered)
+  }
+
+  /**
+   * Process first pixel stage.
+   * @param x Horizontal position.
+   * @param y Vertical position.
+   * @param raw Unpacked measurements, see unpackMeasurements().
+   * @param [out] m0_out First layer output.
+   * @param [out] m1_out Second layer output.
+   * @param [out] m2_out Third layer output.
+   * @param compact Use the compact trigonometry tables.
+   */
+  void processPixelStage1(int x, int y, const Planes<int16_t> &raw, float *m0_out, float *m1_out, float *m2_out, bool compact)
+  {
+    int32_t m0_raw[3], m1_raw[3], m2_raw[3];
+
+    m0_raw[0] = raw.at(0, y, x);
+    m0_raw[1] = raw.at(1, y, x);
+    m0_raw[2] = raw.at(2, y, x);
+    m1_raw[0] = raw.at(3, y, x);
+    m1_raw[1] = raw.at(4, y, x);
+    m1_raw[2] = raw.at(5, y, x);
+    m2_raw[0] = raw.at(6, y, x);
+    m2_raw[1] = raw.at(7, y, x);
+    m2_raw[2] = raw.at(8, y, x);
+
+    processMeasurementTriple(0, compact, x, y, m0_raw, m0_out);
+    processMeasurementTriple(1, compact, x, y, m1_raw, m1_out);
+    processMeasurementTriple(2, compact, x, y, m2_raw, m2_out);
+  }
+
+  /**
+   * Process stage 1 of the columns of #raw_region in one row.
+   * @param y Vertical position.
+   * @param raw Unpacked measurements, see unpackMeasurements().
+   * @param [out] m_out Stage 1 planes, IR a, IR b and IR amplitude of each frequency.
+   * @param compact Use the compact trigonometry tables.
+   */
+  void processRowStage1(int y, const Planes<int16_t> &raw, Planes<float> &m_out, bool compact)
+  {
+    const int x_begin = raw_region.x_begin, x_end = raw_region.x_end;
+
+    if(kernels == 0)
+    {
+      for(int x = x_begin; x < x_end; ++x)
+      {
+        float m[9];
+        processPixelStage1(x, y, raw, m + 0, m + 3, m + 6, compact);
+
+        for(int i = 0; i < 9; ++i)
+          m_out.at(i, y, x) = m[i];
+      }
+      return;
+    }
+
+    CpuDepthStage1Row row;
+
+    for(int i = 0; i < 9; ++i)
+    {
+      row.raw[i] = raw.row(i, y) + x_begin;
+      row.out[i] = m_out.row(i, y) + x_begin;
+    }
+
+    for(int f = 0; f < 3; ++f)
+    {
+      for(int i = 0; i < 6; ++i)
+        row.trig[f][i] = compact ? 0 : trig_tables[f][i] + y * 512 + x_begin;
+
+      row.p0_trig[f][0] = p0_trig_tables[f][0] + y * 512 + x_begin;
+      row.p0_trig[f][1] = p0_trig_tables[f][1] + y * 512 + x_begin;
+      row.phase_cos[f] = phase_cos[f];
+      row.phase_sin[f] = phase_sin[f];
+    }
+    row.z = z_table.ptr(y, x_begin);
+
+    (compact ? kernels->stage1_compact : kernels->stage1)(params, row, x_end - x_begin);
+  }
+
+  /**
+   * Process stage 2 of the columns of #stage2_region in one row.
+   * @param y Vertical position.
+   * @param m Stage 1 planes.
+   * @param m_filtered Bilateral filtered IR a and IR b planes of each frequency, NULL to use the ones of \a m.
+   * @param [out] ir_out IR row, may be NULL.
+   * @param [out] depth_out Depth row.
+   * @param [out] ir_sum_out Row of amplitude sums, may be NULL.
+   * @param [out] confidence_out Row of unwrapping confidences, may be NULL.
+   */
+  void processRowStage2(int y, const Planes<float> &m, const Planes<float> *m_filtered, float *ir_out, float *depth_out, float *ir_sum_out, float *confidence_out)
+  {
+    const int x_begin = stage2_region.x_begin, x_end = stage2_region.x_end;
+    CpuDepthStage2Row row;
+
+    for(int i = 0; i < 3; ++i)
+    {
+      row.m[3 * i + 0] = m_filtered != 0 ? m_filtered->row(2 * i + 0, y) : m.row(3 * i + 0, y);
+      row.m[3 * i + 1] = m_filtered != 0 ? m_filtered->row(2 * i + 1, y) : m.row(3 * i + 1, y);
+      row.m[3 * i + 2] = m.row(3 * i + 2, y);
+    }
+
+    if(kernels == 0)
+    {
+      for(int x = x_begin; x < x_end; ++x)
+      {
+        float m_pixel[9];
+
+        for(int i = 0; i < 9; ++i)
+          m_pixel[i] = row.m[i][x];
+
+        processPixelStage2(x, y, m_pixel + 0, m_pixel + 3, m_pixel + 6, ir_out != 0 ? ir_out + x : 0, depth_out + x, ir_sum_out != 0 ? ir_sum_out + x : 0,
+                           confidence_out != 0 ? confidence_out + x : 0);
+      }
+      return;
+    }
+
+    for(int i = 0; i < 9; ++i)
+      row.m[i] += x_begin;
+
+    Mat<float> &stage2_x_table = enable_binning ? binned_x_table : x_table;
+    Mat<float> &stage2_z_table = enable_binning ? binned_z_table : z_table;
+
+    row.x = stage2_x_table.ptr(y, x_begin);
+    row.z = stage2_z_table.ptr(y, x_begin);
+    row.ir = ir_out != 0 ? ir_out + x_begin : 0;
+    row.depth = depth_out + x_begin;
+    row.ir_sum = ir_sum_out != 0 ? ir_sum_out + x_begin : 0;
+    row.confidence = confidence_out != 0 ? confidence_out + x_begin : 0;
+
+    (enable_fast_math ? kernels->stage2_fast : kernels->stage2)(params, row, x_end - x_begin);
+  }
 
-            other_m_normalized[0] = other_m_ptr[0] * other_inv_norm;
-            other_m_normalized[1] = other_m_ptr[1] * other_inv_norm;
+  /**
+   * Bilateral filter of the columns of #stage2_region in one row, the border pixels keep their values.
+   * @tparam FastMath Use fastRsqrt() and fastExp2().
+   * @param y Vertical position.
+   * @param m Stage 1 planes.
+   * @param [out] m_out Filtered IR a and IR b planes of each frequency.
+   * @param [out] max_edge_test Row of max edge test results (1 if passed), may be NULL.
+   */
+  template<bool FastMath>
+  void filterRowStage1(int y, const Planes<float> &m, Planes<float> &m_out, unsigned char *max_edge_test)
+  {
+    const int x_begin = stage2_region.x_begin, x_end = stage2_region.x_end;
+    const bool border_row = y < 1 || y > height - 2;
+
+    for(int i = 0; i < 3; ++i)
+    {
+      float *a_out = m_out.row(2 * i + 0, y), *b_out = m_out.row(2 * i + 1, y);
+      const float *a = m.row(3 * i + 0, y), *b = m.row(3 * i + 1, y);
+
+      if(border_row)
+      {
+        std::copy(a + x_begin, a + x_end, a_out + x_begin);
+        std::copy(b + x_begin, b + x_end, b_out + x_begin);
+      }
+      else
+      {
+        if(x_begin == 0)
+        {
+          a_out[0] = a[0];
+          b_out[0] = b[0];
+        }
+        if(x_end == width)
+        {
+          a_out[width - 1] = a[width - 1];
+          b_out[width - 1] = b[width - 1];
+        }
+      }
+    }
+
+    if(border_row)
+    {
+      if(max_edge_test != 0)
+        std::fill(max_edge_test + x_begin, max_edge_test + x_end, 1);
+      return;
+    }
+
+    for(int x = std::max(x_begin, 1); x < std::min(x_end, width - 1); ++x)
+    {
+      bool max_edge_test_val;
+      filterPixelStage1<FastMath>(x, y, m, m_out, max_edge_test_val);
+
+      if(max_edge_test != 0)
+        max_edge_test[x] = max_edge_test_val ? 1 : 0;
+    }
+
+    if(max_edge_test != 0)
+    {
+      if(x_begin == 0)
+        max_edge_test[0] = 1;
+      if(x_end == width)
+        max_edge_test[width - 1] = 1;
+    }
+  }
+
+  /**
+   * Filter pixels in stage 1, except the border pixels, see filterRowStage1().
+   * The amplitudes are not filtered, stage 2 reads them from \a m.
+   * @tparam FastMath Use fastRsqrt() and fastExp2().
+   * @param x Horizontal position.
+   * @param y Vertical position.
+   * @param m Stage 1 planes.
+   * @param [out] m_out Filtered IR a and IR b planes of each frequency.
+   * @param [out] bilateral_max_edge_test Whether the accumulated distance of each image stayed within limits.
+   */
+  template<bool FastMath>
+  void filterPixelStage1(int x, int y, const Planes<float> &m, Planes<float> &m_out, bool& bilateral_max_edge_test)
+  {
+    bilateral_max_edge_test = true;
+
+    float m_normalized[2];
+    float other_m_normalized[2];
+
+    for(int i = 0; i < 3; ++i)
+    {
+      // neighbours are at +-1 and +-512, rows of a plane have no padding
+      const float *a_ptr = m.row(3 * i + 0, y) + x, *b_ptr = m.row(3 * i + 1, y) + x;
+
+      float norm2 = a_ptr[0] * a_ptr[0] + b_ptr[0] * b_ptr[0];
+      float inv_norm = FastMath ? fastRsqrt(norm2) : 1.0f / std::sqrt(norm2);
+      inv_norm = (inv_norm == inv_norm) ? inv_norm : std::numeric_limits<float>::infinity();
+
+      m_normalized[0] = a_ptr[0] * inv_norm;
+      m_normalized[1] = b_ptr[0] * inv_norm;
+
+      int j = 0;
+
+      float weight_acc = 0.0f;
+      float weighted_m_acc[2] = {0.0f, 0.0f};
+
+      float threshold = (params.joint_bilateral_ab_threshold * params.joint_bilateral_ab_threshold) / (params.ab_multiplier * params.ab_multiplier);
+      float joint_bilateral_exp = params.joint_bilateral_exp;
+
+      if(norm2 < threshold)
+      {
+        threshold = 0.0f;
+        joint_bilateral_exp = 0.0f;
+      }
+
+      float dist_acc = 0.0f;
+
+      for(int yi = -1; yi < 2; ++yi)
+      {
+        for(int xi = -1; xi < 2; ++xi, ++j)
+        {
+          if(yi == 0 && xi == 0)
+          {
+            weight_acc += params.gaussian_kernel[j];
+
+            weighted_m_acc[0] += params.gaussian_kernel[j] * a_ptr[0];
+            weighted_m_acc[1] += params.gaussian_kernel[j] * b_ptr[0];
+            continue;
+          }
+
+          const float other_m[2] = { a_ptr[yi * 512 + xi], b_ptr[yi * 512 + xi] };
+          float other_norm2 = other_m[0] * other_m[0] + other_m[1] * other_m[1];
+          // TODO: maybe fix numeric problems when norm = 0 - original code uses reciprocal square root, which returns +inf for +0
+          float other_inv_norm = FastMath ? fastRsqrt(other_norm2) : 1.0f / std::sqrt(other_norm2);
+          other_inv_norm = (other_inv_norm == other_inv_norm) ? other_inv_norm : std::numeric_limits<float>::infinity();
+
+          other_m_normalized[0] = other_m[0] * other_inv_norm;
+          other_m_normalized[1] = other_m[1] * other_inv_norm;
+
+          float dist = -(other_m_normalized[0] * m_normalized[0] + other_m_normalized[1] * m_normalized[1]);
+          dist += 1.0f;
+          dist *= 0.5f;
+
+          float weight = 0.0f;
+
+          if(other_norm2 >= threshold)
+          {
+            float exponent = -1.442695f * joint_bilateral_exp * dist;
+            weight = (params.gaussian_kernel[j] * (FastMath ? fastExp2(exponent * 1.442695f) : std::exp(exponent)));
+            dist_acc += dist;
+          }
+
+          weighted_m_acc[0] += weight * other_m[0];
+          weighted_m_acc[1] += weight * other_m[1];
+
+          weight_acc += weight;
+        }
+      }
+
+      bilateral_max_edge_test = bilateral_max_edge_test && dist_acc < params.joint_bilateral_max_edge;
+
+      m_out.at(2 * i + 0, y, x) = 0.0f < weight_acc ? weighted_m_acc[0] / weight_acc : 0.0f;
+      m_out.at(2 * i + 1, y, x) = 0.0f < weight_acc ? weighted_m_acc[1] / weight_acc : 0.0f;
+    }
+  }
+
+  /**
+   * Unwrap the phases of the three frequencies onto a common range, see processPixelStage2().
+   * @param t0, t1, t2 Phases scaled to [0, 3), [0, 15) and [0, 2).
+   * @param [out] t6, t7 Unwrapped \a t0 and \a t1.
+   * @param [out] t8 Half of the unwrapped \a t2.
+   */
+  static void unwrapPhases(float t0, float t1, float t2, float &t6, float &t7, float &t8)
+  {
+    float t5 = (std::floor((t1 - t0) * 0.333333f + 0.5f) * 3.0f + t0);
+    float t3 = (-t2 + t5);
+    float t4 = t3 * 2.0f;
+
+    bool c1 = t4 >= -t4; // true if t4 positive
+
+    float f1 = c1 ? 2.0f : -2.0f;
+    float f2 = c1 ? 0.5f : -0.5f;
+    t3 *= f2;
+    t3 = (t3 - std::floor(t3)) * f1;
+
+    bool c2 = 0.5f < std::abs(t3) && std::abs(t3) < 1.5f;
+
+    t6 = c2 ? t5 + 15.0f : t5;
+    t7 = c2 ? t1 + 15.0f : t1;
+
+    t8 = (std::floor((-t2 + t6) * 0.5f + 0.5f) * 2.0f + t2) * 0.5f;
+  }
+
+  /**
+   * Cell of #dealias_lut of a pixel.
+   * The wrap counts of unwrapPhases() only depend on t1 - t0 and t0 - t2,
+   * and change where t1 - t0 crosses an odd multiple of 1.5 or t0 - t2 a
+   * multiple of 0.5, so cells of that size make the same decisions. Both
+   * coordinates are positive, truncating them is a floor.
+   */
+  static int dealiasLutIndex(float t0, float t1, float t2)
+  {
+    const int i1 = std::min(int((t1 - t0) * 0.333333f + 1.5f), DEALIAS_LUT_D1_CELLS - 1);
+    const int i2 = std::min(int((t0 - t2 + 2.0f) * 2.0f), DEALIAS_LUT_D2_CELLS - 1);
+    return i1 * DEALIAS_LUT_D2_CELLS + i2;
+  }
+
+  /** unwrapPhases() with the wrap counts from #dealias_lut. */
+  void unwrapPhasesLut(float t0, float t1, float t2, float &t6, float &t7, float &t8) const
+  {
+    const DealiasOffsets &offsets = dealias_lut[dealiasLutIndex(t0, t1, t2)];
+
+    t6 = t0 + offsets.t0;
+    t7 = t1 + offsets.t1;
+    t8 = (t2 + offsets.t2) * 0.5f;
+  }
+
+  /** Fill #dealias_lut with the decisions of unwrapPhases() at the cell centres. */
+  void fillDealiasLut()
+  {
+    for(int i1 = 0; i1 < DEALIAS_LUT_D1_CELLS; ++i1)
+    {
+      for(int i2 = 0; i2 < DEALIAS_LUT_D2_CELLS; ++i2)
+      {
+        const float t0 = 1.5f, t1 = t0 + 3.0f * (i1 - 1), t2 = t0 - (0.5f * i2 - 1.75f);
+        float t6, t7, t8;
+        unwrapPhases(t0, t1, t2, t6, t7, t8);
+
+        DealiasOffsets &offsets = dealias_lut[i1 * DEALIAS_LUT_D2_CELLS + i2];
+        offsets.t0 = std::floor(t6 - t0 + 0.5f);
+        offsets.t1 = std::floor(t7 - t1 + 0.5f);
+        offsets.t2 = std::floor(2.0f * t8 - t2 + 0.5f);
+      }
+    }
+  }
 
-            float dist = -(other_m_normalized[0] * m_normalized[0] + other_m_normalized[1] * m_normalized[1]);
-            dist += 1.0f;
-            dist *= 0.5f;
+  /**
+   * Map the unwrapped phase of a pixel to its depth, the end of stage 2.
+   * @param x Horizontal position.
+   * @param y Vertical position.
+   * @param phase Unwrapped phase, 0 for invalid pixels.
+   * @return Depth.
+   */
+  float phaseToDepth(int x, int y, float phase)
+  {
+    // this seems to be the phase to depth mapping :)
+    float zmultiplier = enable_binning ? binned_z_table.at(y, x) : z_table.at(y, x);
+    float xmultiplier = enable_binning ? binned_x_table.at(y, x) : x_table.at(y, x);
 
-            float weight = 0.0f;
+    phase = 0 < phase ? phase + params.phase_offset : phase;
 
-            if(other_norm2 >= threshold)
-            {
-              weight = (params.gaussian_kernel[j] * std::exp(-1.442695f * joint_bilateral_exp * dist));
-              dist_acc += dist;
-            }
+    float depth_linear = zmultiplier * phase;
+    float max_depth = phase * params.unambigious_dist * 2;
 
-            weighted_m_acc[0] += weight * other_m_ptr[0];
-            weighted_m_acc[1] += weight * other_m_ptr[1];
+    bool cond1 = /*(modeMask & 32) != 0*/ true && 0 < depth_linear && 0 < max_depth;
 
-            weight_acc += weight;
-          }
-        }
+    xmultiplier = (xmultiplier * 90) / (max_depth * max_depth * 8192.0);
 
-        bilateral_max_edge_test = bilateral_max_edge_test && dist_acc < params.joint_bilateral_max_edge;
+    float depth_fit = depth_linear / (-depth_linear * xmultiplier + 1);
 
-        m_out[0] = 0.0f < weight_acc ? weighted_m_acc[0] / weight_acc : 0.0f;
-        m_out[1] = 0.0f < weight_acc ? weighted_m_acc[1] / weight_acc : 0.0f;
-        m_out[2] = m_ptr[2];
-      }
-    }
+    depth_fit = depth_fit < 0 ? 0 : depth_fit;
+    return cond1 ? depth_fit : depth_linear; // r1.y -> later r2.z
   }
 
-  void processPixelStage2(int x, int y, float *m0, float *m1, float *m2, float *ir_out, float *depth_out, float *ir_sum_out)
+  void processPixelStage2(int x, int y, float *m0, float *m1, float *m2, float *ir_out, float *depth_out, float *ir_sum_out, float *confidence_out)
   {
     //// 10th measurement
     //float m9 = 1; // decodePixelMeasurement(data, 9, x, y);
@@ -596,7 +2093,7 @@ public:
 
     float ir_sum = m0[1] + m1[1] + m2[1];
 
-    float phase;
+    float phase, confidence = 0.0f;
     // if(DISABLE_DISAMBIGUATION)
     if(false)
     {
@@ -628,23 +2125,12 @@ public:
         float t1 = m1[0] / (2.0f * M_PI) * 15.0f;
         float t2 = m2[0] / (2.0f * M_PI) * 2.0f;
 
-        float t5 = (std::floor((t1 - t0) * 0.333333f + 0.5f) * 3.0f + t0);
-        float t3 = (-t2 + t5);
-        float t4 = t3 * 2.0f;
-
-        bool c1 = t4 >= -t4; // true if t4 positive
-
-        float f1 = c1 ? 2.0f : -2.0f;
-        float f2 = c1 ? 0.5f : -0.5f;
-        t3 *= f2;
-        t3 = (t3 - std::floor(t3)) * f1;
+        float t6, t7, t8;
 
-        bool c2 = 0.5f < std::abs(t3) && std::abs(t3) < 1.5f;
-
-        float t6 = c2 ? t5 + 15.0f : t5;
-        float t7 = c2 ? t1 + 15.0f : t1;
-
-        float t8 = (std::floor((-t2 + t6) * 0.5f + 0.5f) * 2.0f + t2) * 0.5f;
+        if(enable_dealias_lut)
+          unwrapPhasesLut(t0, t1, t2, t6, t7, t8);
+        else
+          unwrapPhases(t0, t1, t2, t6, t7, t8);
 
         t6 *= 0.333333f; // = / 3
         t7 *= 0.066667f; // = / 15
@@ -689,111 +2175,132 @@ public:
         float mask3 = params.max_dealias_confidence * params.max_dealias_confidence >= norm ? 1.0f : 0.0f;
         t10 *= mask3;
         phase = true/*(modeMask & 2) != 0*/ ? t11 : t10;
+
+        // margin of the dealiasing test, 1 when the three phases agree exactly
+        confidence = 0 < t11 ? 1.0f - norm / ir_x : 0.0f;
       }
     }
 
-    // this seems to be the phase to depth mapping :)
-    float zmultiplier = z_table.at(y, x);
-    float xmultiplier = x_table.at(y, x);
-
-    phase = 0 < phase ? phase + params.phase_offset : phase;
-
-    float depth_linear = zmultiplier * phase;
-    float max_depth = phase * params.unambigious_dist * 2;
-
-    bool cond1 = /*(modeMask & 32) != 0*/ true && 0 < depth_linear && 0 < max_depth;
-
-    xmultiplier = (xmultiplier * 90) / (max_depth * max_depth * 8192.0);
-
-    float depth_fit = depth_linear / (-depth_linear * xmultiplier + 1);
-
-    depth_fit = depth_fit < 0 ? 0 : depth_fit;
-    float depth = cond1 ? depth_fit : depth_linear; // r1.y -> later r2.z
-
     // depth
-    *depth_out = depth;
+    *depth_out = phaseToDepth(x, y, phase);
     if(ir_sum_out != 0)
     {
       *ir_sum_out = ir_sum;
     }
 
+    if(confidence_out != 0)
+    {
+      *confidence_out = confidence;
+    }
+
     // ir
     //*ir_out = std::min((m1[2]) * ab_output_multiplier, 65535.0f);
     // ir avg
-    *ir_out = std::min((m0[2] + m1[2] + m2[2]) * 0.3333333f * params.ab_output_multiplier, 65535.0f);
+    if(ir_out != 0)
+    {
+      *ir_out = std::min((m0[2] + m1[2] + m2[2]) * 0.3333333f * params.ab_output_multiplier, 65535.0f);
+    }
     //ir_out[0] = std::min(m0[2] * ab_output_multiplier, 65535.0f);
     //ir_out[1] = std::min(m1[2] * ab_output_multiplier, 65535.0f);
     //ir_out[2] = std::min(m2[2] * ab_output_multiplier, 65535.0f);
   }
 
-  void filterPixelStage2(int x, int y, Mat<Vec<float, 3> > &m, bool max_edge_test_ok, float *depth_out)
+  /**
+   * Edge-aware filter of the columns of #roi in one row, the border pixels keep their depth if it is in range.
+   * @param y Vertical position.
+   * @param m Planes of raw depth, raw depth passing the bilateral max edge test (else 0) and amplitude sum.
+   * @param max_edge_test Row of max edge test results (1 if passed).
+   * @param [out] depth_out Filtered depth row.
+   */
+  void filterRowStage2(int y, const Planes<float> &m, const unsigned char *max_edge_test, float *depth_out)
+  {
+    const int x_begin = roi.x_begin, x_end = roi.x_end;
+    const float *raw_depth = m.row(0, y);
+
+    if(y < 1 || y > height - 2)
+    {
+      for(int x = x_begin; x < x_end; ++x)
+        depth_out[x] = raw_depth[x] >= params.min_depth && raw_depth[x] <= params.max_depth ? raw_depth[x] : 0.0f;
+      return;
+    }
+
+    if(x_begin == 0)
+      depth_out[0] = raw_depth[0] >= params.min_depth && raw_depth[0] <= params.max_depth ? raw_depth[0] : 0.0f;
+    if(x_end == width)
+      depth_out[width - 1] = raw_depth[width - 1] >= params.min_depth && raw_depth[width - 1] <= params.max_depth ? raw_depth[width - 1] : 0.0f;
+
+    for(int x = std::max(x_begin, 1); x < std::min(x_end, width - 1); ++x)
+      filterPixelStage2(x, y, m, max_edge_test[x] == 1, depth_out + x);
+  }
+
+  /**
+   * Filter pixels in stage 2, except the border pixels, see filterRowStage2().
+   * @param x Horizontal position.
+   * @param y Vertical position.
+   * @param m Planes of raw depth, raw depth passing the bilateral max edge test (else 0) and amplitude sum.
+   * @param max_edge_test_ok Whether the pixel passed the bilateral max edge test.
+   * @param [out] depth_out Filtered depth.
+   */
+  void filterPixelStage2(int x, int y, const Planes<float> &m, bool max_edge_test_ok, float *depth_out)
   {
-    Vec<float, 3> &depth_and_ir_sum = m.at(y, x);
-    float &raw_depth = depth_and_ir_sum.val[0], &ir_sum = depth_and_ir_sum.val[2];
+    const float raw_depth = m.at(0, y, x), ir_sum = m.at(2, y, x);
 
     if(raw_depth >= params.min_depth && raw_depth <= params.max_depth)
     {
-      if(x < 1 || y < 1 || x > 510 || y > 422)
-      {
-        *depth_out = raw_depth;
-      }
-      else
-      {
-        float ir_sum_acc = ir_sum, squared_ir_sum_acc = ir_sum * ir_sum, min_depth = raw_depth, max_depth = raw_depth;
+      float ir_sum_acc = ir_sum, squared_ir_sum_acc = ir_sum * ir_sum, min_depth = raw_depth, max_depth = raw_depth;
 
-        for(int yi = -1; yi < 2; ++yi)
+      for(int yi = -1; yi < 2; ++yi)
+      {
+        for(int xi = -1; xi < 2; ++xi)
         {
-          for(int xi = -1; xi < 2; ++xi)
-          {
-            if(yi == 0 && xi == 0) continue;
+          if(yi == 0 && xi == 0) continue;
 
-            Vec<float, 3> &other = m.at(y + yi, x + xi);
+          const float other_depth = m.at(1, y + yi, x + xi), other_ir_sum = m.at(2, y + yi, x + xi);
 
-            ir_sum_acc += other.val[2];
-            squared_ir_sum_acc += other.val[2] * other.val[2];
+          ir_sum_acc += other_ir_sum;
+          squared_ir_sum_acc += other_ir_sum * other_ir_sum;
 
-            if(0.0f < other.val[1])
-            {
-              min_depth = std::min(min_depth, other.val[1]);
-              max_depth = std::max(max_depth, other.val[1]);
-            }
+          if(0.0f < other_depth)
+          {
+            min_depth = std::min(min_depth, other_depth);
+            max_depth = std::max(max_depth, other_depth);
           }
         }
+      }
 
-        float tmp0 = std::sqrt(squared_ir_sum_acc * 9.0f - ir_sum_acc * ir_sum_acc) / 9.0f;
-        float edge_avg = std::max(ir_sum_acc / 9.0f, params.edge_ab_avg_min_value);
-        tmp0 /= edge_avg;
+      float tmp0 = std::sqrt(squared_ir_sum_acc * 9.0f - ir_sum_acc * ir_sum_acc) / 9.0f;
+      float edge_avg = std::max(ir_sum_acc / 9.0f, params.edge_ab_avg_min_value);
+      tmp0 /= edge_avg;
 
-        float abs_min_diff = std::abs(raw_depth - min_depth);
-        float abs_max_diff = std::abs(raw_depth - max_depth);
+      float abs_min_diff = std::abs(raw_depth - min_depth);
+      float abs_max_diff = std::abs(raw_depth - max_depth);
 
-        float avg_diff = (abs_min_diff + abs_max_diff) * 0.5f;
-        float max_abs_diff = std::max(abs_min_diff, abs_max_diff);
+      float avg_diff = (abs_min_diff + abs_max_diff) * 0.5f;
+      float max_abs_diff = std::max(abs_min_diff, abs_max_diff);
 
-        bool cond0 =
-            0.0f < raw_depth &&
-            tmp0 >= params.edge_ab_std_dev_threshold &&
-            params.edge_close_delta_threshold < abs_min_diff &&
-            params.edge_far_delta_threshold < abs_max_diff &&
-            params.edge_max_delta_threshold < max_abs_diff &&
-            params.edge_avg_delta_threshold < avg_diff;
+      bool cond0 =
+          0.0f < raw_depth &&
+          tmp0 >= params.edge_ab_std_dev_threshold &&
+          params.edge_close_delta_threshold < abs_min_diff &&
+          params.edge_far_delta_threshold < abs_max_diff &&
+          params.edge_max_delta_threshold < max_abs_diff &&
+          params.edge_avg_delta_threshold < avg_diff;
 
-        *depth_out = cond0 ? 0.0f : raw_depth;
+      *depth_out = cond0 ? 0.0f : raw_depth;
 
-        if(!cond0)
+      if(!cond0)
+      {
+        if(max_edge_test_ok)
         {
-          if(max_edge_test_ok)
-          {
-            //float tmp1 = 1500.0f > raw_depth ? 30.0f : 0.02f * raw_depth;
-            float edge_count = 0.0f;
+          //float tmp1 = 1500.0f > raw_depth ? 30.0f : 0.02f * raw_depth;
+          float edge_count = 0.0f;
 
-            *depth_out = edge_count > params.max_edge_count ? 0.0f : raw_depth;
-          }
-          else
-          {
-            *depth_out = !max_edge_test_ok ? 0.0f : raw_depth;
-            *depth_out = true ? *depth_out : raw_depth;
-          }
+          *depth_out = edge_count > params.max_edge_count ? 0.0f : raw_depth;
+        }
+        else
+        {
+          *depth_out = !max_edge_test_ok ? 0.0f : raw_depth;
+          *depth_out = true ? *depth_out : raw_depth;
         }
       }
     }
@@ -801,9 +2308,267 @@ public:
     {
       *depth_out = 0.0f;
     }
+  }
+
+  /**
+   * Rank the phase unwrapping hypotheses of a pixel.
+   * @param t Phases of the three frequencies scaled by 3, 15 and 2.
+   * @param num_hyps Number of hypotheses to keep, at most 3.
+   * @param [out] phase_out Fused phases of the most likely hypotheses.
+   * @param [out] err_out Residuals of the most likely hypotheses.
+   */
+  static void kdeUnwrapPhase(const float t[3], size_t num_hyps, float *phase_out, float *err_out)
+  {
+    // weights of the residuals in the cost function
+    const float w1 = 1.0f, w2 = 10.0f, w3 = 1.0218f;
+
+    float err_min[3] = {100000.0f, 200000.0f, 300000.0f};
+    int ind_min[3] = {0, 0, 0};
+
+    for(int i = 0; i < KDE_NUM_HYPOTHESES; ++i)
+    {
+      const float err1 = 3.0f * kde_n_list[i] - 15.0f * kde_k_list[i] - (t[1] - t[0]);
+      const float err2 = 3.0f * kde_n_list[i] - 2.0f * kde_m_list[i] - (t[2] - t[0]);
+      const float err3 = 15.0f * kde_k_list[i] - 2.0f * kde_m_list[i] - (t[2] - t[1]);
+      const float err = w1 * err1 * err1 + w2 * err2 * err2 + w3 * err3 * err3;
+
+      // insertion into the sorted list of the best hypotheses
+      size_t j = num_hyps;
+      for(; j > 0 && err < err_min[j - 1]; --j)
+      {
+        if(j < num_hyps)
+        {
+          err_min[j] = err_min[j - 1];
+          ind_min[j] = ind_min[j - 1];
+        }
+      }
+
+      if(j < num_hyps)
+      {
+        err_min[j] = err;
+        ind_min[j] = i;
+      }
+    }
+
+    for(size_t j = 0; j < num_hyps; ++j)
+    {
+      const int i = ind_min[j];
+      // average of the unwrapped phases of the three frequencies
+      phase_out[j] = (t[2] / 2.0f + kde_m_list[i] + t[1] / 15.0f + kde_k_list[i] + t[0] / 3.0f + kde_n_list[i]) / 3.0f;
+      err_out[j] = err_min[j];
+    }
+  }
+
+  /**
+   * Predict the phase variance of a frequency from its amplitude, with the
+   * model sigma = atan(sqrt(1 / (gamma0 * a + gamma1 * a^2 + gamma2) - 1)).
+   * See section 3.3 and 4.4 of the KDE paper.
+   * @param frequency Index of the modulation frequency.
+   * @param ir Amplitude.
+   * @return Phase variance.
+   */
+  static float kdePhaseVariance(int frequency, float ir)
+  {
+    static const float gamma[3][3] = {
+      {0.8211288451f, -0.002601348899f, -3.549793908f},
+      {1.259642407f, -0.005478390508f, -4.335841127f},
+      {0.6447928035f, -0.0009627273649f, -3.368205575f}
+    };
+    static const float roots[3] = {5.64173671f, 4.31705182f, 6.84453530f};
+
+    float q = gamma[frequency][0] * ir + gamma[frequency][1] * ir * ir + gamma[frequency][2];
+    q *= q;
+
+    float sigma;
+    if(1.0f < q)
+      sigma = std::atan(std::sqrt(1.0f / (q - 1.0f)));
+    else
+      sigma = roots[frequency] < ir ? roots[frequency] * 0.5f * M_PI / ir : 0.5f * M_PI;
+
+    sigma = std::max(sigma, 0.001f);
+    return sigma * sigma;
+  }
+
+  /**
+   * Compute the unwrapping hypotheses of a pixel and their confidences.
+   * @param a IR a of each frequency.
+   * @param b IR b of each frequency.
+   * @param [out] phase_out Phase of each hypothesis.
+   * @param [out] conf_out Confidence of each hypothesis.
+   */
+  void processPixelKdePhase(const float *a, const float *b, float *phase_out, float *conf_out)
+  {
+    static const float frequency_scale[3] = {3.0f, 15.0f, 2.0f};
+    float t[3], ir[3];
+
+    for(int i = 0; i < 3; ++i)
+    {
+      float phase;
+
+      if(enable_fast_math)
+      {
+        phase = fastPhaseAngle(b[i], a[i]);
+      }
+      else
+      {
+        phase = std::atan2(b[i], a[i]);
+        phase = (phase != phase) ? 0.0f : phase;
+        phase = phase < 0.0f ? phase + 2.0f * M_PI : phase;
+      }
+
+      ir[i] = std::sqrt(a[i] * a[i] + b[i] * b[i]) * params.ab_multiplier;
+      // scale with the least common multiples of the modulation frequencies
+      t[i] = phase / (2.0f * M_PI) * frequency_scale[i];
+    }
+
+    const size_t num_hyps = params.num_hyps;
+    float err[3];
+    kdeUnwrapPhase(t, num_hyps, phase_out, err);
+
+    float phase_likelihood = 0.0f;
+
+    // near saturation the amplitude says nothing about the phase noise
+    if(ir[0] + ir[1] + ir[2] < 0.4f * 65535.0f)
+    {
+      const float var = kdePhaseVariance(0, ir[0]) + kdePhaseVariance(1, ir[1]) + kdePhaseVariance(2, ir[2]);
+      phase_likelihood = std::exp(-var / (2.0f * params.phase_confidence_scale));
+      phase_likelihood = (phase_likelihood != phase_likelihood) ? 0.0f : phase_likelihood;
+    }
+
+    const float max_phase = params.max_depth * 9.0f / 18750.0f;
+
+    for(size_t j = 0; j < num_hyps; ++j)
+    {
+      const float unwrapping_likelihood = phase_likelihood * std::exp(-err[j] / (2.0f * params.unwrapping_likelihood_scale));
+      // suppress hypotheses beyond the allowed range
+      conf_out[j] = phase_out[j] > max_phase ? 0.0f : unwrapping_likelihood;
+    }
+  }
+
+  /**
+   * Compute the unwrapping hypotheses of the columns of #stage2_region in one row.
+   * @param y Vertical position.
+   * @param m Stage 1 planes.
+   * @param m_filtered Bilateral filtered IR a and IR b planes of each frequency, NULL to use the ones of \a m.
+   * @param [out] ir_out IR row, may be NULL.
+   */
+  void processRowKdePhase(int y, const Planes<float> &m, const Planes<float> *m_filtered, float *ir_out)
+  {
+    const int num_hyps = int(params.num_hyps);
+
+    for(int x = stage2_region.x_begin; x < stage2_region.x_end; ++x)
+    {
+      float a[3], b[3], phase[3], conf[3];
+
+      for(int i = 0; i < 3; ++i)
+      {
+        a[i] = m_filtered != 0 ? m_filtered->at(2 * i + 0, y, x) : m.at(3 * i + 0, y, x);
+        b[i] = m_filtered != 0 ? m_filtered->at(2 * i + 1, y, x) : m.at(3 * i + 1, y, x);
+      }
+
+      processPixelKdePhase(a, b, phase, conf);
+
+      for(int j = 0; j < num_hyps; ++j)
+      {
+        kde_phase_conf.at(j, y, x) = phase[j];
+        kde_phase_conf.at(num_hyps + j, y, x) = conf[j];
+      }
+
+      if(ir_out != 0)
+        ir_out[x] = std::min((m.at(2, y, x) + m.at(5, y, x) + m.at(8, y, x)) * 0.3333333f * params.ab_output_multiplier, 65535.0f);
+    }
+  }
+
+  /**
+   * Choose the hypothesis of a pixel with the highest kernel density in its
+   * neighbourhood and convert it to depth.
+   * @param x Horizontal position.
+   * @param y Vertical position.
+   * @param [out] depth_out Depth, 0 if the density is below the threshold or the depth out of range.
+   * @param [out] confidence_out Density of the chosen hypothesis, 0 whenever the depth is. May be NULL.
+   */
+  void filterPixelKde(int x, int y, float *depth_out, float *confidence_out)
+  {
+    const int num_hyps = int(params.num_hyps), radius = int(params.kde_neigborhood_size);
+
+    float phase[3], kde_val[3] = {0.0f, 0.0f, 0.0f};
+
+    for(int j = 0; j < num_hyps; ++j)
+      phase[j] = kde_phase_conf.at(j, y, x);
+
+    if(x >= 1 && x <= width - 2)
+    {
+      // same support as the OpenCL filter_kde() and filter_kde3(), without the border columns and the first row
+      const int x_begin = std::max(x - radius, 1), x_end = std::min(x + radius, width - 2);
+      const int y_begin = std::max(y - radius, 1), y_end = std::min(y + radius, height - 1);
+
+      const float exp_scale = -1.0f / (2.0f * params.kde_sigma_sqr);
+      float sum[3] = {0.0f, 0.0f, 0.0f}, sum_gauss = 0.0f;
+
+      for(int yi = y_begin; yi <= y_end; ++yi)
+      {
+        const float gauss_y = kde_gauss_kernel[yi - y + radius];
+
+        for(int j = 0; j < num_hyps; ++j)
+        {
+          const float *phase_row = kde_phase_conf.row(j, yi), *conf_row = kde_phase_conf.row(num_hyps + j, yi);
+
+          for(int xi = x_begin; xi <= x_end; ++xi)
+          {
+            // invalid and saturated pixels have no confidence, skip their exponentials
+            if(conf_row[xi] == 0.0f)
+              continue;
+
+            const float weight = gauss_y * kde_gauss_kernel[xi - x + radius] * conf_row[xi];
+            sum_gauss += weight;
+
+            for(int h = 0; h < num_hyps; ++h)
+            {
+              const float diff = phase_row[xi] - phase[h];
+              const float exponent = diff * diff * exp_scale;
+
+              // far hypotheses contribute nothing a float sum could hold, and their denormals are slow
+              if(exponent > -80.0f)
+                sum[h] += weight * (enable_fast_math ? fastExp2(exponent * 1.442695f) : std::exp(exponent));
+            }
+          }
+        }
+      }
+
+      for(int h = 0; h < num_hyps; ++h)
+        kde_val[h] = sum_gauss > 0.5f ? sum[h] / sum_gauss : sum[h] * 2.0f;
+    }
 
-    // override raw depth
-    depth_and_ir_sum.val[0] = depth_and_ir_sum.val[1];
+    int best = 0;
+    for(int h = 1; h < num_hyps; ++h)
+      best = kde_val[h] > kde_val[best] ? h : best;
+
+    const float phase_final = phase[best];
+    float max_val = kde_val[best];
+
+    float zmultiplier = enable_binning ? binned_z_table.at(y, x) : z_table.at(y, x);
+    float xmultiplier = enable_binning ? binned_x_table.at(y, x) : x_table.at(y, x);
+
+    float depth_linear = zmultiplier * phase_final;
+    float max_depth = phase_final * params.unambigious_dist * 2;
+
+    bool cond1 = 0 < depth_linear && 0 < max_depth;
+
+    xmultiplier = (xmultiplier * 90) / (max_depth * max_depth * 8192.0);
+
+    float depth_fit = depth_linear / (-depth_linear * xmultiplier + 1);
+    depth_fit = depth_fit < 0 ? 0 : depth_fit;
+
+    float depth = cond1 ? depth_fit : depth_linear;
+
+    // filter_kde() tests the range of the fitted depth, filter_kde3() the range of the linear depth
+    const float range_depth = num_hyps == 3 ? depth_linear : depth;
+    max_val = range_depth < params.min_depth || range_depth > params.max_depth ? 0.0f : max_val;
+
+    *depth_out = max_val >= params.kde_threshold ? depth : 0.0f;
+
+    if(confidence_out != 0)
+      *confidence_out = max_val >= params.kde_threshold ? max_val : 0.0f;
   }
 };
 
@@ -812,19 +2577,47 @@ CpuDepthPacketProcessor::CpuDepthPacketProcessor() :
 {
 }
 
+CpuDepthPacketProcessor::CpuDepthPacketProcessor(CpuDepthPacketProcessorImpl *impl) :
+    impl_(impl)
+{
+}
+
 CpuDepthPacketProcessor::~CpuDepthPacketProcessor()
 {
   delete impl_;
 }
 
+static CpuDepthPacketProcessorImpl *newKdeImpl()
+{
+  CpuDepthPacketProcessorImpl *impl = new CpuDepthPacketProcessorImpl();
+  impl->enableKde();
+  return impl;
+}
+
+CpuKdeDepthPacketProcessor::CpuKdeDepthPacketProcessor() :
+    CpuDepthPacketProcessor(newKdeImpl())
+{
+}
+
 void CpuDepthPacketProcessor::setConfiguration(const libfreenect2::DepthPacketProcessor::Config &config)
 {
   DepthPacketProcessor::setConfiguration(config);
   
   impl_->params.min_depth = config.MinDepth * 1000.0f;
   impl_->params.max_depth = config.MaxDepth * 1000.0f;
+
   impl_->enable_bilateral_filter = config.EnableBilateralFilter;
   impl_->enable_edge_filter = config.EnableEdgeAwareFilter;
+  impl_->enable_tiled_processing = config.EnableTiledProcessing;
+  impl_->enable_fast_math = config.EnableFastMath;
+  impl_->enable_dealias_lut = config.EnableDealiasingLut;
+  impl_->selectInstantiations();
+  impl_->setNumThreads(config.NumThreads);
+  impl_->setKernels(config.DepthKernels);
+  impl_->setHugePages(config.EnableHugePages);
+  impl_->setCompactTrigTables(config.EnableCompactTrigTables);
+  impl_->setBinning(config.EnableBinning);
+  impl_->setRoi(int(config_.RoiX), int(config_.RoiY), int(config_.RoiWidth), int(config_.RoiHeight));
 }
 
 /**
@@ -857,9 +2650,7 @@ void CpuDepthPacketProcessor::loadP0TablesFromCommandResponse(unsigned char* buf
     Mat<uint16_t>(424, 512, p0table->p0table2).copyTo(impl_->p0_table2);
   }
 
-  impl_->fillTrigTable(impl_->p0_table0, impl_->trig_table0);
-  impl_->fillTrigTable(impl_->p0_table1, impl_->trig_table1);
-  impl_->fillTrigTable(impl_->p0_table2, impl_->trig_table2);
+  impl_->fillTrigTables();
 }
 
 void CpuDepthPacketProcessor::loadXZTables(const float *xtable, const float *ztable)
@@ -869,6 +2660,10 @@ void CpuDepthPacketProcessor::loadXZTables(const float *xtable, const float *zta
 
   impl_->z_table.create(424, 512);
   std::copy(ztable, ztable + TABLE_SIZE, impl_->z_table.ptr(0,0));
+
+  impl_->binned_x_table.create(212, 256);
+  impl_->binned_z_table.create(212, 256);
+  binXZTables(xtable, ztable, impl_->binned_x_table.ptr(0, 0), impl_->binned_z_table.ptr(0, 0));
 }
 
 void CpuDepthPacketProcessor::loadLookupTable(const short *lut)
@@ -876,6 +2671,28 @@ void CpuDepthPacketProcessor::loadLookupTable(const short *lut)
   std::copy(lut, lut + LUT_SIZE, impl_->lut11to16);
 }
 
+bool CpuDepthPacketProcessor::supportsPartialPackets() const
+{
+  // processPartial() works at full resolution and has no KDE
+  return !impl_->enable_binning && !impl_->enable_kde;
+}
+
+void CpuDepthPacketProcessor::forEachFrameBand(size_t rows, const std::function<void(size_t, size_t)> &f)
+{
+  WorkerPool *pool = impl_->pool;
+  if(pool == 0)
+  {
+    f(0, rows);
+    return;
+  }
+
+  const size_t num_bands = pool->size();
+  pool->run(num_bands, [&](size_t band)
+  {
+    f(band * rows / num_bands, (band + 1) * rows / num_bands);
+  });
+}
+
 /**
  * Process a packet.
  * @param packet Packet to process.
@@ -884,99 +2701,129 @@ void CpuDepthPacketProcessor::process(const DepthPacket &packet)
 {
   if(listener_ == 0) return;
 
+  // skip the work for frames the listener does not take
+  const unsigned int frame_types = listener_->frameTypes();
+  const bool output_ir = (frame_types & Frame::Ir) != 0, output_depth = (frame_types & Frame::Depth) != 0;
+  const bool output_confidence = (frame_types & Frame::Confidence) != 0;
+
+  if(!output_ir && !output_depth && !output_confidence) return;
+
+  // frequencies with all 3 sub-images, only partial packets miss some, see DepthPacketStreamParser::setPartialPackets()
+  unsigned int frequencies = 0;
+  for(int f = 0; f < 3; ++f)
+    if(((packet.lost_subsequences >> (3 * f)) & 7) == 0)
+      frequencies |= 1u << f;
+
+  const bool partial = frequencies != 7;
+  if(partial && (impl_->enable_binning || impl_->enable_kde))
+  {
+    LOG_DEBUG << "skipping packet " << packet.sequence << " with missing sub-images, partial packets need the default pipeline";
+    return;
+  }
+
   impl_->startTiming();
 
   impl_->ir_frame->timestamp = packet.timestamp;
   impl_->depth_frame->timestamp = packet.timestamp;
+  impl_->confidence_frame->timestamp = packet.timestamp;
   impl_->ir_frame->sequence = packet.sequence;
   impl_->depth_frame->sequence = packet.sequence;
-
-  Mat<Vec<float, 9> >
-      m(424, 512),
-      m_filtered(424, 512)
-  ;
-  Mat<unsigned char> m_max_edge_test(424, 512);
-
-  float *m_ptr = (m.ptr(0, 0)->val);
-
-  for(int y = 0; y < 424; ++y)
-    for(int x = 0; x < 512; ++x, m_ptr += 9)
-    {
-      impl_->processPixelStage1(x, y, packet.buffer, m_ptr + 0, m_ptr + 3, m_ptr + 6);
-    }
-
-  // bilateral filtering
-  if(impl_->enable_bilateral_filter)
+  impl_->confidence_frame->sequence = packet.sequence;
+  impl_->ir_frame->lost_subsequences = packet.lost_subsequences;
+  impl_->depth_frame->lost_subsequences = packet.lost_subsequences;
+  impl_->confidence_frame->lost_subsequences = packet.lost_subsequences;
+  // a reused frame may have been cropped to the region of interest
+  impl_->ir_frame->width = impl_->depth_frame->width = impl_->confidence_frame->width = impl_->width;
+  impl_->ir_frame->height = impl_->depth_frame->height = impl_->confidence_frame->height = impl_->height;
+
+  Mat<float> out_ir(impl_->height, impl_->width, impl_->ir_frame->data), out_depth(impl_->height, impl_->width, impl_->depth_frame->data);
+
+  impl_->output_ir = output_ir;
+  impl_->output_confidence = output_confidence;
+  if(output_confidence)
+    impl_->out_confidence.create(impl_->height, impl_->width, impl_->confidence_frame->data);
+
+  // the confidence comes out of stage 2, which also computes the depth
+  if(partial)
   {
-    float *m_filtered_ptr = (m_filtered.ptr(0, 0)->val);
-    unsigned char *m_max_edge_test_ptr = m_max_edge_test.ptr(0, 0);
-
-    for(int y = 0; y < 424; ++y)
-      for(int x = 0; x < 512; ++x, m_filtered_ptr += 9, ++m_max_edge_test_ptr)
-      {
-        bool max_edge_test_val = true;
-        impl_->filterPixelStage1(x, y, m, m_filtered_ptr, max_edge_test_val);
-        *m_max_edge_test_ptr = max_edge_test_val ? 1 : 0;
-      }
-
-    m_ptr = (m_filtered.ptr(0, 0)->val);
+    impl_->processPartial(packet.buffer, frequencies, out_ir, output_depth || output_confidence ? &out_depth : 0);
   }
-  else
+  else if(output_depth || output_confidence)
   {
-    m_ptr = (m.ptr(0, 0)->val);
+    impl_->processPacket(packet.buffer, out_ir, out_depth);
   }
-
-  Mat<float> out_ir(424, 512, impl_->ir_frame->data), out_depth(424, 512, impl_->depth_frame->data);
-
-  if(impl_->enable_edge_filter)
+  else
   {
-    Mat<Vec<float, 3> > depth_ir_sum(424, 512);
-    Vec<float, 3> *depth_ir_sum_ptr = depth_ir_sum.ptr(0, 0);
-    unsigned char *m_max_edge_test_ptr = m_max_edge_test.ptr(0, 0);
-
-    for(int y = 0; y < 424; ++y)
-      for(int x = 0; x < 512; ++x, m_ptr += 9, ++m_max_edge_test_ptr, ++depth_ir_sum_ptr)
-      {
-        float raw_depth, ir_sum;
+    impl_->processIr(packet.buffer, out_ir);
+  }
 
-        impl_->processPixelStage2(x, y, m_ptr + 0, m_ptr + 3, m_ptr + 6, out_ir.ptr(423 - y, x), &raw_depth, &ir_sum);
+    impl_->stopTiming(LOG_INFO);
 
-        depth_ir_sum_ptr->val[0] = raw_depth;
-        depth_ir_sum_ptr->val[1] = *m_max_edge_test_ptr == 1 ? raw_depth : 0;
-        depth_ir_sum_ptr->val[2] = ir_sum;
-      }
+  if(output_ir)
+    applyRoi(impl_->ir_frame);
+  if(output_depth)
+    applyRoi(impl_->depth_frame);
+  if(output_confidence)
+    applyRoi(impl_->confidence_frame);
 
-    m_max_edge_test_ptr = m_max_edge_test.ptr(0, 0);
+  if(output_ir && listener_->onNewFrame(Frame::Ir, impl_->ir_frame))
+  {
+    impl_->newIrFrame();
+  }
 
-    for(int y = 0; y < 424; ++y)
-      for(int x = 0; x < 512; ++x, ++m_max_edge_test_ptr)
-      {
-        impl_->filterPixelStage2(x, y, depth_ir_sum, *m_max_edge_test_ptr == 1, out_depth.ptr(423 - y, x));
-      }
+  if(output_depth && sendDepthFrame(impl_->depth_frame))
+  {
+    impl_->newDepthFrame();
   }
-  else
+
+  if(output_confidence && listener_->onNewFrame(Frame::Confidence, impl_->confidence_frame))
   {
-    for(int y = 0; y < 424; ++y)
-      for(int x = 0; x < 512; ++x, m_ptr += 9)
-      {
-        impl_->processPixelStage2(x, y, m_ptr + 0, m_ptr + 3, m_ptr + 6, out_ir.ptr(423 - y, x), out_depth.ptr(423 - y, x), 0);
-      }
+    impl_->newConfidenceFrame();
   }
+}
 
-    impl_->stopTiming(LOG_INFO);
+const CpuDepthKernels *selectCpuDepthKernels(DepthPacketProcessor::Config::CpuKernels requested)
+{
+  typedef DepthPacketProcessor::Config Config;
 
-  if (listener_ != 0 ){
-    if(listener_->onNewFrame(Frame::Ir, impl_->ir_frame))
-    {
-      impl_->newIrFrame();
-    }
+  const CpuDepthKernels *sse41 = getSse41DepthKernels(), *avx2 = getAvx2DepthKernels(), *neon = getNeonDepthKernels();
+  bool has_sse41 = false, has_avx2 = false;
 
-    if(listener_->onNewFrame(Frame::Depth, impl_->depth_frame))
-    {
-      impl_->newDepthFrame();
-    }
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+  __builtin_cpu_init();
+  has_sse41 = __builtin_cpu_supports("sse4.1");
+  has_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+  switch(requested)
+  {
+  case Config::AutoKernels:
+    break;
+  case Config::ScalarKernels:
+    return 0;
+  case Config::Avx2Kernels:
+    if(avx2 != 0 && has_avx2)
+      return avx2;
+    LOG_WARNING << "avx2 kernels are not available.";
+    break;
+  case Config::Sse41Kernels:
+    if(sse41 != 0 && has_sse41)
+      return sse41;
+    LOG_WARNING << "sse4.1 kernels are not available.";
+    break;
+  case Config::NeonKernels:
+    if(neon != 0)
+      return neon;
+    LOG_WARNING << "neon kernels are not available.";
+    break;
   }
 
+  if(avx2 != 0 && has_avx2)
+    return avx2;
+  if(sse41 != 0 && has_sse41)
+    return sse41;
+  // NEON is mandatory where it is compiled
+  return neon;
 }
 
 } /* namespace libfreenect2 */
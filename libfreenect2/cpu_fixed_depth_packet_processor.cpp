@@ -0,0 +1,603 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+
+/** @file cpu_fixed_depth_packet_processor.cpp Depth processor for the CPU in integer arithmetic. */
+
+#include <libfreenect2/depth_packet_processor.h>
+#include <libfreenect2/protocol/response.h>
+#include <libfreenect2/logging.h>
+#include <libfreenect2/worker_pool.h>
+#include <libfreenect2/cpu_depth_kernels.h>
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace libfreenect2
+{
+
+namespace
+{
+
+/** Position of the highest set bit of a non-zero value. */
+inline int highestBit(uint32_t v)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return 31 - __builtin_clz(v);
+#else
+  int bit = 0;
+  while(v >>= 1)
+    ++bit;
+  return bit;
+#endif
+}
+
+/**
+ * The fast atan2 of the float processor in integer arithmetic, the angle of
+ * (x, y) in [0, 65536) with 65536 a full turn. The polynomial runs in Q15
+ * and the result is rounded to 1/65536 turn, the error stays below
+ * 1.5e-4 rad. Undefined angles (0, 0) return 0.
+ */
+inline int32_t fixedPhaseAngle(int32_t y, int32_t x)
+{
+  uint32_t abs_x = x < 0 ? -uint32_t(x) : uint32_t(x), abs_y = y < 0 ? -uint32_t(y) : uint32_t(y);
+  uint32_t big = std::max(abs_x, abs_y), small = std::min(abs_x, abs_y);
+
+  if(big == 0)
+    return 0;
+
+  // the ratio in Q15 with a 32 bit division
+  const int shift = std::max(highestBit(big) - 15, 0);
+  big >>= shift;
+  small >>= shift;
+  const int32_t r = int32_t((small << 15) / big);
+  const int32_t s = (r * r) >> 15;
+
+  // coefficients of the float polynomial times 65536 / (2 pi) in Q2
+  int32_t t = 869;
+  t = -3552 + ((t * s) >> 15);
+  t = 7516 + ((t * s) >> 15);
+  t = -13781 + ((t * s) >> 15);
+  t = 41716 + ((t * s) >> 15);
+  t = (t * r + 65536) >> 17;
+
+  t = abs_y > abs_x ? 16384 - t : t;
+  t = x < 0 ? 32768 - t : t;
+  t = y < 0 ? 65536 - t : t;
+
+  return t & 65535;
+}
+
+} /* namespace */
+
+class CpuFixedDepthPacketProcessorImpl: public WithPerfLogging
+{
+public:
+  static const int WIDTH = 512, HEIGHT = 424;
+  static const int NUM_MEASUREMENTS = 9; ///< Sub-images used by stage 1; the 10th is not used.
+
+  int16_t lut11to16[2048];
+  std::vector<int16_t> measurements; ///< Unpacked sub-images after lut11to16, one plane of 512x424 each.
+
+  /** Trigonometry tables of one frequency, 3 cos tables followed by 3 sin tables, times ab_multiplier_per_frq in Q14. */
+  typedef int16_t TrigTable[6][512*424];
+  TrigTable *trig_tables; ///< Tables of the 3 frequencies.
+
+  std::vector<float> x_table, z_table;
+
+  /** Buckets of #confidence_lut per octave of the amplitude, see confidenceIndex(). */
+  static const int CONFIDENCE_BITS = 6, CONFIDENCE_STEPS = 1 << CONFIDENCE_BITS;
+  /** Squared dealiasing confidence of an amplitude, in the units of the norm of processPixel(). */
+  int64_t confidence_lut[32 * CONFIDENCE_STEPS];
+  uint32_t individual_ab_threshold, ab_threshold; ///< Amplitude thresholds in the units of processPixel().
+  uint16_t sqrt_lut[1024]; ///< Square roots of [0, 1024) in Q8, see fixedSqrt().
+
+  DepthPacketProcessor::Parameters params;
+
+  Frame *ir_frame, *depth_frame, *confidence_frame;
+
+  /** Pixels of the output images, columns [x_begin, x_end) of rows [y_begin, y_end) in processing order; rows are flipped in the output images. */
+  int x_begin, x_end, y_begin, y_end;
+
+  WorkerPool *pool; ///< Threads processing horizontal bands of the image, NULL to process serially.
+
+  CpuFixedDepthPacketProcessorImpl()
+  {
+    newIrFrame();
+    newDepthFrame();
+    newConfidenceFrame();
+
+    measurements.resize(NUM_MEASUREMENTS * WIDTH * HEIGHT);
+    trig_tables = new TrigTable[3];
+    pool = 0;
+    setRoi(0, 0, WIDTH, HEIGHT);
+
+    // amplitudes of processPixel() are sqrt(a^2 + b^2) in Q7, ab_multiplier is applied in float
+    const double amplitude_scale = 128.0 / params.ab_multiplier;
+    individual_ab_threshold = uint32_t(std::ceil(params.individual_ab_threshold * amplitude_scale));
+    ab_threshold = uint32_t(std::ceil(params.ab_threshold * amplitude_scale));
+
+    // the norm of processPixel() is in (1 / (30 * 65536) turn)^2 instead of rad^2
+    const double norm_scale = (30.0 * 65536.0) * (30.0 * 65536.0) / (4.0 * M_PI * M_PI);
+
+    for(int bit = 0; bit < 32; ++bit)
+    {
+      for(int step = 0; step < CONFIDENCE_STEPS; ++step)
+      {
+        // centre of the bucket, below CONFIDENCE_STEPS each bucket holds one amplitude
+        const double amplitude = std::ldexp(CONFIDENCE_STEPS + step + (bit >= CONFIDENCE_BITS ? 0.5 : 0.0), bit - CONFIDENCE_BITS) / amplitude_scale;
+
+        double ir_x = std::exp((std::log(amplitude) * params.ab_confidence_slope * 0.301030 + params.ab_confidence_offset) * 3.321928);
+        ir_x = std::min<double>(params.max_dealias_confidence, std::max<double>(params.min_dealias_confidence, ir_x));
+        confidence_lut[bit * CONFIDENCE_STEPS + step] = int64_t(ir_x * ir_x * norm_scale);
+      }
+    }
+
+    for(int i = 0; i < 1024; ++i)
+      sqrt_lut[i] = uint16_t(std::sqrt(double(i)) * 256.0);
+  }
+
+  ~CpuFixedDepthPacketProcessorImpl()
+  {
+    delete[] trig_tables;
+    delete pool;
+    delete ir_frame;
+    delete depth_frame;
+    delete confidence_frame;
+  }
+
+  /** Allocate a new IR frame. */
+  void newIrFrame()
+  {
+    ir_frame = newFloatFrame();
+  }
+
+  /** Allocate a new depth frame. */
+  void newDepthFrame()
+  {
+    depth_frame = newFloatFrame();
+  }
+
+  /** Allocate a new confidence frame. */
+  void newConfidenceFrame()
+  {
+    confidence_frame = newFloatFrame();
+  }
+
+  static Frame *newFloatFrame()
+  {
+    Frame *frame = new Frame(WIDTH * HEIGHT * 4);
+    frame->width = WIDTH;
+    frame->height = HEIGHT;
+    frame->bytes_per_pixel = 4;
+    frame->format = Frame::Float;
+    return frame;
+  }
+
+  /**
+   * Set the number of threads processing the image.
+   * @param num_threads 1 processes serially, 0 uses all hardware threads.
+   */
+  void setNumThreads(size_t num_threads)
+  {
+    if(num_threads == 0)
+      num_threads = libfreenect2::thread::hardware_concurrency();
+
+    size_t current = pool != 0 ? pool->size() : 1;
+    if(num_threads == current)
+      return;
+
+    delete pool;
+    pool = num_threads > 1 ? new WorkerPool(num_threads) : 0;
+  }
+
+  /**
+   * Restrict processing to a region of interest of the output images.
+   * Pixels outside of it are left unchanged in the output.
+   */
+  void setRoi(int x, int y, int roi_width, int roi_height)
+  {
+    x_begin = x;
+    x_end = x + roi_width;
+    y_begin = HEIGHT - y - roi_height;
+    y_end = HEIGHT - y;
+  }
+
+  /**
+   * Fill the trigonometry tables of one frequency from its P0 table.
+   * @param p0table P0 table in processing order.
+   * @param frequency Index of the modulation frequency.
+   */
+  void fillTrigTable(const uint16_t *p0table, int frequency)
+  {
+    const float scale = params.ab_multiplier_per_frq[frequency] * 16384.0f;
+
+    for(int i = 0; i < WIDTH * HEIGHT; ++i)
+    {
+      const float p0 = -((float)p0table[i]) * 0.000031 * M_PI;
+
+      for(int phase = 0; phase < 3; ++phase)
+      {
+        // cos(p0 + phase) and sin(-(p0 + phase)) are cos and sin of the negated angle
+        const float angle = -(p0 + params.phase_in_rad[phase]);
+        trig_tables[frequency][phase][i] = int16_t(std::floor(std::cos(angle) * scale + 0.5f));
+        trig_tables[frequency][phase + 3][i] = int16_t(std::floor(std::sin(angle) * scale + 0.5f));
+      }
+    }
+  }
+
+  /**
+   * Integer square root, rounded down for values below 2^32 and with about
+   * 16 significant bits above. The 10 highest bits give the start value in
+   * #sqrt_lut, one Newton step refines it.
+   */
+  uint32_t fixedSqrt(uint64_t v) const
+  {
+    // an even shift to 32 bits halves the shift of the root
+    const int shift = (v >> 32) != 0 ? (highestBit(uint32_t(v >> 32)) + 2) & ~1 : 0;
+    const uint32_t x = uint32_t(v >> shift);
+
+    if(x < 1024)
+      return uint32_t(sqrt_lut[x] >> 8) << (shift >> 1);
+
+    // x >> n is in [256, 1024), the start value is below the root by at most 0.4%
+    const int n = (highestBit(x) - 8) & ~1;
+    uint32_t root = (uint32_t(sqrt_lut[x >> n]) << (n >> 1)) >> 8;
+
+    // a Newton step from any start value stays at or above the rounded down root
+    root = (root + x / root) >> 1;
+    while(uint64_t(root) * root > x)
+      --root;
+
+    return root << (shift >> 1);
+  }
+
+  /**
+   * Bucket of #confidence_lut of an amplitude, its highest bit and the
+   * CONFIDENCE_BITS bits below it, so the buckets are at most 1.6% wide.
+   */
+  static int confidenceIndex(uint32_t amplitude)
+  {
+    amplitude = std::max(amplitude, 1u);
+    const int bit = highestBit(amplitude);
+    const uint32_t step = bit >= CONFIDENCE_BITS ? amplitude >> (bit - CONFIDENCE_BITS) : amplitude << (CONFIDENCE_BITS - bit);
+    return bit * CONFIDENCE_STEPS + int(step) - CONFIDENCE_STEPS;
+  }
+
+  /**
+   * Process a packet with processPixel(), in horizontal bands over #pool.
+   * @param data Depth packet.
+   * @param [out] ir_out IR image, NULL if the listener takes no IR.
+   * @param [out] depth_out Depth image, NULL to compute only the IR image.
+   * @param [out] confidence_out Confidence image, may be NULL.
+   */
+  void process(const unsigned char *data, float *ir_out, float *depth_out, float *confidence_out)
+  {
+    if(pool == 0)
+    {
+      processBand(data, y_begin, y_end, ir_out, depth_out, confidence_out);
+      return;
+    }
+
+    const int rows = y_end - y_begin;
+    const size_t num_bands = pool->size() * 4;
+    pool->run(num_bands, [&](size_t band)
+    {
+      processBand(data, y_begin + int(band * rows / num_bands), y_begin + int((band + 1) * rows / num_bands), ir_out, depth_out, confidence_out);
+    });
+  }
+
+  void processBand(const unsigned char *data, int band_begin, int band_end, float *ir_out, float *depth_out, float *confidence_out)
+  {
+    for(int sub = 0; sub < NUM_MEASUREMENTS; ++sub)
+    {
+      // 298496 = 512 * 424 * 11 / 8 = number of bytes per sub image
+      const unsigned char *sub_image = data + 298496 * sub;
+
+      for(int y = band_begin; y < band_end; ++y)
+      {
+        int i = y < 212 ? y + 212 : 423 - y;
+        unpackDepthRow(sub_image + 704 * i, lut11to16, &measurements[(sub * HEIGHT + y) * WIDTH]);
+      }
+    }
+
+    for(int y = band_begin; y < band_end; ++y)
+    {
+      const int out_offset = (HEIGHT - 1 - y) * WIDTH;
+
+      for(int x = x_begin; x < x_end; ++x)
+        processPixel(x, y, ir_out != 0 ? ir_out + out_offset + x : 0, depth_out != 0 ? depth_out + out_offset + x : 0,
+                     confidence_out != 0 ? confidence_out + out_offset + x : 0);
+    }
+  }
+
+  /**
+   * Map the unwrapped phase of a pixel to its depth, as the float processor does.
+   * @param offset Position in the x and z tables.
+   * @param phase Unwrapped phase, 0 for invalid pixels.
+   * @return Depth.
+   */
+  float phaseToDepth(int offset, float phase) const
+  {
+    float zmultiplier = z_table[offset];
+    float xmultiplier = x_table[offset];
+
+    phase = 0 < phase ? phase + params.phase_offset : phase;
+
+    float depth_linear = zmultiplier * phase;
+    float max_depth = phase * params.unambigious_dist * 2;
+
+    bool cond1 = 0 < depth_linear && 0 < max_depth;
+
+    xmultiplier = (xmultiplier * 90) / (max_depth * max_depth * 8192.0);
+
+    float depth_fit = depth_linear / (-depth_linear * xmultiplier + 1);
+
+    depth_fit = depth_fit < 0 ? 0 : depth_fit;
+    return cond1 ? depth_fit : depth_linear;
+  }
+
+  /**
+   * Stage 1 and stage 2 of a pixel in integer arithmetic.
+   *
+   * Stage 1 accumulates the Q14 #trig_tables in int32, the phases are
+   * fixedPhaseAngle() in 1/65536 turn and the amplitudes fixedSqrt() in Q7.
+   * The dealiasing of the float stage 2 works on the phases scaled by
+   * 3, 15 and 2 in the same unit, and the dealiasing confidence comes from
+   * #confidence_lut. Only phaseToDepth() and the scaling of the outputs
+   * use floats.
+   * @param x Horizontal position.
+   * @param y Vertical position.
+   * @param [out] ir_out IR output, may be NULL.
+   * @param [out] depth_out Depth output, may be NULL.
+   * @param [out] confidence_out Unwrapping confidence output, may be NULL.
+   */
+  void processPixel(int x, int y, float *ir_out, float *depth_out, float *confidence_out)
+  {
+    const int offset = y * WIDTH + x;
+    const bool valid = 0.0f < z_table[offset];
+    const uint32_t saturated_amplitude = uint32_t(65535.0f * 128.0f / params.ab_multiplier);
+
+    uint32_t amplitude[3], ir_amplitude_sum = 0;
+    int32_t phase[3];
+
+    for(int f = 0; f < 3; ++f)
+    {
+      const int32_t m0 = measurements[(3 * f + 0) * WIDTH * HEIGHT + offset];
+      const int32_t m1 = measurements[(3 * f + 1) * WIDTH * HEIGHT + offset];
+      const int32_t m2 = measurements[(3 * f + 2) * WIDTH * HEIGHT + offset];
+      const TrigTable &trig = trig_tables[f];
+
+      // the absolute cos and sin of the 3 phases, 120 degrees apart, add up to at most 2,
+      // so |a| and |b| stay below 2 * 1.62 * 2^14 * 32767 < 2^31
+      const int32_t a = trig[0][offset] * m0 + trig[1][offset] * m1 + trig[2][offset] * m2;
+      const int32_t b = trig[3][offset] * m0 + trig[4][offset] * m1 + trig[5][offset] * m2;
+
+      if(!valid)
+      {
+        amplitude[f] = 0;
+        phase[f] = 0;
+      }
+      else if(m0 == 32767 || m1 == 32767 || m2 == 32767)
+      {
+        // saturated pixels have no phase and the maximum IR
+        amplitude[f] = 0;
+        phase[f] = 0;
+        ir_amplitude_sum += saturated_amplitude;
+      }
+      else
+      {
+        const int64_t a7 = a >> 7, b7 = b >> 7;
+        amplitude[f] = fixedSqrt(uint64_t(a7 * a7 + b7 * b7));
+        phase[f] = fixedPhaseAngle(b, a);
+        ir_amplitude_sum += amplitude[f];
+      }
+    }
+
+    if(ir_out != 0)
+      *ir_out = std::min(ir_amplitude_sum * (params.ab_multiplier / 128.0f) * 0.3333333f * params.ab_output_multiplier, 65535.0f);
+
+    if(depth_out == 0)
+      return;
+
+    const uint32_t ir_min = std::min(std::min(amplitude[0], amplitude[1]), amplitude[2]);
+    const uint32_t ir_max = std::max(std::max(amplitude[0], amplitude[1]), amplitude[2]);
+    const uint32_t ir_sum = amplitude[0] + amplitude[1] + amplitude[2];
+
+    float phase_final = 0.0f, confidence = 0.0f;
+
+    if(ir_min >= individual_ab_threshold && ir_sum >= ab_threshold)
+    {
+      const int32_t one = 65536;
+      const int32_t t0 = 3 * phase[0], t1 = 15 * phase[1], t2 = 2 * phase[2];
+
+      // the unwrapping of the float stage 2, the numerators of the floors are offset to stay positive
+      const int32_t t5 = ((t1 - t0 + 3 * one / 2 + 6 * one) / (3 * one) - 2) * 3 * one + t0;
+      const int32_t t3 = t5 > t2 ? t5 - t2 : t2 - t5;
+      const bool c2 = one / 2 < t3 % (2 * one) && t3 % (2 * one) < 3 * one / 2;
+      const int32_t t6 = c2 ? t5 + 15 * one : t5;
+      const int32_t t7 = c2 ? t1 + 15 * one : t1;
+      const int32_t t8 = ((t6 - t2 + one + 8 * one) / (2 * one) - 4) * 2 * one + t2; // twice the t8 of the float stage 2
+
+      // t6 / 3, t7 / 15 and t8 in 1 / (30 * 65536) turn
+      const int64_t u6 = 10 * t6, u7 = 2 * t7, u8 = 15 * t8;
+      const int32_t t9 = int32_t(u6 + u7 + u8);
+
+      // the cross product with the coefficients in Q16
+      const int64_t v8 = (u7 * 54197 - u8 * 7226) >> 16;
+      const int64_t v6 = (u8 * 36131 - u6 * 54197) >> 16;
+      const int64_t v7 = (u6 * 7226 - u7 * 36131) >> 16;
+      const int64_t norm = v8 * v8 + v6 * v6 + v7 * v7;
+
+      const int64_t ir_x = confidence_lut[confidenceIndex(0 < params.ab_confidence_slope ? ir_min : ir_max)];
+
+      if(t9 > 0 && norm <= ir_x)
+      {
+        phase_final = t9 * (1.0f / (90.0f * 65536.0f));
+        confidence = 1.0f - float(norm) / float(ir_x);
+      }
+    }
+
+    *depth_out = phaseToDepth(offset, phase_final);
+
+    if(confidence_out != 0)
+      *confidence_out = confidence;
+  }
+};
+
+CpuFixedDepthPacketProcessor::CpuFixedDepthPacketProcessor() :
+    impl_(new CpuFixedDepthPacketProcessorImpl())
+{
+}
+
+CpuFixedDepthPacketProcessor::~CpuFixedDepthPacketProcessor()
+{
+  delete impl_;
+}
+
+void CpuFixedDepthPacketProcessor::setConfiguration(const libfreenect2::DepthPacketProcessor::Config &config)
+{
+  if(config.EnableBilateralFilter || config.EnableEdgeAwareFilter || config.EnableBinning)
+    LOG_WARNING << "the fixed-point processor has no bilateral filter, edge-aware filter or binning, they are ignored";
+
+  // the region of interest is clamped and applied to the 512x424 frames
+  libfreenect2::DepthPacketProcessor::Config full_resolution = config;
+  full_resolution.EnableBinning = false;
+  DepthPacketProcessor::setConfiguration(full_resolution);
+
+  impl_->params.min_depth = config.MinDepth * 1000.0f;
+  impl_->params.max_depth = config.MaxDepth * 1000.0f;
+  impl_->setNumThreads(config.NumThreads);
+  impl_->setRoi(int(config_.RoiX), int(config_.RoiY), int(config_.RoiWidth), int(config_.RoiHeight));
+}
+
+void CpuFixedDepthPacketProcessor::loadP0TablesFromCommandResponse(unsigned char* buffer, size_t buffer_length)
+{
+  libfreenect2::protocol::P0TablesResponse* p0table = (libfreenect2::protocol::P0TablesResponse*)buffer;
+
+  if(buffer_length < sizeof(libfreenect2::protocol::P0TablesResponse))
+  {
+    LOG_ERROR << "P0Table response too short!";
+    return;
+  }
+
+  const uint16_t *tables[3] = { p0table->p0table0, p0table->p0table1, p0table->p0table2 };
+  std::vector<uint16_t> flipped(TABLE_SIZE);
+
+  for(int f = 0; f < 3; ++f)
+  {
+    // the P0 tables are upside down, like in the float processor
+    for(int y = 0; y < 424; ++y)
+      std::copy(tables[f] + (423 - y) * 512, tables[f] + (424 - y) * 512, flipped.begin() + y * 512);
+
+    impl_->fillTrigTable(&flipped[0], f);
+  }
+}
+
+void CpuFixedDepthPacketProcessor::loadXZTables(const float *xtable, const float *ztable)
+{
+  impl_->x_table.assign(xtable, xtable + TABLE_SIZE);
+  impl_->z_table.assign(ztable, ztable + TABLE_SIZE);
+}
+
+void CpuFixedDepthPacketProcessor::loadLookupTable(const short *lut)
+{
+  std::copy(lut, lut + LUT_SIZE, impl_->lut11to16);
+}
+
+void CpuFixedDepthPacketProcessor::forEachFrameBand(size_t rows, const std::function<void(size_t, size_t)> &f)
+{
+  WorkerPool *pool = impl_->pool;
+  if(pool == 0)
+  {
+    f(0, rows);
+    return;
+  }
+
+  const size_t num_bands = pool->size();
+  pool->run(num_bands, [&](size_t band)
+  {
+    f(band * rows / num_bands, (band + 1) * rows / num_bands);
+  });
+}
+
+void CpuFixedDepthPacketProcessor::process(const DepthPacket &packet)
+{
+  if(listener_ == 0) return;
+
+  const unsigned int frame_types = listener_->frameTypes();
+  const bool output_ir = (frame_types & Frame::Ir) != 0, output_depth = (frame_types & Frame::Depth) != 0;
+  const bool output_confidence = (frame_types & Frame::Confidence) != 0;
+
+  if(!output_ir && !output_depth && !output_confidence) return;
+
+  if(packet.lost_subsequences != 0)
+  {
+    LOG_DEBUG << "skipping packet " << packet.sequence << " with missing sub-images, partial packets need the default pipeline";
+    return;
+  }
+
+  impl_->startTiming();
+
+  Frame *frames[3] = { impl_->ir_frame, impl_->depth_frame, impl_->confidence_frame };
+  for(int i = 0; i < 3; ++i)
+  {
+    frames[i]->timestamp = packet.timestamp;
+    frames[i]->sequence = packet.sequence;
+    // a reused frame may have been cropped to the region of interest
+    frames[i]->width = 512;
+    frames[i]->height = 424;
+  }
+
+  // the confidence comes out of stage 2, which also computes the depth
+  impl_->process(packet.buffer, output_ir ? reinterpret_cast<float *>(impl_->ir_frame->data) : 0,
+                 output_depth || output_confidence ? reinterpret_cast<float *>(impl_->depth_frame->data) : 0,
+                 output_confidence ? reinterpret_cast<float *>(impl_->confidence_frame->data) : 0);
+
+  impl_->stopTiming(LOG_INFO);
+
+  if(output_ir)
+    applyRoi(impl_->ir_frame);
+  if(output_depth)
+    applyRoi(impl_->depth_frame);
+  if(output_confidence)
+    applyRoi(impl_->confidence_frame);
+
+  if(output_ir && listener_->onNewFrame(Frame::Ir, impl_->ir_frame))
+    impl_->newIrFrame();
+
+  if(output_depth && sendDepthFrame(impl_->depth_frame))
+    impl_->newDepthFrame();
+
+  if(output_confidence && listener_->onNewFrame(Frame::Confidence, impl_->confidence_frame))
+    impl_->newConfidenceFrame();
+}
+
+} /* namespace libfreenect2 */
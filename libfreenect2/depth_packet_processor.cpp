@@ -28,8 +28,11 @@
 
 #include <libfreenect2/depth_packet_processor.h>
 #include <libfreenect2/async_packet_processor.h>
+#include <libfreenect2/cpu_depth_kernels.h>
 #include <libfreenect2/logging.h>
 
+#include <algorithm>
+#include <cmath>
 #include <cstring>
 #include <iostream>
 
@@ -100,17 +103,196 @@ DepthPacketProcessor::Parameters::Parameters()
 }
 
 DepthPacketProcessor::DepthPacketProcessor() :
-    listener_(0)
+    listener_(0),
+    uint16_depth_frame_(0),
+    temporal_kernels_(selectCpuDepthKernels()),
+    temporal_width_(0),
+    temporal_height_(0)
 {
 }
 
 DepthPacketProcessor::~DepthPacketProcessor()
 {
+  delete uint16_depth_frame_;
 }
 
 void DepthPacketProcessor::setConfiguration(const libfreenect2::DepthPacketProcessor::Config &config)
 {
+  if(config.DepthKernels != config_.DepthKernels)
+    temporal_kernels_ = selectCpuDepthKernels(config.DepthKernels);
+
   config_ = config;
+
+  // start the temporal filter over, the frames may have a new size or content
+  temporal_state_.clear();
+  temporal_width_ = temporal_height_ = 0;
+
+  // keep the region of interest inside the output image
+  const size_t width = config_.EnableBinning ? 256 : 512, height = config_.EnableBinning ? 212 : 424;
+  config_.RoiX = std::min(config_.RoiX, width - 1);
+  config_.RoiY = std::min(config_.RoiY, height - 1);
+  config_.RoiWidth = config_.RoiWidth == 0 ? width - config_.RoiX : std::min(config_.RoiWidth, width - config_.RoiX);
+  config_.RoiHeight = config_.RoiHeight == 0 ? height - config_.RoiY : std::min(config_.RoiHeight, height - config_.RoiY);
+
+  if(hasRoi())
+    LOG_INFO << "region of interest " << config_.RoiWidth << "x" << config_.RoiHeight << " at " << config_.RoiX << "," << config_.RoiY;
+}
+
+bool DepthPacketProcessor::hasRoi() const
+{
+  return config_.RoiWidth < (config_.EnableBinning ? 256u : 512u) || config_.RoiHeight < (config_.EnableBinning ? 212u : 424u);
+}
+
+void DepthPacketProcessor::applyRoi(Frame *frame) const
+{
+  if(!hasRoi()) return;
+
+  const size_t pixel_size = frame->bytes_per_pixel, row_size = frame->width * pixel_size;
+  const size_t x = config_.RoiX, y = config_.RoiY, width = config_.RoiWidth, height = config_.RoiHeight;
+
+  if(config_.CropToRoi)
+  {
+    // each row moves to a lower address, so the rows can be moved in place from the top
+    for(size_t i = 0; i < height; ++i)
+      std::memmove(frame->data + i * width * pixel_size, frame->data + (y + i) * row_size + x * pixel_size, width * pixel_size);
+
+    frame->width = width;
+    frame->height = height;
+    return;
+  }
+
+  std::memset(frame->data, 0, y * row_size);
+
+  for(size_t i = y; i < y + height; ++i)
+  {
+    unsigned char *row = frame->data + i * row_size;
+    std::memset(row, 0, x * pixel_size);
+    std::memset(row + (x + width) * pixel_size, 0, row_size - (x + width) * pixel_size);
+  }
+
+  std::memset(frame->data + (y + height) * row_size, 0, (frame->height - y - height) * row_size);
+}
+
+void DepthPacketProcessor::binXZTables(const float *xtable, const float *ztable, float *binned_xtable, float *binned_ztable)
+{
+  for(int y = 0; y < 212; ++y)
+  {
+    for(int x = 0; x < 256; ++x)
+    {
+      float x_sum = 0.0f, z_sum = 0.0f;
+      int count = 0;
+
+      for(int yi = 2 * y; yi < 2 * y + 2; ++yi)
+      {
+        for(int xi = 2 * x; xi < 2 * x + 2; ++xi)
+        {
+          if(ztable[yi * 512 + xi] > 0.0f)
+          {
+            x_sum += xtable[yi * 512 + xi];
+            z_sum += ztable[yi * 512 + xi];
+            ++count;
+          }
+        }
+      }
+
+      binned_xtable[y * 256 + x] = count > 0 ? x_sum / count : 0.0f;
+      binned_ztable[y * 256 + x] = count > 0 ? z_sum / count : 0.0f;
+    }
+  }
+}
+
+void DepthPacketProcessor::forEachFrameBand(size_t rows, const std::function<void(size_t, size_t)> &f)
+{
+  f(0, rows);
+}
+
+void DepthPacketProcessor::prepareTemporalFilter(const Frame *frame)
+{
+  if(frame->width != temporal_width_ || frame->height != temporal_height_)
+  {
+    temporal_state_.assign(frame->width * frame->height, 0.0f);
+    temporal_width_ = frame->width;
+    temporal_height_ = frame->height;
+  }
+}
+
+void DepthPacketProcessor::filterTemporal(float *depth, size_t begin, size_t end)
+{
+  float *state = &temporal_state_[0];
+  const float alpha = config_.TemporalFilterAlpha, max_jump = config_.TemporalFilterMaxJump;
+
+  size_t x = begin;
+  if(temporal_kernels_ != 0)
+  {
+    const size_t n = (end - begin) - (end - begin) % temporal_kernels_->width;
+    temporal_kernels_->temporal(state + begin, depth + begin, int(n), alpha, max_jump);
+    x += n;
+  }
+
+  for(; x < end; ++x)
+  {
+    const float d = depth[x], s = state[x];
+    // NaN is invalid like in the kernels, it would stick in the state
+    if(!(d > 0.0f)) continue;
+
+    depth[x] = state[x] = (s <= 0.0f || std::abs(d - s) > d * max_jump) ? d : s + alpha * (d - s);
+  }
+}
+
+bool DepthPacketProcessor::sendDepthFrame(Frame *frame)
+{
+  const bool temporal = config_.EnableTemporalFilter;
+  if(temporal)
+    prepareTemporalFilter(frame);
+
+  float *depth = reinterpret_cast<float *>(frame->data);
+  const size_t width = frame->width;
+
+  if(config_.DepthFormat != Frame::UInt16)
+  {
+    if(temporal)
+    {
+      forEachFrameBand(frame->height, [&](size_t y_begin, size_t y_end)
+      {
+        filterTemporal(depth, y_begin * width, y_end * width);
+      });
+    }
+    return listener_->onNewFrame(Frame::Depth, frame);
+  }
+
+  if(uint16_depth_frame_ == 0)
+  {
+    uint16_depth_frame_ = new Frame(512 * 424 * sizeof(uint16_t));
+    uint16_depth_frame_->bytes_per_pixel = sizeof(uint16_t);
+    uint16_depth_frame_->format = Frame::UInt16;
+  }
+
+  Frame *out = uint16_depth_frame_;
+  out->width = frame->width;
+  out->height = frame->height;
+  out->timestamp = frame->timestamp;
+  out->sequence = frame->sequence;
+  out->lost_subsequences = frame->lost_subsequences;
+  out->format = frame->format == Frame::Invalid ? Frame::Invalid : Frame::UInt16;
+
+  uint16_t *depth_mm = reinterpret_cast<uint16_t *>(out->data);
+
+  // the rows of a band are rounded while the filter left them in cache
+  forEachFrameBand(frame->height, [&](size_t y_begin, size_t y_end)
+  {
+    const size_t begin = y_begin * width, end = y_end * width;
+    if(temporal)
+      filterTemporal(depth, begin, end);
+
+    // NaN fails the comparison and becomes 0 like the other invalid values
+    for(size_t i = begin; i < end; ++i)
+      depth_mm[i] = depth[i] > 0.0f ? static_cast<uint16_t>(std::min(depth[i] + 0.5f, 65535.0f)) : 0;
+  });
+
+  if(listener_->onNewFrame(Frame::Depth, out))
+    uint16_depth_frame_ = 0;
+
+  return false;
 }
 
 void DepthPacketProcessor::setFrameListener(libfreenect2::FrameListener *listener)
@@ -31,6 +31,8 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <functional>
+#include <vector>
 
 #include <include/libfreenect2.h>
 #include <libfreenect2/packet_processor.h>
@@ -38,6 +40,8 @@
 namespace libfreenect2
 {
 
+struct CpuDepthKernels;
+
 /** Data packet with depth information. */
 struct DepthPacket
 {
@@ -45,6 +49,7 @@ struct DepthPacket
   uint32_t timestamp;
   unsigned char *buffer; ///< Depth data.
   size_t buffer_length;  ///< Size of depth data.
+  uint32_t lost_subsequences; ///< Bit i is set if sub-image i is missing, 0 for complete packets. See DepthPacketStreamParser::setPartialPackets().
 
   Buffer *memory;
 };
@@ -114,9 +119,72 @@ public:
   virtual void loadXZTables(const float *xtable, const float *ztable) = 0;
   virtual void loadLookupTable(const short *lut) = 0;
 
+  /**
+   * Whether process() computes packets with missing sub-images in the current
+   * configuration, see DepthPacketStreamParser::setPartialPackets(). Others
+   * drop them.
+   */
+  virtual bool supportsPartialPackets() const { return false; }
+
 protected:
+  /** Whether the configured region of interest is smaller than the output image. */
+  bool hasRoi() const;
+
+  /**
+   * Crop a full size frame to the region of interest, or set the pixels
+   * outside of it to 0, depending on Config::CropToRoi.
+   * @param frame IR or depth frame.
+   */
+  void applyRoi(Frame *frame) const;
+
+  /**
+   * Average 2x2 blocks of the x and z tables for binned processing, over
+   * the pixels with a positive z. Blocks without one get a z of 0.
+   * @param xtable, ztable Tables of TABLE_SIZE values.
+   * @param [out] binned_xtable, binned_ztable Tables of TABLE_SIZE / 4 values.
+   */
+  static void binXZTables(const float *xtable, const float *ztable, float *binned_xtable, float *binned_ztable);
+
+  /**
+   * Run \a f over horizontal bands of the rows of a frame, on the threads of
+   * the processor. The default runs one band on the calling thread.
+   * @param rows Number of rows.
+   * @param f Callable with arguments (size_t row_begin, size_t row_end).
+   */
+  virtual void forEachFrameBand(size_t rows, const std::function<void(size_t, size_t)> &f);
+
+  /**
+   * Smooth a depth frame with the previous ones if Config::EnableTemporalFilter
+   * is set, and send it to the listener in the format of Config::DepthFormat.
+   *
+   * Each pixel keeps an exponential running average of its depth. A pixel
+   * restarts from the new depth when it changes by more than
+   * Config::TemporalFilterMaxJump of the depth, so moving objects do not
+   * leave trails. Invalid pixels stay invalid and keep their average.
+   *
+   * For Frame::UInt16, each band of rows is filtered and rounded in one
+   * pass over forEachFrameBand() into a separate frame owned by this class,
+   * and \a frame stays with the caller.
+   * @param frame Float depth frame, after applyRoi().
+   * @return true if the listener took \a frame, so the caller needs a new one.
+   */
+  bool sendDepthFrame(Frame *frame);
+
   libfreenect2::DepthPacketProcessor::Config config_;
   libfreenect2::FrameListener *listener_;
+
+private:
+  Frame *uint16_depth_frame_; ///< Output of sendDepthFrame() for Frame::UInt16, NULL until needed.
+
+  const CpuDepthKernels *temporal_kernels_;
+  std::vector<float> temporal_state_; ///< Running average of each pixel, 0 if there is none yet.
+  size_t temporal_width_, temporal_height_;
+
+  /** Reset the temporal state if the size of the frame changed. */
+  void prepareTemporalFilter(const Frame *frame);
+
+  /** Temporal filter of the pixels [begin, end) of a depth frame, see sendDepthFrame(). */
+  void filterTemporal(float *depth, size_t begin, size_t end);
 };
 
 // TODO: push this to some internal namespace
@@ -134,13 +202,58 @@ public:
   virtual void loadP0TablesFromCommandResponse(unsigned char* buffer, size_t buffer_length);
   virtual void loadXZTables(const float *xtable, const float *ztable);
   virtual void loadLookupTable(const short *lut);
+  virtual bool supportsPartialPackets() const;
 
   virtual const char *name() { return "CPU"; }
   virtual void process(const DepthPacket &packet);
+protected:
+  virtual void forEachFrameBand(size_t rows, const std::function<void(size_t, size_t)> &f);
+
+  /** Take over an implementation set up for another pipeline, for the subclasses. */
+  explicit CpuDepthPacketProcessor(CpuDepthPacketProcessorImpl *impl);
 private:
   CpuDepthPacketProcessorImpl *impl_;
 };
 
+/**
+ * Depth packet processor using the CPU with the KDE phase unwrapping.
+ * It ranks Parameters::num_hyps hypotheses per pixel, 2 like the OpenCL
+ * filter_kde(). 3 follows filter_kde3() and is slower.
+ */
+class CpuKdeDepthPacketProcessor : public CpuDepthPacketProcessor
+{
+public:
+  CpuKdeDepthPacketProcessor();
+
+  virtual const char *name() { return "CPU KDE"; }
+};
+
+class CpuFixedDepthPacketProcessorImpl;
+
+/**
+ * Depth packet processor using the CPU in integer arithmetic, for CPUs with
+ * weak floating point throughput. It has no filters and no binning.
+ */
+class CpuFixedDepthPacketProcessor : public DepthPacketProcessor
+{
+public:
+  CpuFixedDepthPacketProcessor();
+  virtual ~CpuFixedDepthPacketProcessor();
+
+  virtual void setConfiguration(const libfreenect2::DepthPacketProcessor::Config &config);
+
+  virtual void loadP0TablesFromCommandResponse(unsigned char* buffer, size_t buffer_length);
+  virtual void loadXZTables(const float *xtable, const float *ztable);
+  virtual void loadLookupTable(const short *lut);
+
+  virtual const char *name() { return "CPU fixed"; }
+  virtual void process(const DepthPacket &packet);
+protected:
+  virtual void forEachFrameBand(size_t rows, const std::function<void(size_t, size_t)> &f);
+private:
+  CpuFixedDepthPacketProcessorImpl *impl_;
+};
+
 
 
 class DumpDepthPacketProcessorImpl;
@@ -181,6 +294,7 @@ private:
         virtual const char *name() { return "OpenCL"; }
         
         virtual void process(const DepthPacket &packet);
+        virtual void setBufferCount(size_t count);
         
     protected:
         virtual Allocator *getAllocator();
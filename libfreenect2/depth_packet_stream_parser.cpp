@@ -35,23 +35,24 @@ namespace libfreenect2
 
 DepthPacketStreamParser::DepthPacketStreamParser() :
     processor_(noopProcessor<DepthPacket>()),
+    partial_packets_(false),
+    subpacket_length_(0),
+    next_subsequence_(0),
     processed_packets_(-1),
     current_sequence_(0),
-    current_subsequence_(0)
+    current_subsequence_(0),
+    current_timestamp_(0),
+    lost_subsequences_(),
+    logged_lost_subsequences_(0)
 {
-  size_t single_image = 512*424*11/8;
-  buffer_size_ = 10 * single_image;
+  subpacket_size_ = 512*424*11/8;
+  buffer_size_ = NUM_SUBSEQUENCES * subpacket_size_;
 
   processor_->allocateBuffer(packet_, buffer_size_);
-
-  work_buffer_.data = new unsigned char[single_image];
-  work_buffer_.capacity = single_image;
-  work_buffer_.length = 0;
 }
 
 DepthPacketStreamParser::~DepthPacketStreamParser()
 {
-  delete[] work_buffer_.data;
 }
 
 void DepthPacketStreamParser::setPacketProcessor(libfreenect2::BaseDepthPacketProcessor *processor)
@@ -59,6 +60,96 @@ void DepthPacketStreamParser::setPacketProcessor(libfreenect2::BaseDepthPacketPr
   processor_->releaseBuffer(packet_);
   processor_ = (processor != 0) ? processor : noopProcessor<DepthPacket>();
   processor_->allocateBuffer(packet_, buffer_size_);
+
+  // the subpacket in progress was written to the old buffer
+  subpacket_length_ = 0;
+  next_subsequence_ = 0;
+  current_subsequence_ = 0;
+}
+
+void DepthPacketStreamParser::setPartialPackets(bool enable)
+{
+  if(enable)
+    LOG_INFO << "passing on depth packets with missing subsequences";
+
+  partial_packets_ = enable;
+}
+
+uint32_t DepthPacketStreamParser::getLostSubsequences(int subsequence) const
+{
+  return lost_subsequences_[subsequence];
+}
+
+/**
+ * End the packet of the current sequence: count its missing subsequences and
+ * pass it on if it is complete, or if partial packets are enabled.
+ * @return True if the packet was passed on and #packet_ has a new buffer.
+ */
+bool DepthPacketStreamParser::finishPacket()
+{
+  const uint32_t received = current_subsequence_;
+  const uint32_t complete = (1u << NUM_SUBSEQUENCES) - 1;
+
+  current_subsequence_ = 0;
+  next_subsequence_ = 0;
+
+  if(received == 0)
+    return false;
+
+  if(received != complete)
+  {
+    uint32_t lost = 0;
+    for(int i = 0; i < NUM_SUBSEQUENCES; ++i)
+    {
+      if((received & (1u << i)) == 0)
+        ++lost_subsequences_[i];
+      lost += lost_subsequences_[i];
+    }
+
+    const int interval = 30;
+    if(current_sequence_ % interval == 0 || lost - logged_lost_subsequences_ >= interval)
+    {
+      LOG_INFO << "lost subsequences:" << " " << lost_subsequences_[0] << " " << lost_subsequences_[1] << " " << lost_subsequences_[2]
+               << " " << lost_subsequences_[3] << " " << lost_subsequences_[4] << " " << lost_subsequences_[5] << " " << lost_subsequences_[6]
+               << " " << lost_subsequences_[7] << " " << lost_subsequences_[8] << " " << lost_subsequences_[9];
+      logged_lost_subsequences_ = lost;
+    }
+
+    if(!partial_packets_)
+    {
+      LOG_DEBUG << "not all subsequences received " << received;
+      return false;
+    }
+  }
+
+  if(!processor_->ready())
+  {
+    LOG_DEBUG << "skipping depth packet";
+    return false;
+  }
+
+  DepthPacket &packet = packet_;
+  packet.sequence = current_sequence_;
+  packet.timestamp = current_timestamp_;
+  packet.buffer = packet_.memory->data;
+  packet.buffer_length = packet_.memory->capacity;
+  packet.lost_subsequences = complete & ~received;
+
+  processor_->process(packet);
+  processor_->allocateBuffer(packet_, buffer_size_);
+
+  processed_packets_++;
+  if (processed_packets_ == 0)
+    processed_packets_ = current_sequence_;
+  int diff = current_sequence_ - processed_packets_;
+  const int interval = 30;
+  if ((current_sequence_ % interval == 0 && diff != 0) || diff >= interval)
+  {
+    LOG_INFO << diff << " packets were lost";
+    processed_packets_ = current_sequence_;
+  }
+
+  return true;
 }
 
 void DepthPacketStreamParser::onDataReceived(unsigned char* buffer, size_t in_length)
@@ -68,103 +159,84 @@ void DepthPacketStreamParser::onDataReceived(unsigned char* buffer, size_t in_le
     LOG_ERROR << "Packet buffer is NULL";
     return;
   }
-  Buffer &wb = work_buffer_;
 
   if(in_length == 0)
   {
     //synchronize to subpacket boundary
-    wb.length = 0;
+    subpacket_length_ = 0;
+    return;
   }
-  else
+
+  DepthSubPacketFooter *footer = 0;
+  bool footer_found = false;
+
+  if(subpacket_length_ + in_length == subpacket_size_ + sizeof(DepthSubPacketFooter))
   {
-    DepthSubPacketFooter *footer = 0;
-    bool footer_found = false;
+    in_length -= sizeof(DepthSubPacketFooter);
+    footer = reinterpret_cast<DepthSubPacketFooter *>(&buffer[in_length]);
+    footer_found = true;
+  }
 
-    if(wb.length + in_length == wb.capacity + sizeof(DepthSubPacketFooter))
-    {
-      in_length -= sizeof(DepthSubPacketFooter);
-      footer = reinterpret_cast<DepthSubPacketFooter *>(&buffer[in_length]);
-      footer_found = true;
-    }
+  if(subpacket_length_ + in_length > subpacket_size_)
+  {
+    LOG_DEBUG << "subpacket too large";
+    subpacket_length_ = 0;
+    return;
+  }
+
+  unsigned char *slot = packet_.memory->data + next_subsequence_ * subpacket_size_;
+
+  memcpy(slot + subpacket_length_, buffer, in_length);
+  subpacket_length_ += in_length;
 
-    if(wb.length + in_length > wb.capacity)
+  if(!footer_found)
+    return;
+
+  if(footer->length != subpacket_length_)
+  {
+    LOG_DEBUG << "image data too short!";
+  }
+  else
+  {
+    if(current_sequence_ != footer->sequence)
     {
-      LOG_DEBUG << "subpacket too large";
-      wb.length = 0;
-      return;
+      // this subpacket took the slot of the expected subsequence of the unfinished packet
+      current_subsequence_ &= ~(1u << next_subsequence_);
+      finishPacket();
+
+      current_sequence_ = footer->sequence;
     }
 
-    memcpy(wb.data + wb.length, buffer, in_length);
-    wb.length += in_length;
+    current_timestamp_ = footer->timestamp;
+
+    Buffer &fb = *packet_.memory;
 
-    if(footer_found)
+    if((footer->subsequence + 1) * footer->length > fb.capacity)
     {
-      if(footer->length != wb.length)
-      {
-        LOG_DEBUG << "image data too short!";
-      }
-      else
+      LOG_DEBUG << "front buffer too short! subsequence number is " << footer->subsequence;
+    }
+    else
+    {
+      // after a lost subpacket, or in the new buffer of a finished packet
+      unsigned char *target = fb.data + (footer->subsequence * footer->length);
+      if(target != slot)
       {
-        if(current_sequence_ != footer->sequence)
-        {
-          if(current_subsequence_ == 0x3ff)
-          {
-            if(processor_->ready())
-            {
-
-              DepthPacket &packet = packet_;
-              packet.sequence = current_sequence_;
-              packet.timestamp = footer->timestamp;
-              packet.buffer = packet_.memory->data;
-              packet.buffer_length = packet_.memory->capacity;
-
-              processor_->process(packet);
-                processor_->allocateBuffer(packet_, buffer_size_);
-
-              processed_packets_++;
-              if (processed_packets_ == 0)
-                processed_packets_ = current_sequence_;
-              int diff = current_sequence_ - processed_packets_;
-              const int interval = 30;
-              if ((current_sequence_ % interval == 0 && diff != 0) || diff >= interval)
-              {
-                LOG_INFO << diff << " packets were lost";
-                processed_packets_ = current_sequence_;
-              }
-            }
-            else
-            {
-              LOG_DEBUG << "skipping depth packet";
-            }
-          }
-          else
-          {
-            LOG_DEBUG << "not all subsequences received " << current_subsequence_;
-          }
-
-          current_sequence_ = footer->sequence;
-          current_subsequence_ = 0;
-        }
-
-        Buffer &fb = *packet_.memory;
-
-        // set the bit corresponding to the subsequence number to 1
-        current_subsequence_ |= 1 << footer->subsequence;
-
-        if(footer->subsequence * footer->length > fb.capacity)
-        {
-          LOG_DEBUG << "front buffer too short! subsequence number is " << footer->subsequence;
-        }
-        else
-        {
-          memcpy(fb.data + (footer->subsequence * footer->length), wb.data + (wb.length - footer->length), footer->length);
-        }
+        memcpy(target, slot, footer->length);
       }
 
-      // reset working buffer
-      wb.length = 0;
+      // set the bit corresponding to the subsequence number to 1
+      current_subsequence_ |= 1 << footer->subsequence;
+      next_subsequence_ = footer->subsequence + 1 < NUM_SUBSEQUENCES ? footer->subsequence + 1 : 0;
+    }
+
+    // the packet is complete with its last subpacket, the next one would be written to its first slot
+    if(current_subsequence_ == (1u << NUM_SUBSEQUENCES) - 1 || (partial_packets_ && footer->subsequence == NUM_SUBSEQUENCES - 1))
+    {
+      finishPacket();
     }
   }
+
+  subpacket_length_ = 0;
 }
 
 } /* namespace libfreenect2 */
@@ -55,26 +55,59 @@ LIBFREENECT2_PACK(struct DepthSubPacketFooter
 /**
  * Parser of th depth stream, recognizes valid depth packets in the stream, and
  * passes them on for further processing.
+ *
+ * The image data of a subpacket is written directly to the slot of the
+ * expected subsequence in the packet buffer. Only when the footer reports
+ * another subsequence, e.g. after a lost subpacket, it is moved to its slot.
  */
 class DepthPacketStreamParser : public usb::DataCallback
 {
 public:
+  static const int NUM_SUBSEQUENCES = 10;
+
   DepthPacketStreamParser();
   virtual ~DepthPacketStreamParser();
 
   void setPacketProcessor(libfreenect2::BaseDepthPacketProcessor *processor);
 
+  /**
+   * Pass on packets with missing subsequences instead of dropping them,
+   * marked in DepthPacket::lost_subsequences. A packet ends with its last
+   * subsequence then. Set from Freenect2Device::Config::EnablePartialFrames
+   * when the processor supports them, see
+   * DepthPacketProcessor::supportsPartialPackets().
+   * @param enable Whether to pass on incomplete packets.
+   */
+  void setPartialPackets(bool enable);
+
+  /**
+   * Number of times a subsequence was missing from a packet that was partly
+   * received. Packets lost completely are not counted.
+   * @param subsequence Subsequence number, below NUM_SUBSEQUENCES.
+   */
+  uint32_t getLostSubsequences(int subsequence) const;
+
   virtual void onDataReceived(unsigned char* buffer, size_t length);
 private:
   libfreenect2::BaseDepthPacketProcessor *processor_;
+  bool partial_packets_;
 
   size_t buffer_size_;
+  size_t subpacket_size_; ///< Size of the image data of a subpacket, a slot in the packet buffer.
   DepthPacket packet_;
-  libfreenect2::Buffer work_buffer_;
+
+  size_t subpacket_length_; ///< Image data received of the current subpacket.
+  uint32_t next_subsequence_; ///< Expected subsequence, its slot receives the image data until the footer arrives.
 
   uint32_t processed_packets_;
   uint32_t current_sequence_;
   uint32_t current_subsequence_;
+  uint32_t current_timestamp_; ///< Timestamp of the last subpacket of the current sequence.
+
+  uint32_t lost_subsequences_[NUM_SUBSEQUENCES];
+  uint32_t logged_lost_subsequences_; ///< Sum of #lost_subsequences_ when they were last logged.
+
+  bool finishPacket();
 };
 
 } /* namespace libfreenect2 */
@@ -46,6 +46,7 @@ Frame::Frame(size_t dataSize) :
   gain(0.f),
   gamma(0.f),
   format(Frame::Invalid),
+  lost_subsequences(0),
   rawdata(NULL)
 {
     if (dataSize > 0)
@@ -67,6 +68,11 @@ Frame::~Frame()
 
 FrameListener::~FrameListener() {}
 
+unsigned int FrameListener::frameTypes() const
+{
+  return Frame::Color | Frame::Ir | Frame::Depth;
+}
+
 /** Implementation class for synchronizing different types of frames. */
 class SyncMultiFrameListenerImpl
 {
@@ -103,6 +109,11 @@ SyncMultiFrameListener::~SyncMultiFrameListener()
   delete impl_;
 }
 
+unsigned int SyncMultiFrameListener::frameTypes() const
+{
+  return impl_->subscribed_frame_types_;
+}
+
 bool SyncMultiFrameListener::hasNewFrame() const
 {
   std::unique_lock<std::mutex> l(impl_->mutex_);
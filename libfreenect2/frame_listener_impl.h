@@ -72,6 +72,7 @@ public:
   void release(FrameMap &frame);
 
   virtual bool onNewFrame(Frame::Type type, Frame *frame);
+  virtual unsigned int frameTypes() const;
 private:
   SyncMultiFrameListenerImpl *impl_;
 
@@ -32,6 +32,7 @@
 #include <libfreenect2/opencl_depth_packet_processor_resources.h>
 
 #include <sstream>
+#include <vector>
 
 #define _USE_MATH_DEFINES
 #include <math.h>
@@ -160,10 +161,11 @@ public:
   libfreenect2::DepthPacketProcessor::Config config;
   DepthPacketProcessor::Parameters params;
 
-  Frame *ir_frame, *depth_frame;
-  Allocator *input_buffer_allocator;
+  Frame *ir_frame, *depth_frame, *confidence_frame;
+  PoolAllocator *input_buffer_allocator;
   Allocator *ir_buffer_allocator;
   Allocator *depth_buffer_allocator;
+  Allocator *confidence_buffer_allocator;
 
   cl::Context context;
   cl::Device device;
@@ -187,6 +189,8 @@ public:
   cl::Buffer buf_p0_table;
   cl::Buffer buf_x_table;
   cl::Buffer buf_z_table;
+  cl::Buffer buf_binned_x_table;
+  cl::Buffer buf_binned_z_table;
   cl::Buffer buf_packet;
 
   // Read-Write buffers
@@ -199,6 +203,7 @@ public:
   size_t buf_edge_test_size;
   size_t buf_depth_size;
   size_t buf_ir_sum_size;
+  size_t buf_confidence_size;
   size_t buf_filtered_size;
 
   cl::Buffer buf_a;
@@ -210,6 +215,7 @@ public:
   cl::Buffer buf_edge_test;
   cl::Buffer buf_depth;
   cl::Buffer buf_ir_sum;
+  cl::Buffer buf_confidence;
   cl::Buffer buf_filtered;
 
   bool deviceInitialized;
@@ -239,9 +245,11 @@ public:
     input_buffer_allocator = new PoolAllocator(new OpenCLAllocator(context, queue, true));
     ir_buffer_allocator = new OpenCLAllocator(context, queue, false);
     depth_buffer_allocator = new OpenCLAllocator(context, queue, false);
+    confidence_buffer_allocator = new OpenCLAllocator(context, queue, false);
 
     newIrFrame();
     newDepthFrame();
+    newConfidenceFrame();
 
     const int CL_ICDL_VERSION = 2;
     typedef cl_int (*icdloader_func)(int, size_t, void*, size_t*);
@@ -273,9 +281,11 @@ public:
   {
     delete ir_frame;
     delete depth_frame;
+    delete confidence_frame;
     delete input_buffer_allocator;
     delete ir_buffer_allocator;
     delete depth_buffer_allocator;
+    delete confidence_buffer_allocator;
   }
 
   void generateOptions(std::string &options) const
@@ -284,6 +294,8 @@ public:
     oss.precision(16);
     oss << std::scientific;
     oss << " -D BFI_BITMASK=" << "0x180";
+    oss << " -D IMAGE_WIDTH=" << (config.EnableBinning ? 256 : 512);
+    oss << " -D IMAGE_HEIGHT=" << (config.EnableBinning ? 212 : 424);
 
     oss << " -D AB_MULTIPLIER=" << params.ab_multiplier << "f";
     oss << " -D AB_MULTIPLIER_PER_FRQ0=" << params.ab_multiplier_per_frq[0] << "f";
@@ -466,6 +478,8 @@ public:
     CHECK_CL_PARAM(buf_p0_table = cl::Buffer(context, CL_MEM_READ_ONLY, buf_p0_table_size, NULL, &err));
     CHECK_CL_PARAM(buf_x_table = cl::Buffer(context, CL_MEM_READ_ONLY, buf_x_table_size, NULL, &err));
     CHECK_CL_PARAM(buf_z_table = cl::Buffer(context, CL_MEM_READ_ONLY, buf_z_table_size, NULL, &err));
+    CHECK_CL_PARAM(buf_binned_x_table = cl::Buffer(context, CL_MEM_READ_ONLY, buf_x_table_size / 4, NULL, &err));
+    CHECK_CL_PARAM(buf_binned_z_table = cl::Buffer(context, CL_MEM_READ_ONLY, buf_z_table_size / 4, NULL, &err));
     CHECK_CL_PARAM(buf_packet = cl::Buffer(context, CL_MEM_READ_ONLY, buf_packet_size, NULL, &err));
 
     //Read-Write
@@ -478,6 +492,7 @@ public:
     buf_edge_test_size = IMAGE_SIZE * sizeof(cl_uchar);
     buf_depth_size = IMAGE_SIZE * sizeof(cl_float);
     buf_ir_sum_size = IMAGE_SIZE * sizeof(cl_float);
+    buf_confidence_size = IMAGE_SIZE * sizeof(cl_float);
     buf_filtered_size = IMAGE_SIZE * sizeof(cl_float);
 
     CHECK_CL_PARAM(buf_a = cl::Buffer(context, CL_MEM_READ_WRITE, buf_a_size, NULL, &err));
@@ -489,6 +504,7 @@ public:
     CHECK_CL_PARAM(buf_edge_test = cl::Buffer(context, CL_MEM_READ_WRITE, buf_edge_test_size, NULL, &err));
     CHECK_CL_PARAM(buf_depth = cl::Buffer(context, CL_MEM_READ_WRITE, buf_depth_size, NULL, &err));
     CHECK_CL_PARAM(buf_ir_sum = cl::Buffer(context, CL_MEM_READ_WRITE, buf_ir_sum_size, NULL, &err));
+    CHECK_CL_PARAM(buf_confidence = cl::Buffer(context, CL_MEM_READ_WRITE, buf_confidence_size, NULL, &err));
     CHECK_CL_PARAM(buf_filtered = cl::Buffer(context, CL_MEM_WRITE_ONLY, buf_filtered_size, NULL, &err));
 
     return true;
@@ -505,7 +521,7 @@ public:
       if (!buildProgram(sourceCode))
         return false;
 
-    CHECK_CL_PARAM(kernel_processPixelStage1 = cl::Kernel(program, "processPixelStage1", &err));
+    CHECK_CL_PARAM(kernel_processPixelStage1 = cl::Kernel(program, config.EnableBinning ? "processPixelStage1Binned" : "processPixelStage1", &err));
     CHECK_CL_RETURN(kernel_processPixelStage1.setArg(0, buf_lut11to16));
     CHECK_CL_RETURN(kernel_processPixelStage1.setArg(1, buf_z_table));
     CHECK_CL_RETURN(kernel_processPixelStage1.setArg(2, buf_p0_table));
@@ -526,10 +542,11 @@ public:
     CHECK_CL_PARAM(kernel_processPixelStage2 = cl::Kernel(program, "processPixelStage2", &err));
     CHECK_CL_RETURN(kernel_processPixelStage2.setArg(0, config.EnableBilateralFilter ? buf_a_filtered : buf_a));
     CHECK_CL_RETURN(kernel_processPixelStage2.setArg(1, config.EnableBilateralFilter ? buf_b_filtered : buf_b));
-    CHECK_CL_RETURN(kernel_processPixelStage2.setArg(2, buf_x_table));
-    CHECK_CL_RETURN(kernel_processPixelStage2.setArg(3, buf_z_table));
+    CHECK_CL_RETURN(kernel_processPixelStage2.setArg(2, config.EnableBinning ? buf_binned_x_table : buf_x_table));
+    CHECK_CL_RETURN(kernel_processPixelStage2.setArg(3, config.EnableBinning ? buf_binned_z_table : buf_z_table));
     CHECK_CL_RETURN(kernel_processPixelStage2.setArg(4, buf_depth));
     CHECK_CL_RETURN(kernel_processPixelStage2.setArg(5, buf_ir_sum));
+    CHECK_CL_RETURN(kernel_processPixelStage2.setArg(6, buf_confidence));
 
     CHECK_CL_PARAM(kernel_filterPixelStage2 = cl::Kernel(program, "filterPixelStage2", &err));
     CHECK_CL_RETURN(kernel_filterPixelStage2.setArg(0, buf_depth));
@@ -541,39 +558,52 @@ public:
     return true;
   }
 
-  bool run(const DepthPacket &packet)
+  bool run(const DepthPacket &packet, bool read_confidence)
   {
     std::vector<cl::Event> eventWrite(1), eventPPS1(1), eventFPS1(1), eventPPS2(1), eventFPS2(1);
-    cl::Event eventReadIr, eventReadDepth;
+    cl::Event eventReadIr, eventReadDepth, eventReadConfidence;
+
+    // when binning, stage 1 averages 2x2 blocks and all later kernels process a quarter of the pixels
+    const size_t image_size = config.EnableBinning ? IMAGE_SIZE / 4 : IMAGE_SIZE;
 
     CHECK_CL_RETURN(queue.enqueueWriteBuffer(buf_packet, CL_FALSE, 0, buf_packet_size, packet.buffer, NULL, &eventWrite[0]));
-    CHECK_CL_RETURN(queue.enqueueNDRangeKernel(kernel_processPixelStage1, cl::NullRange, cl::NDRange(IMAGE_SIZE), cl::NullRange, &eventWrite, &eventPPS1[0]));
-    CHECK_CL_RETURN(queue.enqueueReadBuffer(buf_ir, CL_FALSE, 0, buf_ir_size, ir_frame->data, &eventPPS1, &eventReadIr));
+    CHECK_CL_RETURN(queue.enqueueNDRangeKernel(kernel_processPixelStage1, cl::NullRange, cl::NDRange(image_size), cl::NullRange, &eventWrite, &eventPPS1[0]));
+    CHECK_CL_RETURN(queue.enqueueReadBuffer(buf_ir, CL_FALSE, 0, image_size * sizeof(cl_float), ir_frame->data, &eventPPS1, &eventReadIr));
 
     if(config.EnableBilateralFilter)
     {
-      CHECK_CL_RETURN(queue.enqueueNDRangeKernel(kernel_filterPixelStage1, cl::NullRange, cl::NDRange(IMAGE_SIZE), cl::NullRange, &eventPPS1, &eventFPS1[0]));
+      CHECK_CL_RETURN(queue.enqueueNDRangeKernel(kernel_filterPixelStage1, cl::NullRange, cl::NDRange(image_size), cl::NullRange, &eventPPS1, &eventFPS1[0]));
     }
     else
     {
       eventFPS1[0] = eventPPS1[0];
     }
 
-    CHECK_CL_RETURN(queue.enqueueNDRangeKernel(kernel_processPixelStage2, cl::NullRange, cl::NDRange(IMAGE_SIZE), cl::NullRange, &eventFPS1, &eventPPS2[0]));
+    CHECK_CL_RETURN(queue.enqueueNDRangeKernel(kernel_processPixelStage2, cl::NullRange, cl::NDRange(image_size), cl::NullRange, &eventFPS1, &eventPPS2[0]));
+
+    if(read_confidence)
+    {
+      CHECK_CL_RETURN(queue.enqueueReadBuffer(buf_confidence, CL_FALSE, 0, image_size * sizeof(cl_float), confidence_frame->data, &eventPPS2, &eventReadConfidence));
+    }
 
     if(config.EnableEdgeAwareFilter)
     {
-      CHECK_CL_RETURN(queue.enqueueNDRangeKernel(kernel_filterPixelStage2, cl::NullRange, cl::NDRange(IMAGE_SIZE), cl::NullRange, &eventPPS2, &eventFPS2[0]));
+      CHECK_CL_RETURN(queue.enqueueNDRangeKernel(kernel_filterPixelStage2, cl::NullRange, cl::NDRange(image_size), cl::NullRange, &eventPPS2, &eventFPS2[0]));
     }
     else
     {
       eventFPS2[0] = eventPPS2[0];
     }
 
-    CHECK_CL_RETURN(queue.enqueueReadBuffer(config.EnableEdgeAwareFilter ? buf_filtered : buf_depth, CL_FALSE, 0, buf_depth_size, depth_frame->data, &eventFPS2, &eventReadDepth));
+    CHECK_CL_RETURN(queue.enqueueReadBuffer(config.EnableEdgeAwareFilter ? buf_filtered : buf_depth, CL_FALSE, 0, image_size * sizeof(cl_float), depth_frame->data, &eventFPS2, &eventReadDepth));
     CHECK_CL_RETURN(eventReadIr.wait());
     CHECK_CL_RETURN(eventReadDepth.wait());
 
+    if(read_confidence)
+    {
+      CHECK_CL_RETURN(eventReadConfidence.wait());
+    }
+
 #ifdef LIBFREENECT2_WITH_PROFILING_CL
     if(count == 0)
     {
@@ -646,6 +676,12 @@ public:
     depth_frame->format = Frame::Float;
   }
 
+  void newConfidenceFrame()
+  {
+    confidence_frame = new OpenCLFrame(static_cast<OpenCLBuffer *>(confidence_buffer_allocator->allocate(IMAGE_SIZE * sizeof(cl_float))));
+    confidence_frame->format = Frame::Float;
+  }
+
   bool fill_trig_table(const libfreenect2::protocol::P0TablesResponse *p0table)
   {
     if(!deviceInitialized)
@@ -678,7 +714,7 @@ public:
     return true;
   }
 
-  bool fill_xz_tables(const float *xtable, const float *ztable)
+  bool fill_xz_tables(const float *xtable, const float *ztable, const float *binned_xtable, const float *binned_ztable)
   {
     if(!deviceInitialized)
     {
@@ -686,11 +722,15 @@ public:
       return false;
     }
 
-    cl::Event event0, event1;
+    cl::Event event0, event1, event2, event3;
     CHECK_CL_RETURN(queue.enqueueWriteBuffer(buf_x_table, CL_FALSE, 0, buf_x_table_size, xtable, NULL, &event0));
     CHECK_CL_RETURN(queue.enqueueWriteBuffer(buf_z_table, CL_FALSE, 0, buf_z_table_size, ztable, NULL, &event1));
+    CHECK_CL_RETURN(queue.enqueueWriteBuffer(buf_binned_x_table, CL_FALSE, 0, buf_x_table_size / 4, binned_xtable, NULL, &event2));
+    CHECK_CL_RETURN(queue.enqueueWriteBuffer(buf_binned_z_table, CL_FALSE, 0, buf_z_table_size / 4, binned_ztable, NULL, &event3));
     CHECK_CL_RETURN(event0.wait());
     CHECK_CL_RETURN(event1.wait());
+    CHECK_CL_RETURN(event2.wait());
+    CHECK_CL_RETURN(event3.wait());
     return true;
   }
 
@@ -724,7 +764,8 @@ void OpenCLDepthPacketProcessor::setConfiguration(const libfreenect2::DepthPacke
   DepthPacketProcessor::setConfiguration(config);
 
   if ( impl_->config.MaxDepth != config.MaxDepth
-    || impl_->config.MinDepth != config.MinDepth)
+    || impl_->config.MinDepth != config.MinDepth
+    || impl_->config.EnableBinning != config.EnableBinning)
   {
     // OpenCL program needs to be rebuilt, then reinitialized
     impl_->programBuilt = false;
@@ -757,7 +798,9 @@ void OpenCLDepthPacketProcessor::loadP0TablesFromCommandResponse(unsigned char *
 
 void OpenCLDepthPacketProcessor::loadXZTables(const float *xtable, const float *ztable)
 {
-  impl_->fill_xz_tables(xtable, ztable);
+  std::vector<float> binned_xtable(512 * 424 / 4), binned_ztable(512 * 424 / 4);
+  binXZTables(xtable, ztable, &binned_xtable[0], &binned_ztable[0]);
+  impl_->fill_xz_tables(xtable, ztable, &binned_xtable[0], &binned_ztable[0]);
 }
 
 void OpenCLDepthPacketProcessor::loadLookupTable(const short *lut)
@@ -775,6 +818,13 @@ void OpenCLDepthPacketProcessor::process(const DepthPacket &packet)
   if (!listener_)
     return;
 
+  // the kernels need all 9 measurement sub-images, see DepthPacketStreamParser::setPartialPackets()
+  if((packet.lost_subsequences & 0x1ff) != 0)
+  {
+    LOG_DEBUG << "skipping packet " << packet.sequence << " with missing sub-images";
+    return;
+  }
+
   if(!impl_->programInitialized && !impl_->initProgram())
   {
     impl_->runtimeOk = false;
@@ -782,14 +832,21 @@ void OpenCLDepthPacketProcessor::process(const DepthPacket &packet)
     return;
   }
 
+  const bool output_confidence = (listener_->frameTypes() & Frame::Confidence) != 0;
+
   impl_->startTiming();
 
   impl_->ir_frame->timestamp = packet.timestamp;
   impl_->depth_frame->timestamp = packet.timestamp;
+  impl_->confidence_frame->timestamp = packet.timestamp;
   impl_->ir_frame->sequence = packet.sequence;
   impl_->depth_frame->sequence = packet.sequence;
+  impl_->confidence_frame->sequence = packet.sequence;
+  // a reused frame may have been cropped to the region of interest
+  impl_->ir_frame->width = impl_->depth_frame->width = impl_->confidence_frame->width = config_.EnableBinning ? 256 : 512;
+  impl_->ir_frame->height = impl_->depth_frame->height = impl_->confidence_frame->height = config_.EnableBinning ? 212 : 424;
 
-  impl_->runtimeOk = impl_->run(packet);
+  impl_->runtimeOk = impl_->run(packet, output_confidence);
 
   impl_->stopTiming(LOG_INFO);
 
@@ -797,12 +854,28 @@ void OpenCLDepthPacketProcessor::process(const DepthPacket &packet)
   {
       impl_->ir_frame->format = libfreenect2::Frame::Format::Invalid;
       impl_->depth_frame->format = libfreenect2::Frame::Format::Invalid;
+      impl_->confidence_frame->format = libfreenect2::Frame::Format::Invalid;
+  }
+  else
+  {
+    // the kernels process the whole image, the region of interest only shapes the output
+    applyRoi(impl_->ir_frame);
+    applyRoi(impl_->depth_frame);
+    if(output_confidence)
+      applyRoi(impl_->confidence_frame);
   }
 
   if(listener_->onNewFrame(Frame::Ir, impl_->ir_frame))
     impl_->newIrFrame();
-  if(listener_->onNewFrame(Frame::Depth, impl_->depth_frame))
+  if(sendDepthFrame(impl_->depth_frame))
     impl_->newDepthFrame();
+  if(output_confidence && listener_->onNewFrame(Frame::Confidence, impl_->confidence_frame))
+    impl_->newConfidenceFrame();
+}
+
+void OpenCLDepthPacketProcessor::setBufferCount(size_t count)
+{
+  impl_->input_buffer_allocator->setCapacity(count);
 }
 
 Allocator *OpenCLDepthPacketProcessor::getAllocator()
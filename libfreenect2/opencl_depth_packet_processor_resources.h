@@ -54,13 +54,10 @@ float decodePixelMeasurement(global const ushort *data, global const short *lut1
   return (float)lut11to16[(x < 1 || 510 < x || col_idx > 352) ? 0 : ((data[data_idx0] >> upper_bytes) | (data[data_idx1] << lower_bytes)) & 2047];
 }
 
-void kernel processPixelStage1(global const short *lut11to16, global const float *z_table, global const float3 *p0_table, global const ushort *data,
-                               global float3 *a_out, global float3 *b_out, global float3 *n_out, global float *ir_out)
+void measurePixelStage1(global const short *lut11to16, global const float *z_table, global const float3 *p0_table, global const ushort *data,
+                        const uint x, const uint y, float3 *a_out, float3 *b_out, int3 *saturated_out)
 {
-  const uint i = get_global_id(0);
-
-  const uint x = i % 512;
-  const uint y = i / 512;
+  const uint i = y * 512 + x;
 
   const uint y_tmp = (423 - y);
   const uint y_in = (y_tmp < 212 ? y_tmp + 212 : 423 - y_tmp);
@@ -93,13 +90,69 @@ void kernel processPixelStage1(global const short *lut11to16, global const float
                       dot(v1, p0y_sin),
                       dot(v2, p0z_sin)) * (float3)(AB_MULTIPLIER_PER_FRQ0, AB_MULTIPLIER_PER_FRQ1, AB_MULTIPLIER_PER_FRQ2);
 
-  a = select(a, (float3)(0.0f), invalid_pixel);
-  b = select(b, (float3)(0.0f), invalid_pixel);
-  float3 n = sqrt(a * a + b * b);
+  *a_out = select(a, (float3)(0.0f), invalid_pixel);
+  *b_out = select(b, (float3)(0.0f), invalid_pixel);
 
-  int3 saturated = (int3)(any(isequal(v0, (float3)(32767.0f))),
+  *saturated_out = (int3)(any(isequal(v0, (float3)(32767.0f))),
                           any(isequal(v1, (float3)(32767.0f))),
                           any(isequal(v2, (float3)(32767.0f))));
+}
+
+void kernel processPixelStage1(global const short *lut11to16, global const float *z_table, global const float3 *p0_table, global const ushort *data,
+                               global float3 *a_out, global float3 *b_out, global float3 *n_out, global float *ir_out)
+{
+  const uint i = get_global_id(0);
+
+  float3 a, b;
+  int3 saturated;
+  measurePixelStage1(lut11to16, z_table, p0_table, data, i % 512, i / 512, &a, &b, &saturated);
+
+  float3 n = sqrt(a * a + b * b);
+
+  a_out[i] = select(a, (float3)(0.0f), saturated);
+  b_out[i] = select(b, (float3)(0.0f), saturated);
+  n_out[i] = n;
+  ir_out[i] = min(dot(select(n, (float3)(65535.0f), saturated), (float3)(0.333333333f  * AB_MULTIPLIER * AB_OUTPUT_MULTIPLIER)), 65535.0f);
+}
+
+/*******************************************************************************
+ * Process pixel stage 1 of a 2x2 block, averaging IR a and IR b of the valid pixels
+ ******************************************************************************/
+void kernel processPixelStage1Binned(global const short *lut11to16, global const float *z_table, global const float3 *p0_table, global const ushort *data,
+                                     global float3 *a_out, global float3 *b_out, global float3 *n_out, global float *ir_out)
+{
+  const uint i = get_global_id(0);
+
+  const uint x = i % IMAGE_WIDTH;
+  const uint y = i / IMAGE_WIDTH;
+
+  float3 a_sum = (float3)(0.0f);
+  float3 b_sum = (float3)(0.0f);
+  int3 saturated = (int3)(0);
+  float count = 0.0f;
+
+  for(uint yi = 2 * y; yi < 2 * y + 2; ++yi)
+  {
+    for(uint xi = 2 * x; xi < 2 * x + 2; ++xi)
+    {
+      float3 a, b;
+      int3 saturated_pixel;
+      measurePixelStage1(lut11to16, z_table, p0_table, data, xi, yi, &a, &b, &saturated_pixel);
+
+      saturated |= saturated_pixel;
+
+      if(0.0f < z_table[yi * 512 + xi])
+      {
+        a_sum += a;
+        b_sum += b;
+        count += 1.0f;
+      }
+    }
+  }
+
+  const float3 a = a_sum / max(count, 1.0f);
+  const float3 b = b_sum / max(count, 1.0f);
+  float3 n = sqrt(a * a + b * b);
 
   a_out[i] = select(a, (float3)(0.0f), saturated);
   b_out[i] = select(b, (float3)(0.0f), saturated);
@@ -115,15 +168,15 @@ void kernel filterPixelStage1(global const float3 *a, global const float3 *b, gl
 {
   const uint i = get_global_id(0);
 
-  const uint x = i % 512;
-  const uint y = i / 512;
+  const uint x = i % IMAGE_WIDTH;
+  const uint y = i / IMAGE_WIDTH;
 
   const float3 self_a = a[i];
   const float3 self_b = b[i];
 
   const float gaussian[9] = {GAUSSIAN_KERNEL_0, GAUSSIAN_KERNEL_1, GAUSSIAN_KERNEL_2, GAUSSIAN_KERNEL_3, GAUSSIAN_KERNEL_4, GAUSSIAN_KERNEL_5, GAUSSIAN_KERNEL_6, GAUSSIAN_KERNEL_7, GAUSSIAN_KERNEL_8};
 
-  if(x < 1 || y < 1 || x > 510 || y > 422)
+  if(x < 1 || y < 1 || x > IMAGE_WIDTH - 2 || y > IMAGE_HEIGHT - 2)
   {
     a_out[i] = self_a;
     b_out[i] = self_b;
@@ -150,7 +203,7 @@ void kernel filterPixelStage1(global const float3 *a, global const float3 *b, gl
 
     for(int yi = -1, j = 0; yi < 2; ++yi)
     {
-      uint i_other = (y + yi) * 512 + x - 1;
+      uint i_other = (y + yi) * IMAGE_WIDTH + x - 1;
 
       for(int xi = -1; xi < 2; ++xi, ++j, ++i_other)
       {
@@ -184,7 +237,7 @@ void kernel filterPixelStage1(global const float3 *a, global const float3 *b, gl
  * Process pixel stage 2
  ******************************************************************************/
 void kernel processPixelStage2(global const float3 *a_in, global const float3 *b_in, global const float *x_table, global const float *z_table,
-                               global float *depth, global float *ir_sums)
+                               global float *depth, global float *ir_sums, global float *confidence)
 {
   const uint i = get_global_id(0);
   float3 a = a_in[i];
@@ -200,6 +253,7 @@ void kernel processPixelStage2(global const float3 *a_in, global const float3 *b
   float ir_max = max(ir.x, max(ir.y, ir.z));
 
   float phase_final = 0.0f;
+  float phase_confidence = 0.0f;
 
   if(ir_min >= INDIVIDUAL_AB_THRESHOLD && ir_sum >= AB_THRESHOLD)
   {
@@ -267,6 +321,8 @@ void kernel processPixelStage2(global const float3 *a_in, global const float3 *b
     float mask3 = MAX_DEALIAS_CONFIDENCE * MAX_DEALIAS_CONFIDENCE >= norm ? 1.0f : 0.0f;
     t10 *= mask3;
     phase_final = true/*(modeMask & 2) != 0*/ ? t11 : t10;
+
+    phase_confidence = 0.0f < t11 ? 1.0f - norm / ir_x : 0.0f;
   }
 
   float zmultiplier = z_table[i];
@@ -287,6 +343,7 @@ void kernel processPixelStage2(global const float3 *a_in, global const float3 *b
   float d = cond1 ? depth_fit : depth_linear; // r1.y -> later r2.z
   depth[i] = d;
   ir_sums[i] = ir_sum;
+  confidence[i] = phase_confidence;
 }
 
 /*******************************************************************************
@@ -296,8 +353,8 @@ void kernel filterPixelStage2(global const float *depth, global const float *ir_
 {
   const uint i = get_global_id(0);
 
-  const uint x = i % 512;
-  const uint y = i / 512;
+  const uint x = i % IMAGE_WIDTH;
+  const uint y = i / IMAGE_WIDTH;
 
   const float raw_depth = depth[i];
   const float ir_sum = ir_sums[i];
@@ -305,7 +362,7 @@ void kernel filterPixelStage2(global const float *depth, global const float *ir_
 
   if(raw_depth >= MIN_DEPTH && raw_depth <= MAX_DEPTH)
   {
-    if(x < 1 || y < 1 || x > 510 || y > 422)
+    if(x < 1 || y < 1 || x > IMAGE_WIDTH - 2 || y > IMAGE_HEIGHT - 2)
     {
       filtered[i] = raw_depth;
     }
@@ -318,7 +375,7 @@ void kernel filterPixelStage2(global const float *depth, global const float *ir_
 
       for(int yi = -1; yi < 2; ++yi)
       {
-        uint i_other = (y + yi) * 512 + x - 1;
+        uint i_other = (y + yi) * IMAGE_WIDTH + x - 1;
 
         for(int xi = -1; xi < 2; ++xi, ++i_other)
         {
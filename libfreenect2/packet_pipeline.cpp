@@ -32,6 +32,10 @@
 #include <libfreenect2/rgb_packet_stream_parser.h>
 #include <libfreenect2/depth_packet_stream_parser.h>
 #include <libfreenect2/protocol/response.h>
+#include <libfreenect2/logging.h>
+
+#include <cstdlib>
+#include <string>
 
 namespace libfreenect2
 {
@@ -41,6 +45,42 @@ static RgbPacketProcessor *getDefaultRgbPacketProcessor()
   return new TurboJpegRgbPacketProcessor();
 }
 
+/**
+ * Wrap a processor in an AsyncPacketProcessor with the queue from the
+ * environment: LIBFREENECT2_<stream>_QUEUE_DEPTH packets, 1 by default, and
+ * LIBFREENECT2_<stream>_QUEUE_POLICY "drop-newest" (default), "drop-oldest"
+ * or "block".
+ * @param processor Processor to wrap.
+ * @param stream "RGB" or "DEPTH".
+ */
+template<typename PacketT>
+static AsyncPacketProcessor<PacketT> *createAsyncPacketProcessor(PacketProcessor<PacketT> *processor, const std::string &stream)
+{
+  size_t depth = 1;
+  AsyncQueuePolicy policy = DropNewestPacket;
+
+  const char *depth_env = std::getenv(("LIBFREENECT2_" + stream + "_QUEUE_DEPTH").c_str());
+  if(depth_env && std::atoi(depth_env) > 0)
+    depth = std::atoi(depth_env);
+
+  const char *policy_env = std::getenv(("LIBFREENECT2_" + stream + "_QUEUE_POLICY").c_str());
+  if(policy_env)
+  {
+    const std::string name(policy_env);
+    if(name == "drop-oldest")
+      policy = DropOldestPacket;
+    else if(name == "block")
+      policy = BlockOnFullQueue;
+    else if(name != "drop-newest")
+      LOG_WARNING << "unknown queue policy " << name << ", dropping the newest packets";
+  }
+
+  if(depth != 1 || policy != DropNewestPacket)
+    LOG_INFO << processor->name() << " queue depth " << depth << ", " << (policy == DropOldestPacket ? "drop-oldest" : policy == BlockOnFullQueue ? "block" : "drop-newest");
+
+  return new AsyncPacketProcessor<PacketT>(processor, depth, policy);
+}
+
 class PacketPipelineComponents
 {
 public:
@@ -48,9 +88,9 @@ public:
   DepthPacketStreamParser *depth_parser_;
 
   RgbPacketProcessor *rgb_processor_;
-  BaseRgbPacketProcessor *async_rgb_processor_;
+  AsyncPacketProcessor<RgbPacket> *async_rgb_processor_;
   DepthPacketProcessor *depth_processor_;
-  BaseDepthPacketProcessor *async_depth_processor_;
+  AsyncPacketProcessor<DepthPacket> *async_depth_processor_;
 
   ~PacketPipelineComponents();
   void initialize(RgbPacketProcessor *rgb, DepthPacketProcessor *depth);
@@ -64,8 +104,8 @@ void PacketPipelineComponents::initialize(RgbPacketProcessor *rgb, DepthPacketPr
   rgb_processor_ = rgb;
   depth_processor_ = depth;
 
-  async_rgb_processor_ = new AsyncPacketProcessor<RgbPacket>(rgb_processor_);
-  async_depth_processor_ = new AsyncPacketProcessor<DepthPacket>(depth_processor_);
+  async_rgb_processor_ = createAsyncPacketProcessor<RgbPacket>(rgb_processor_, "RGB");
+  async_depth_processor_ = createAsyncPacketProcessor<DepthPacket>(depth_processor_, "DEPTH");
 
   rgb_parser_->setPacketProcessor(async_rgb_processor_);
   depth_parser_->setPacketProcessor(async_depth_processor_);
@@ -108,6 +148,16 @@ DepthPacketProcessor *PacketPipeline::getDepthPacketProcessor() const
   return comp_->depth_processor_;
 }
 
+PacketQueueStatistics PacketPipeline::getRgbQueueStatistics() const
+{
+  return comp_->async_rgb_processor_->getStatistics();
+}
+
+PacketQueueStatistics PacketPipeline::getDepthQueueStatistics() const
+{
+  return comp_->async_depth_processor_->getStatistics();
+}
+
 CpuPacketPipeline::CpuPacketPipeline()
 {
   comp_->initialize(getDefaultRgbPacketProcessor(), new CpuDepthPacketProcessor());
@@ -115,6 +165,20 @@ CpuPacketPipeline::CpuPacketPipeline()
 
 CpuPacketPipeline::~CpuPacketPipeline() { }
 
+CpuKdePacketPipeline::CpuKdePacketPipeline()
+{
+  comp_->initialize(getDefaultRgbPacketProcessor(), new CpuKdeDepthPacketProcessor());
+}
+
+CpuKdePacketPipeline::~CpuKdePacketPipeline() { }
+
+CpuFixedPacketPipeline::CpuFixedPacketPipeline()
+{
+  comp_->initialize(getDefaultRgbPacketProcessor(), new CpuFixedDepthPacketProcessor());
+}
+
+CpuFixedPacketPipeline::~CpuFixedPacketPipeline() { }
+
     
     OpenCLPacketPipeline::OpenCLPacketPipeline()
     {
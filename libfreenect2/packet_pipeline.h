@@ -64,6 +64,9 @@ public:
 
   virtual RgbPacketProcessor *getRgbPacketProcessor() const;
   virtual DepthPacketProcessor *getDepthPacketProcessor() const;
+
+  virtual PacketQueueStatistics getRgbQueueStatistics() const;
+  virtual PacketQueueStatistics getDepthQueueStatistics() const;
 protected:
   PacketPipelineComponents *comp_;
 };
@@ -83,6 +86,22 @@ public:
   virtual ~CpuPacketPipeline();
 };
 
+/** Pipeline with CPU depth processing using the KDE phase unwrapping. */
+class LIBFREENECT2_API CpuKdePacketPipeline : public PacketPipeline
+{
+public:
+  CpuKdePacketPipeline();
+  virtual ~CpuKdePacketPipeline();
+};
+
+/** Pipeline with fixed-point CPU depth processing. */
+class LIBFREENECT2_API CpuFixedPacketPipeline : public PacketPipeline
+{
+public:
+  CpuFixedPacketPipeline();
+  virtual ~CpuFixedPacketPipeline();
+};
+
     
     /** Pipeline with OpenCL depth processing. */
     class LIBFREENECT2_API OpenCLPacketPipeline : public PacketPipeline
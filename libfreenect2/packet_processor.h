@@ -75,6 +75,16 @@ public:
     p.memory = NULL;
   }
 
+  /**
+   * Let allocateBuffer() hand out \a count buffers at the same time, for
+   * callers that keep several packets in flight.
+   * @param count Number of buffers, see PoolAllocator::setCapacity().
+   */
+  virtual void setBufferCount(size_t count)
+  {
+    default_allocator_.setCapacity(count);
+  }
+
 protected:
   virtual Allocator *getAllocator() { return &default_allocator_; }
 
@@ -37,6 +37,12 @@
 namespace libfreenect2
 {
     
+RgbPacketChunks::~RgbPacketChunks()
+{
+  for(size_t i = 0; i < references.size(); ++i)
+    references[i]->release();
+}
+
 RgbPacketProcessor::RgbPacketProcessor() :
     listener_(0)
 {
@@ -51,6 +57,27 @@ void RgbPacketProcessor::setFrameListener(libfreenect2::FrameListener *listener)
   listener_ = listener;
 }
 
+void RgbPacketProcessor::releaseBuffer(RgbPacket &p)
+{
+  p.chunks.reset();
+  BaseRgbPacketProcessor::releaseBuffer(p);
+}
+
+void RgbPacketProcessor::copyJpeg(const RgbPacket &packet, unsigned char *out)
+{
+  if(packet.jpeg_buffer != 0)
+  {
+    std::memcpy(out, packet.jpeg_buffer, packet.jpeg_buffer_length);
+    return;
+  }
+
+  for(size_t i = 0; i < packet.chunks->jpeg.size(); ++i)
+  {
+    std::memcpy(out, packet.chunks->jpeg[i].data, packet.chunks->jpeg[i].length);
+    out += packet.chunks->jpeg[i].length;
+  }
+}
+
     
 /** Implementation of the Dump rgb packet processor. */
 class DumpRgbPacketProcessorImpl: public WithPerfLogging
@@ -92,7 +119,7 @@ void DumpRgbPacketProcessor::process(const RgbPacket &packet)
         frame->gamma = packet.gamma;
         frame->dataSize = packet.jpeg_buffer_length;
 
-        std::memcpy(frame->data, packet.jpeg_buffer, packet.jpeg_buffer_length);
+        copyJpeg(packet, frame->data);
         
         if (!listener_->onNewFrame(Frame::Color, frame))
         {
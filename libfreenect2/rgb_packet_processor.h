@@ -32,25 +32,52 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <memory>
+#include <vector>
+
 #include <include/libfreenect2.h>
 #include <libfreenect2/packet_processor.h>
+#include <libfreenect2/usb/DataCallback.h>
 
 namespace libfreenect2
 {
 
+/** Piece of data in a USB transfer buffer. */
+struct RgbPacketChunk
+{
+  unsigned char *data;
+  size_t length;
+};
+
+/**
+ * Data of a packet left in the USB transfer buffers by the scatter-gather
+ * mode of RgbPacketStreamParser. The buffers go back to their transfer pool
+ * when this is destroyed.
+ */
+class RgbPacketChunks
+{
+public:
+  ~RgbPacketChunks();
+
+  std::vector<RgbPacketChunk> buffers;           ///< Received data of the packet, header and footer included.
+  std::vector<usb::DataReference *> references; ///< References keeping #buffers.
+  std::vector<RgbPacketChunk> jpeg;              ///< Pieces of the JPEG data within #buffers.
+};
+
 /** Packet with JPEG data. */
 struct RgbPacket
 {
   uint32_t sequence;
 
   uint32_t timestamp;
-  unsigned char *jpeg_buffer; ///< JPEG data.
+  unsigned char *jpeg_buffer; ///< JPEG data, NULL if it spans several #chunks.
   size_t jpeg_buffer_length;  ///< Length of the JPEG data.
   float exposure;
   float gain;
   float gamma;
 
   Buffer *memory;
+  std::shared_ptr<RgbPacketChunks> chunks; ///< USB transfer buffers holding the JPEG data in scatter-gather mode, else NULL.
 };
 
 typedef PacketProcessor<RgbPacket> BaseRgbPacketProcessor;
@@ -63,6 +90,17 @@ public:
   virtual ~RgbPacketProcessor();
 
   virtual void setFrameListener(libfreenect2::FrameListener *listener);
+
+  /** Also give the USB transfer buffers of a scatter-gather packet back. */
+  virtual void releaseBuffer(RgbPacket &p);
+
+  /**
+   * Copy the JPEG data of a packet, from #RgbPacket::jpeg_buffer or from the
+   * pieces in #RgbPacket::chunks.
+   * @param packet Packet to copy from.
+   * @param [out] out Destination of #RgbPacket::jpeg_buffer_length bytes.
+   */
+  static void copyJpeg(const RgbPacket &packet, unsigned char *out);
 protected:
   libfreenect2::FrameListener *listener_;
 };
@@ -30,6 +30,8 @@
 #include <libfreenect2/rgb_packet_stream_parser.h>
 #include <libfreenect2/logging.h>
 #include <memory.h>
+#include <algorithm>
+#include <cstdlib>
 
 namespace libfreenect2
 {
@@ -61,11 +63,43 @@ LIBFREENECT2_PACK(struct RgbPacketFooter {
   uint32_t unknown4[3]; // seems to be 0 all the time.
 });
 
+/**
+ * Copy bytes of data spread over several chunks.
+ * @param chunks Chunks of the data, in order.
+ * @param offset Position of the first byte in the data.
+ * @param [out] out Destination.
+ * @param n Number of bytes to copy, they must be within the chunks.
+ */
+static void readChunks(const RgbPacketChunk *chunks, size_t offset, void *out, size_t n)
+{
+  unsigned char *o = static_cast<unsigned char *>(out);
+
+  for(; n > 0; ++chunks)
+  {
+    if(offset >= chunks->length)
+    {
+      offset -= chunks->length;
+      continue;
+    }
+
+    size_t piece = std::min(n, chunks->length - offset);
+    memcpy(o, chunks->data + offset, piece);
+    o += piece;
+    n -= piece;
+    offset = 0;
+  }
+}
+
 RgbPacketStreamParser::RgbPacketStreamParser() :
     buffer_size_(2*1024*1024),
-    processor_(noopProcessor<RgbPacket>())
+    processor_(noopProcessor<RgbPacket>()),
+    scatter_gather_(false),
+    chunks_(std::make_shared<RgbPacketChunks>()),
+    chunks_length_(0)
 {
   processor_->allocateBuffer(packet_, buffer_size_);
+
+  setScatterGather(std::getenv("LIBFREENECT2_RGB_SCATTER_GATHER") != 0);
 }
 
 RgbPacketStreamParser::~RgbPacketStreamParser()
@@ -79,6 +113,20 @@ void RgbPacketStreamParser::setPacketProcessor(BaseRgbPacketProcessor *processor
   processor_->allocateBuffer(packet_, buffer_size_);
 }
 
+void RgbPacketStreamParser::setScatterGather(bool enable)
+{
+  if(enable)
+    LOG_INFO << "keeping rgb transfer buffers until decoded";
+
+  scatter_gather_ = enable;
+
+  // drop the packet being received
+  chunks_ = std::make_shared<RgbPacketChunks>();
+  chunks_length_ = 0;
+  if (packet_.memory != NULL)
+    packet_.memory->length = 0;
+}
+
 void RgbPacketStreamParser::onDataReceived(unsigned char* buffer, size_t length)
 {
   if (packet_.memory == NULL || packet_.memory->data == NULL)
@@ -103,76 +151,168 @@ void RgbPacketStreamParser::onDataReceived(unsigned char* buffer, size_t length)
       return;
     }
 
-    // not enough data to do anything
-    if (fb.length <= sizeof(RawRgbPacket) + sizeof(RgbPacketFooter))
-      return;
+    RgbPacketChunk chunk = { fb.data, fb.length };
 
-    RgbPacketFooter* footer = reinterpret_cast<RgbPacketFooter *>(&fb.data[fb.length - sizeof(RgbPacketFooter)]);
+    if (parsePacket(&chunk, 1, fb.length))
+    {
+      // reset front buffer
+      packet_.memory->length = 0;
+    }
+  }
+}
 
-    if (footer->magic_header == 0x39393939 && footer->magic_footer == 0x42424242)
+void RgbPacketStreamParser::onBufferReceived(unsigned char* buffer, size_t length, usb::DataReference *reference)
+{
+  if (!scatter_gather_)
+  {
+    usb::DataCallback::onBufferReceived(buffer, length, reference);
+    return;
+  }
+
+  if (packet_.memory == NULL || packet_.memory->data == NULL)
+  {
+    LOG_ERROR << "Packet buffer is NULL";
+    reference->release();
+    return;
+  }
+
+  // package containing data
+  if(length > 0)
+  {
+    RgbPacketChunk chunk = { buffer, length };
+    chunks_->buffers.push_back(chunk);
+    chunks_->references.push_back(reference);
+    chunks_length_ += length;
+
+    if(chunks_length_ > buffer_size_)
     {
-      RawRgbPacket *raw_packet = reinterpret_cast<RawRgbPacket *>(fb.data);
+      LOG_INFO << "buffer overflow!";
+      chunks_ = std::make_shared<RgbPacketChunks>();
+      chunks_length_ = 0;
+      return;
+    }
 
-      if (fb.length != footer->packet_size || raw_packet->sequence != footer->sequence)
-      {
-        LOG_INFO << "packetsize or sequence doesn't match!";
-        fb.length = 0;
-        return;
-      }
+    if (parsePacket(chunks_->buffers.data(), chunks_->buffers.size(), chunks_length_))
+    {
+      // the processor keeps the buffers of a passed on packet, the others go back now
+      chunks_ = std::make_shared<RgbPacketChunks>();
+      chunks_length_ = 0;
+    }
+  }
+  else
+  {
+    reference->release();
+  }
+}
 
-      if (fb.length - sizeof(RawRgbPacket) - sizeof(RgbPacketFooter) < footer->filler_length)
-      {
-        LOG_INFO << "not enough space for packet filler!";
-        fb.length = 0;
-        return;
-      }
+/**
+ * Check for a complete packet at the end of the received data and pass it on.
+ * @param chunks Received data of the packet, in order.
+ * @param num_chunks Number of chunks.
+ * @param length Total length of the chunks.
+ * @return True if the data ended with a packet footer, valid or not, and needs to be reset.
+ */
+bool RgbPacketStreamParser::parsePacket(const RgbPacketChunk *chunks, size_t num_chunks, size_t length)
+{
+  // not enough data to do anything
+  if (length <= sizeof(RawRgbPacket) + sizeof(RgbPacketFooter))
+    return false;
 
-      size_t jpeg_length = 0;
-      //check for JPEG EOI 0xff 0xd9 within 0 to 3 alignment bytes
-      size_t length_no_filler = fb.length - sizeof(RawRgbPacket) - sizeof(RgbPacketFooter) - footer->filler_length;
-      for (size_t i = 0; i < 4; i++)
-      {
-        if (length_no_filler < i + 2)
-          break;
-        size_t eoi = length_no_filler - i;
+  RgbPacketFooter footer;
+  readChunks(chunks, length - sizeof(RgbPacketFooter), &footer, sizeof(footer));
 
-        if (raw_packet->jpeg_buffer[eoi - 2] == 0xff && raw_packet->jpeg_buffer[eoi - 1] == 0xd9)
-          jpeg_length = eoi;
-      }
+  if (footer.magic_header != 0x39393939 || footer.magic_footer != 0x42424242)
+    return false;
 
-      if (jpeg_length == 0)
-      {
-        LOG_INFO << "no JPEG detected!";
-        fb.length = 0;
-        return;
-      }
+  RawRgbPacket raw_packet;
+  readChunks(chunks, 0, &raw_packet, sizeof(raw_packet));
 
-      // can the processor handle the next image?
-      if(processor_->ready())
-      {
-        RgbPacket &rgb_packet = packet_;
-        rgb_packet.sequence = raw_packet->sequence;
-        rgb_packet.timestamp = footer->timestamp;
-        rgb_packet.exposure = footer->exposure;
-        rgb_packet.gain = footer->gain;
-        rgb_packet.gamma = footer->gamma;
-        rgb_packet.jpeg_buffer = raw_packet->jpeg_buffer;
-        rgb_packet.jpeg_buffer_length = jpeg_length;
-
-        // call the processor
-        processor_->process(rgb_packet);
-          //allocatePacket() should never return NULL when processor is ready()
-          processor_->allocateBuffer(packet_, buffer_size_);
-      }
-      else
+  if (length != footer.packet_size || raw_packet.sequence != footer.sequence)
+  {
+    LOG_INFO << "packetsize or sequence doesn't match!";
+    return true;
+  }
+
+  if (length - sizeof(RawRgbPacket) - sizeof(RgbPacketFooter) < footer.filler_length)
+  {
+    LOG_INFO << "not enough space for packet filler!";
+    return true;
+  }
+
+  size_t jpeg_length = 0;
+  //check for JPEG EOI 0xff 0xd9 within 0 to 3 alignment bytes
+  size_t length_no_filler = length - sizeof(RawRgbPacket) - sizeof(RgbPacketFooter) - footer.filler_length;
+  for (size_t i = 0; i < 4; i++)
+  {
+    if (length_no_filler < i + 2)
+      break;
+    size_t eoi = length_no_filler - i;
+
+    unsigned char marker[2];
+    readChunks(chunks, sizeof(RawRgbPacket) + eoi - 2, marker, sizeof(marker));
+
+    if (marker[0] == 0xff && marker[1] == 0xd9)
+      jpeg_length = eoi;
+  }
+
+  if (jpeg_length == 0)
+  {
+    LOG_INFO << "no JPEG detected!";
+    return true;
+  }
+
+  // can the processor handle the next image?
+  if(processor_->ready())
+  {
+    RgbPacket &rgb_packet = packet_;
+    rgb_packet.sequence = raw_packet.sequence;
+    rgb_packet.timestamp = footer.timestamp;
+    rgb_packet.exposure = footer.exposure;
+    rgb_packet.gain = footer.gain;
+    rgb_packet.gamma = footer.gamma;
+    rgb_packet.jpeg_buffer_length = jpeg_length;
+
+    // a JPEG within the first chunk is decoded in place, else the processor gathers the pieces
+    if (sizeof(RawRgbPacket) + jpeg_length <= chunks[0].length)
+    {
+      rgb_packet.jpeg_buffer = chunks[0].data + sizeof(RawRgbPacket);
+    }
+    else
+    {
+      rgb_packet.jpeg_buffer = NULL;
+
+      size_t offset = sizeof(RawRgbPacket), remaining = jpeg_length;
+      for (size_t i = 0; i < num_chunks && remaining > 0; i++)
       {
-        LOG_DEBUG << "skipping rgb packet!";
-      }
+        if (offset >= chunks[i].length)
+        {
+          offset -= chunks[i].length;
+          continue;
+        }
 
-      // reset front buffer
-      packet_.memory->length = 0;
+        RgbPacketChunk piece = { chunks[i].data + offset, std::min(remaining, chunks[i].length - offset) };
+        chunks_->jpeg.push_back(piece);
+        remaining -= piece.length;
+        offset = 0;
+      }
     }
+
+    if (scatter_gather_)
+      rgb_packet.chunks = chunks_;
+
+    // call the processor
+    processor_->process(rgb_packet);
+      //allocatePacket() should never return NULL when processor is ready()
+      processor_->allocateBuffer(packet_, buffer_size_);
+
+    packet_.chunks.reset();
   }
+  else
+  {
+    LOG_DEBUG << "skipping rgb packet!";
+  }
+
+  return true;
 }
 
 } /* namespace libfreenect2 */
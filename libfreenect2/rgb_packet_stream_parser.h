@@ -38,7 +38,15 @@
 namespace libfreenect2
 {
 
-/** Parser for getting an RGB packet from the stream. */
+/**
+ * Parser for getting an RGB packet from the stream.
+ *
+ * By default the data is copied to the packet buffer. In scatter-gather mode
+ * the parser keeps the USB transfer buffers instead and passes them on with
+ * the packet, see RgbPacket::chunks. The processor gives them back to the
+ * transfer pool once the packet is decoded. It can be enabled with the
+ * environment variable LIBFREENECT2_RGB_SCATTER_GATHER.
+ */
 class RgbPacketStreamParser : public usb::DataCallback
 {
 public:
@@ -47,11 +55,27 @@ public:
 
   void setPacketProcessor(BaseRgbPacketProcessor *processor);
 
+  /**
+   * Keep the USB transfer buffers instead of copying them. The decoder reads
+   * the JPEG from the transfer buffers, in place if it fits in one, see
+   * LIBFREENECT2_RGB_TRANSFER_SIZE, else piece by piece.
+   * @param enable Whether to keep the buffers.
+   */
+  void setScatterGather(bool enable);
+
+  virtual bool keepsBuffers() const { return scatter_gather_; }
   virtual void onDataReceived(unsigned char* buffer, size_t length);
+  virtual void onBufferReceived(unsigned char* buffer, size_t length, usb::DataReference *reference);
 private:
   size_t buffer_size_;
   RgbPacket packet_;
   BaseRgbPacketProcessor *processor_; ///< Parser implementation.
+
+  bool scatter_gather_;
+  std::shared_ptr<RgbPacketChunks> chunks_; ///< Buffers of the packet being received in scatter-gather mode.
+  size_t chunks_length_; ///< Data in #chunks_.
+
+  bool parsePacket(const RgbPacketChunk *chunks, size_t num_chunks, size_t length);
 };
 
 } /* namespace libfreenect2 */
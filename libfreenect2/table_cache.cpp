@@ -0,0 +1,287 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+/** @file table_cache.cpp On-disk cache of the calibration and depth tables of a device. */
+
+#include <libfreenect2/table_cache.h>
+#include <libfreenect2/depth_packet_processor.h>
+#include <libfreenect2/protocol/response.h>
+#include <libfreenect2/logging.h>
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace libfreenect2
+{
+
+namespace
+{
+
+const char MAGIC[8] = {'L', 'F', '2', 'T', 'A', 'B', 'L', 'E'};
+const uint32_t VERSION = 1;
+const size_t ALIGNMENT = 64; ///< Alignment of the tables in the file, a cache line.
+
+/** Start of a cache file, followed by the P0 tables, the x, z and lookup tables. */
+struct TableCacheHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  char serial[64];
+  char firmware[256];
+  Freenect2Device::IrCameraParams ir_params;
+  Freenect2Device::ColorCameraParams color_params;
+  uint64_t p0_tables_offset, p0_tables_size;
+  uint64_t xtable_offset, ztable_offset, lut_offset;
+  uint64_t file_size;
+};
+
+size_t alignOffset(size_t offset)
+{
+  return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+/** Fill the identification and the offsets of a header. */
+void layoutHeader(TableCacheHeader &header, const std::string &serial, const std::string &firmware)
+{
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.header_size = sizeof(TableCacheHeader);
+  std::strncpy(header.serial, serial.c_str(), sizeof(header.serial) - 1);
+  std::strncpy(header.firmware, firmware.c_str(), sizeof(header.firmware) - 1);
+
+  header.p0_tables_offset = alignOffset(sizeof(TableCacheHeader));
+  header.p0_tables_size = sizeof(protocol::P0TablesResponse);
+  header.xtable_offset = alignOffset(header.p0_tables_offset + header.p0_tables_size);
+  header.ztable_offset = alignOffset(header.xtable_offset + DepthPacketProcessor::TABLE_SIZE * sizeof(float));
+  header.lut_offset = alignOffset(header.ztable_offset + DepthPacketProcessor::TABLE_SIZE * sizeof(float));
+  header.file_size = header.lut_offset + DepthPacketProcessor::LUT_SIZE * sizeof(short);
+}
+
+/** 32-bit FNV-1a, to keep firmware version strings out of file names. */
+uint32_t hashString(const std::string &s)
+{
+  uint32_t hash = 2166136261u;
+  for(size_t i = 0; i < s.size(); ++i)
+    hash = (hash ^ static_cast<unsigned char>(s[i])) * 16777619u;
+  return hash;
+}
+
+} /* namespace */
+
+TableCache::TableCache(const std::string &serial, const std::string &firmware) :
+  serial_(serial),
+  firmware_(firmware),
+  mapping_(0),
+  mapping_size_(0)
+{
+  TableCacheHeader header;
+  const char *dir = std::getenv("LIBFREENECT2_TABLE_CACHE_DIR");
+
+  // identifiers that do not fit the header cannot be checked, do not cache them
+  if(dir == 0 || *dir == '\0' || serial.empty() || serial.size() >= sizeof(header.serial) || firmware.size() >= sizeof(header.firmware))
+    return;
+
+  std::ostringstream path;
+  path << dir << "/";
+  for(size_t i = 0; i < serial.size(); ++i)
+    path << (std::isalnum(static_cast<unsigned char>(serial[i])) ? serial[i] : '_');
+  path << "-" << std::hex << hashString(firmware) << ".tables";
+  path_ = path.str();
+}
+
+TableCache::TableCache(const std::string &path) :
+  path_(path),
+  mapping_(0),
+  mapping_size_(0)
+{
+}
+
+TableCache::~TableCache()
+{
+#ifndef _WIN32
+  if(mapping_ != 0)
+    munmap(mapping_, mapping_size_);
+#endif
+}
+
+bool TableCache::enabled() const
+{
+  return !path_.empty();
+}
+
+bool TableCache::load()
+{
+#ifndef _WIN32
+  if(!enabled() || mapping_ != 0)
+    return mapping_ != 0;
+
+  int fd = open(path_.c_str(), O_RDONLY);
+  if(fd < 0)
+    return false;
+
+  struct stat st;
+  void *mapping = MAP_FAILED;
+  if(fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(TableCacheHeader))
+    mapping = mmap(0, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if(mapping == MAP_FAILED)
+    return false;
+
+  TableCacheHeader header;
+  std::memcpy(&header, mapping, sizeof(header));
+
+  // a file opened by its path belongs to the device that wrote it
+  if(serial_.empty())
+  {
+    header.serial[sizeof(header.serial) - 1] = '\0';
+    header.firmware[sizeof(header.firmware) - 1] = '\0';
+    serial_ = header.serial;
+    firmware_ = header.firmware;
+  }
+
+  TableCacheHeader expected;
+  layoutHeader(expected, serial_, firmware_);
+
+  // everything but the parameters has to match, so files of other devices or versions are ignored
+  header.ir_params = expected.ir_params;
+  header.color_params = expected.color_params;
+
+  if(size_t(st.st_size) != expected.file_size || std::memcmp(&header, &expected, sizeof(header)) != 0)
+  {
+    LOG_INFO << "ignoring table cache " << path_ << " of another device or version";
+    munmap(mapping, size_t(st.st_size));
+    return false;
+  }
+
+  mapping_ = static_cast<unsigned char *>(mapping);
+  mapping_size_ = size_t(st.st_size);
+  LOG_INFO << "loaded tables from " << path_;
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool TableCache::store(const Freenect2Device::IrCameraParams &ir_params, const Freenect2Device::ColorCameraParams &color_params,
+                       const unsigned char *p0_tables, size_t p0_tables_size, const float *xtable, const float *ztable, const short *lut) const
+{
+#ifndef _WIN32
+  if(!enabled() || p0_tables_size != sizeof(protocol::P0TablesResponse))
+    return false;
+
+  TableCacheHeader header;
+  layoutHeader(header, serial_, firmware_);
+  header.ir_params = ir_params;
+  header.color_params = color_params;
+
+  std::vector<unsigned char> file(header.file_size, 0);
+  std::memcpy(&file[0], &header, sizeof(header));
+  std::memcpy(&file[header.p0_tables_offset], p0_tables, p0_tables_size);
+  std::memcpy(&file[header.xtable_offset], xtable, DepthPacketProcessor::TABLE_SIZE * sizeof(float));
+  std::memcpy(&file[header.ztable_offset], ztable, DepthPacketProcessor::TABLE_SIZE * sizeof(float));
+  std::memcpy(&file[header.lut_offset], lut, DepthPacketProcessor::LUT_SIZE * sizeof(short));
+
+  const std::string dir = path_.substr(0, path_.rfind('/'));
+  if(mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+  {
+    LOG_WARNING << "could not create table cache directory " << dir;
+    return false;
+  }
+
+  // write a temporary file and rename it, so a concurrent load never sees a partial file
+  std::ostringstream tmp_path;
+  tmp_path << path_ << "." << getpid() << ".tmp";
+
+  FILE *f = std::fopen(tmp_path.str().c_str(), "wb");
+  bool ok = f != 0 && std::fwrite(&file[0], 1, file.size(), f) == file.size();
+  ok = f != 0 && std::fclose(f) == 0 && ok;
+  ok = ok && std::rename(tmp_path.str().c_str(), path_.c_str()) == 0;
+
+  if(!ok)
+  {
+    std::remove(tmp_path.str().c_str());
+    LOG_WARNING << "could not write table cache " << path_;
+    return false;
+  }
+
+  LOG_INFO << "stored tables in " << path_;
+  return true;
+#else
+  return false;
+#endif
+}
+
+const Freenect2Device::IrCameraParams &TableCache::irCameraParams() const
+{
+  return reinterpret_cast<const TableCacheHeader *>(mapping_)->ir_params;
+}
+
+const Freenect2Device::ColorCameraParams &TableCache::colorCameraParams() const
+{
+  return reinterpret_cast<const TableCacheHeader *>(mapping_)->color_params;
+}
+
+const unsigned char *TableCache::p0Tables() const
+{
+  return mapping_ + reinterpret_cast<const TableCacheHeader *>(mapping_)->p0_tables_offset;
+}
+
+size_t TableCache::p0TablesSize() const
+{
+  return size_t(reinterpret_cast<const TableCacheHeader *>(mapping_)->p0_tables_size);
+}
+
+const float *TableCache::xTable() const
+{
+  return reinterpret_cast<const float *>(mapping_ + reinterpret_cast<const TableCacheHeader *>(mapping_)->xtable_offset);
+}
+
+const float *TableCache::zTable() const
+{
+  return reinterpret_cast<const float *>(mapping_ + reinterpret_cast<const TableCacheHeader *>(mapping_)->ztable_offset);
+}
+
+const short *TableCache::lookupTable() const
+{
+  return reinterpret_cast<const short *>(mapping_ + reinterpret_cast<const TableCacheHeader *>(mapping_)->lut_offset);
+}
+
+} /* namespace libfreenect2 */
@@ -0,0 +1,108 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+/** @file table_cache.h On-disk cache of the calibration and depth tables of a device. */
+
+#ifndef TABLE_CACHE_H_
+#define TABLE_CACHE_H_
+
+#include <stddef.h>
+#include <string>
+
+#include <include/libfreenect2.h>
+
+namespace libfreenect2
+{
+
+/**
+ * Calibration read from a device at start-up and the depth tables derived
+ * from it, stored in one file per serial number and firmware version.
+ *
+ * A loaded cache maps the file read-only, so the tables are handed to the
+ * depth processor without copying them. The cache directory comes from the
+ * environment variable `LIBFREENECT2_TABLE_CACHE_DIR`; caching is disabled
+ * without it.
+ */
+class TableCache
+{
+public:
+  /**
+   * @param serial Serial number of the device.
+   * @param firmware Firmware version of the device.
+   */
+  TableCache(const std::string &serial, const std::string &firmware);
+
+  /**
+   * Open a cache file of any device by its path, for tools that process
+   * recorded packets. load() takes the device from the file.
+   * @param path Cache file.
+   */
+  explicit TableCache(const std::string &path);
+  ~TableCache();
+
+  /** Whether the cache has a file, from `LIBFREENECT2_TABLE_CACHE_DIR` or a path. */
+  bool enabled() const;
+
+  /**
+   * Map the cache file of the device.
+   * @return false if caching is disabled, or the file is missing or does not match the device.
+   */
+  bool load();
+
+  /**
+   * Write the cache file of the device, replacing the file atomically.
+   * @param ir_params Depth camera parameters.
+   * @param color_params Color camera parameters.
+   * @param p0_tables P0 tables command response.
+   * @param p0_tables_size Size of \a p0_tables, must be sizeof(protocol::P0TablesResponse).
+   * @param xtable, ztable Tables of DepthPacketProcessor::TABLE_SIZE values.
+   * @param lut Table of DepthPacketProcessor::LUT_SIZE values.
+   * @return true on success.
+   */
+  bool store(const Freenect2Device::IrCameraParams &ir_params, const Freenect2Device::ColorCameraParams &color_params,
+             const unsigned char *p0_tables, size_t p0_tables_size, const float *xtable, const float *ztable, const short *lut) const;
+
+  /* Contents of a loaded cache, valid until the cache is destroyed. */
+  const Freenect2Device::IrCameraParams &irCameraParams() const;
+  const Freenect2Device::ColorCameraParams &colorCameraParams() const;
+  const unsigned char *p0Tables() const;
+  size_t p0TablesSize() const;
+  const float *xTable() const;
+  const float *zTable() const;
+  const short *lookupTable() const;
+
+private:
+  std::string path_;         ///< Cache file, empty if caching is disabled.
+  std::string serial_, firmware_;
+  unsigned char *mapping_;   ///< Mapped file, NULL if not loaded.
+  size_t mapping_size_;
+
+  TableCache(const TableCache &);
+  TableCache &operator=(const TableCache &);
+};
+
+} /* namespace libfreenect2 */
+#endif /* TABLE_CACHE_H_ */
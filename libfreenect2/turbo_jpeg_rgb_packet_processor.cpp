@@ -28,21 +28,61 @@
 
 #include <libfreenect2/rgb_packet_processor.h>
 #include <libfreenect2/logging.h>
+#include <libfreenect2/threading.h>
 #include <turbojpeg.h>
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <vector>
+#include <jpeglib.h>
 
 namespace libfreenect2
 {
 
-/** Implementation of the Turbo-Jpeg decoder processor. */
-class TurboJpegRgbPacketProcessorImpl: public WithPerfLogging
+/** libjpeg source reading the JPEG data from the pieces of a scatter-gather packet. */
+struct JpegChunkSource
 {
-public:
+  jpeg_source_mgr pub;
+  const RgbPacketChunk *chunks;
+  size_t num_chunks;
+  size_t next; ///< Index of the next piece to read.
+};
+
+/** libjpeg error handler returning to the decoder instead of exiting. */
+struct JpegError
+{
+  jpeg_error_mgr pub;
+  jmp_buf jump;
+};
 
+/**
+ * A TurboJPEG decompressor with the frame it decodes into. JPEG data split
+ * over several USB transfer buffers is decoded piece by piece with the
+ * libjpeg interface of TurboJPEG, which reads through a source manager.
+ */
+class TurboJpegDecoder: public WithPerfLogging
+{
+public:
   tjhandle decompressor;
 
+  jpeg_decompress_struct chunk_decompressor; ///< Decompressor of split JPEG data, valid if #chunk_decompressor_good.
+  bool chunk_decompressor_good;
+  JpegError chunk_error;
+  JpegChunkSource chunk_source;
+
   Frame *frame;
 
-  TurboJpegRgbPacketProcessorImpl()
+  std::vector<unsigned char> jpeg; ///< JPEG data copied out of the packet buffer for a decoding thread.
+  unsigned char *jpeg_buffer; ///< JPEG data to decode on a thread, NULL if it is in the pieces of #chunks.
+  size_t jpeg_length;         ///< Length of the JPEG data to decode on a thread.
+  std::shared_ptr<RgbPacketChunks> chunks; ///< USB transfer buffers of a scatter-gather packet, kept until it is decoded.
+
+  libfreenect2::FrameListener *listener; ///< Listener of the frame being decoded.
+  bool decoded; ///< Whether the decoding of #frame has finished.
+  bool good;    ///< Whether #frame was decoded successfully.
+
+  TurboJpegDecoder() : chunk_decompressor_good(false), jpeg_buffer(0), jpeg_length(0), listener(0), decoded(false), good(false)
   {
     decompressor = tjInitDecompress();
     if(decompressor == 0)
@@ -50,13 +90,31 @@ public:
       LOG_ERROR << "Failed to initialize TurboJPEG decompressor! TurboJPEG error: '" << tjGetErrorStr() << "'";
     }
 
+    chunk_decompressor.err = jpeg_std_error(&chunk_error.pub);
+    chunk_error.pub.error_exit = onJpegError;
+    chunk_error.pub.output_message = onJpegMessage;
+    if(setjmp(chunk_error.jump) == 0)
+    {
+      jpeg_create_decompress(&chunk_decompressor);
+      chunk_decompressor_good = true;
+    }
+
+    chunk_source.pub.init_source = onInitSource;
+    chunk_source.pub.fill_input_buffer = onFillInputBuffer;
+    chunk_source.pub.skip_input_data = onSkipInputData;
+    chunk_source.pub.resync_to_restart = jpeg_resync_to_restart;
+    chunk_source.pub.term_source = onTermSource;
+
     newFrame();
   }
 
-  ~TurboJpegRgbPacketProcessorImpl()
+  ~TurboJpegDecoder()
   {
     delete frame;
 
+    if(chunk_decompressor_good)
+      jpeg_destroy_decompress(&chunk_decompressor);
+
     if(decompressor != 0)
     {
       if(tjDestroy(decompressor) == -1)
@@ -69,11 +127,333 @@ public:
   void newFrame()
   {
     frame = new Frame(1920 * 1080 * tjPixelSize[TJPF_BGRX]);
-      frame->width = 1920;
+    frame->width = 1920;
     frame->height = 1080;
     frame->bytes_per_pixel = tjPixelSize[TJPF_BGRX];
     frame->format = Frame::BGRX;
   }
+
+  /** Copy the metadata of a packet to #frame. */
+  void setPacket(const RgbPacket &packet)
+  {
+    frame->timestamp = packet.timestamp;
+    frame->sequence = packet.sequence;
+    frame->exposure = packet.exposure;
+    frame->gain = packet.gain;
+    frame->gamma = packet.gamma;
+  }
+
+  /**
+   * Decode JPEG data into #frame.
+   * @return True on success.
+   */
+  bool decode(unsigned char *data, size_t length)
+  {
+    startTiming();
+
+    int r = tjDecompress2(decompressor, data, length, frame->data, 1920, 1920 * tjPixelSize[TJPF_BGRX], 1080, TJPF_BGRX, 0);
+
+    stopTiming(LOG_INFO);
+
+    if(r != 0)
+    {
+      LOG_ERROR << "Failed to decompress rgb image! TurboJPEG error: '" << tjGetErrorStr() << "'";
+    }
+    return r == 0;
+  }
+
+  /**
+   * Decode JPEG data split in pieces into #frame, without gathering them.
+   * @param chunks Pieces of the JPEG data, in order.
+   * @param num_chunks Number of pieces.
+   * @return True on success.
+   */
+  bool decode(const RgbPacketChunk *chunks, size_t num_chunks)
+  {
+    if(!chunk_decompressor_good)
+      return false;
+
+    startTiming();
+
+    chunk_source.chunks = chunks;
+    chunk_source.num_chunks = num_chunks;
+    chunk_source.next = 0;
+    chunk_source.pub.next_input_byte = 0;
+    chunk_source.pub.bytes_in_buffer = 0;
+    chunk_decompressor.src = &chunk_source.pub;
+
+    if(setjmp(chunk_error.jump) != 0)
+    {
+      jpeg_abort_decompress(&chunk_decompressor);
+      stopTiming(LOG_INFO);
+      return false;
+    }
+
+    jpeg_read_header(&chunk_decompressor, TRUE);
+    chunk_decompressor.out_color_space = JCS_EXT_BGRX;
+    jpeg_start_decompress(&chunk_decompressor);
+
+    if(chunk_decompressor.output_width != 1920 || chunk_decompressor.output_height != 1080)
+    {
+      LOG_ERROR << "Unexpected rgb image size " << chunk_decompressor.output_width << "x" << chunk_decompressor.output_height;
+      jpeg_abort_decompress(&chunk_decompressor);
+      stopTiming(LOG_INFO);
+      return false;
+    }
+
+    while(chunk_decompressor.output_scanline < chunk_decompressor.output_height)
+    {
+      JSAMPROW row = frame->data + chunk_decompressor.output_scanline * 1920 * tjPixelSize[TJPF_BGRX];
+      jpeg_read_scanlines(&chunk_decompressor, &row, 1);
+    }
+    jpeg_finish_decompress(&chunk_decompressor);
+
+    stopTiming(LOG_INFO);
+    return true;
+  }
+
+  static void onJpegError(j_common_ptr cinfo)
+  {
+    char message[JMSG_LENGTH_MAX];
+    cinfo->err->format_message(cinfo, message);
+    LOG_ERROR << "Failed to decompress rgb image! libjpeg error: '" << message << "'";
+
+    longjmp(reinterpret_cast<JpegError *>(cinfo->err)->jump, 1);
+  }
+
+  static void onJpegMessage(j_common_ptr cinfo)
+  {
+    char message[JMSG_LENGTH_MAX];
+    cinfo->err->format_message(cinfo, message);
+    LOG_WARNING << "libjpeg: " << message;
+  }
+
+  static void onInitSource(j_decompress_ptr)
+  {
+  }
+
+  /** Move to the next piece of the JPEG data. */
+  static boolean onFillInputBuffer(j_decompress_ptr cinfo)
+  {
+    JpegChunkSource *source = reinterpret_cast<JpegChunkSource *>(cinfo->src);
+
+    if(source->next < source->num_chunks)
+    {
+      source->pub.next_input_byte = source->chunks[source->next].data;
+      source->pub.bytes_in_buffer = source->chunks[source->next].length;
+      source->next++;
+    }
+    else
+    {
+      // truncated data, end the image like the libjpeg memory source does
+      static const JOCTET eoi[2] = { 0xFF, JPEG_EOI };
+      source->pub.next_input_byte = eoi;
+      source->pub.bytes_in_buffer = sizeof(eoi);
+    }
+    return TRUE;
+  }
+
+  static void onSkipInputData(j_decompress_ptr cinfo, long num_bytes)
+  {
+    jpeg_source_mgr *source = cinfo->src;
+    if(num_bytes <= 0)
+      return;
+
+    while(static_cast<size_t>(num_bytes) > source->bytes_in_buffer)
+    {
+      num_bytes -= static_cast<long>(source->bytes_in_buffer);
+      onFillInputBuffer(cinfo);
+    }
+    source->next_input_byte += num_bytes;
+    source->bytes_in_buffer -= num_bytes;
+  }
+
+  static void onTermSource(j_decompress_ptr)
+  {
+  }
+
+  /** Pass #frame to the listener, keeping it if the listener does not take it. */
+  void deliver(libfreenect2::FrameListener *listener)
+  {
+    if(listener->onNewFrame(Frame::Color, frame))
+    {
+      newFrame();
+    }
+  }
+};
+
+/**
+ * Implementation of the Turbo-Jpeg decoder processor.
+ *
+ * With one thread, packets are decoded by the caller of process(). With
+ * more, each thread has its own decoder and process() hands the JPEG data
+ * to a free decoder, so consecutive frames are decoded concurrently.
+ * Scatter-gather packets are decoded from their USB transfer buffers, the
+ * decoder keeps them until it is done. Others are copied out of the packet
+ * buffer, which is reused after process(). Decoders wait in #pending in the order of their packets and
+ * a decoded frame is delivered once the frames before it are, so the
+ * number of decoders bounds the reorder window.
+ */
+class TurboJpegRgbPacketProcessorImpl
+{
+public:
+  std::vector<TurboJpegDecoder *> decoders;
+  std::vector<libfreenect2::thread *> threads; ///< Decoding threads, empty when decoding in process().
+
+  std::deque<TurboJpegDecoder *> idle;    ///< Decoders without a frame.
+  std::deque<TurboJpegDecoder *> queued;  ///< Decoders with a frame waiting for a thread.
+  std::deque<TurboJpegDecoder *> pending; ///< Decoders with a frame not delivered yet, in packet order.
+  bool shutdown;
+
+  libfreenect2::mutex mutex;
+  libfreenect2::mutex delivery_mutex; ///< Held while delivering frames, to keep their order across threads.
+  libfreenect2::condition_variable work_condition; ///< Signals the threads that a decoder was queued.
+  libfreenect2::condition_variable idle_condition; ///< Signals process() that a decoder became idle.
+
+  TurboJpegRgbPacketProcessorImpl() : shutdown(false)
+  {
+    size_t num_threads = 1;
+    const char *threads_env = std::getenv("LIBFREENECT2_RGB_DECODER_THREADS");
+    if(threads_env && std::atoi(threads_env) > 0)
+      num_threads = std::atoi(threads_env);
+
+    for(size_t i = 0; i < num_threads; ++i)
+    {
+      decoders.push_back(new TurboJpegDecoder());
+      idle.push_back(decoders.back());
+    }
+
+    if(num_threads > 1)
+    {
+      LOG_INFO << "decoding on " << num_threads << " threads";
+      for(size_t i = 0; i < num_threads; ++i)
+        threads.push_back(new libfreenect2::thread(&TurboJpegRgbPacketProcessorImpl::static_execute, this));
+    }
+  }
+
+  ~TurboJpegRgbPacketProcessorImpl()
+  {
+    {
+      libfreenect2::lock_guard l(mutex);
+      shutdown = true;
+    }
+    work_condition.notify_all();
+
+    for(size_t i = 0; i < threads.size(); ++i)
+    {
+      threads[i]->join();
+      delete threads[i];
+    }
+
+    for(size_t i = 0; i < decoders.size(); ++i)
+      delete decoders[i];
+  }
+
+  bool good()
+  {
+    return decoders[0]->decompressor != 0;
+  }
+
+  /**
+   * Hand a packet to a decoding thread, waiting for an idle decoder.
+   * The packet buffer can be released afterwards.
+   */
+  void submit(const RgbPacket &packet, libfreenect2::FrameListener *listener)
+  {
+    TurboJpegDecoder *decoder;
+    {
+      libfreenect2::unique_lock l(mutex);
+      while(idle.empty())
+        WAIT_CONDITION(idle_condition, mutex, l);
+
+      decoder = idle.front();
+      idle.pop_front();
+    }
+
+    decoder->setPacket(packet);
+    decoder->listener = listener;
+    decoder->decoded = false;
+    decoder->jpeg_length = packet.jpeg_buffer_length;
+    if(packet.chunks)
+    {
+      decoder->chunks = packet.chunks;
+      decoder->jpeg_buffer = packet.jpeg_buffer;
+    }
+    else
+    {
+      decoder->jpeg.resize(packet.jpeg_buffer_length);
+      RgbPacketProcessor::copyJpeg(packet, decoder->jpeg.data());
+      decoder->jpeg_buffer = decoder->jpeg.data();
+    }
+
+    {
+      libfreenect2::lock_guard l(mutex);
+      pending.push_back(decoder);
+      queued.push_back(decoder);
+    }
+    work_condition.notify_one();
+  }
+
+  static void static_execute(void *data)
+  {
+    static_cast<TurboJpegRgbPacketProcessorImpl *>(data)->execute();
+  }
+
+  /** Decode queued frames and deliver the decoded frames at the front of #pending. */
+  void execute()
+  {
+    this_thread::set_name("TurboJPEG");
+    libfreenect2::unique_lock l(mutex);
+
+    while(!shutdown)
+    {
+      if(queued.empty())
+      {
+        WAIT_CONDITION(work_condition, mutex, l);
+        continue;
+      }
+
+      TurboJpegDecoder *decoder = queued.front();
+      queued.pop_front();
+      l.unlock();
+
+      if(decoder->jpeg_buffer != 0)
+        decoder->good = decoder->decode(decoder->jpeg_buffer, decoder->jpeg_length);
+      else
+        decoder->good = decoder->decode(decoder->chunks->jpeg.data(), decoder->chunks->jpeg.size());
+
+      // give the USB transfer buffers back as soon as possible
+      decoder->chunks.reset();
+
+      l.lock();
+      decoder->decoded = true;
+
+      std::vector<TurboJpegDecoder *> ready;
+      while(!pending.empty() && pending.front()->decoded)
+      {
+        ready.push_back(pending.front());
+        pending.pop_front();
+      }
+
+      if(ready.empty())
+        continue;
+
+      // take the delivery lock before another thread can take the next frames
+      libfreenect2::unique_lock delivery(delivery_mutex);
+      l.unlock();
+
+      for(size_t i = 0; i < ready.size(); ++i)
+        if(ready[i]->good)
+          ready[i]->deliver(ready[i]->listener);
+
+      delivery.unlock();
+      l.lock();
+
+      for(size_t i = 0; i < ready.size(); ++i)
+        idle.push_back(ready[i]);
+      idle_condition.notify_one();
+    }
+  }
 };
 
 TurboJpegRgbPacketProcessor::TurboJpegRgbPacketProcessor() :
@@ -88,32 +468,26 @@ TurboJpegRgbPacketProcessor::~TurboJpegRgbPacketProcessor()
 
 void TurboJpegRgbPacketProcessor::process(const RgbPacket &packet)
 {
-  if(impl_->decompressor != 0 && listener_ != 0)
+  if(impl_->good() && listener_ != 0)
   {
-    impl_->startTiming();
-
-    impl_->frame->timestamp = packet.timestamp;
-    impl_->frame->sequence = packet.sequence;
-    impl_->frame->exposure = packet.exposure;
-    impl_->frame->gain = packet.gain;
-    impl_->frame->gamma = packet.gamma;
-
-    int r = tjDecompress2(impl_->decompressor, packet.jpeg_buffer, packet.jpeg_buffer_length, impl_->frame->data, 1920, 1920 * tjPixelSize[TJPF_BGRX], 1080, TJPF_BGRX, 0);
-
-    impl_->stopTiming(LOG_INFO);
-
-    if(r == 0)
+    if(!impl_->threads.empty())
     {
-      if(listener_->onNewFrame(Frame::Color, impl_->frame))
-      {
-        impl_->newFrame();
-      }
+      impl_->submit(packet, listener_);
+      return;
     }
+
+    TurboJpegDecoder *decoder = impl_->decoders[0];
+    decoder->setPacket(packet);
+
+    // a JPEG spanning several USB transfer buffers is read from them in place
+    bool good;
+    if(packet.jpeg_buffer != 0)
+      good = decoder->decode(packet.jpeg_buffer, packet.jpeg_buffer_length);
     else
-    {
-      LOG_ERROR << "Failed to decompress rgb image! TurboJPEG error: '" << tjGetErrorStr() << "'";
-    }
+      good = decoder->decode(packet.chunks->jpeg.data(), packet.chunks->jpeg.size());
 
+    if(good)
+      decoder->deliver(listener_);
   }
 }
 
@@ -35,6 +35,16 @@ namespace libfreenect2 {
 namespace usb {
     
     
+    /** Keeps a transfer buffer from being reused, see DataCallback::onBufferReceived(). */
+    class DataReference
+    {
+    public:
+        virtual ~DataReference() {}
+        
+        /** Give the buffer back to its transfer pool and delete the reference. */
+        virtual void release() = 0;
+    };
+    
     class DataCallback
     {
     public:
@@ -44,6 +54,28 @@ namespace usb {
          * @param n Size of the new data.
          */
         virtual void onDataReceived(unsigned char *buffer, size_t n) = 0;
+        
+        /**
+         * Whether the callback may keep transfer buffers. Bulk transfer pools only
+         * call onBufferReceived() with a reference when this is true, otherwise
+         * onDataReceived() and the buffer is reused right away.
+         */
+        virtual bool keepsBuffers() const { return false; }
+        
+        /**
+         * Callback that new data has arrived in a buffer the callback may keep.
+         * The transfer pool only reuses the buffer after @p reference is released,
+         * from any thread. By default the data is passed to onDataReceived() and
+         * the buffer is released right away.
+         * @param buffer Buffer with new data.
+         * @param n Size of the new data.
+         * @param reference Reference to release once @p buffer is no longer needed.
+         */
+        virtual void onBufferReceived(unsigned char *buffer, size_t n, DataReference *reference)
+        {
+            onDataReceived(buffer, n);
+            reference->release();
+        }
     };
     
 } /* namespace usb */
@@ -37,10 +37,32 @@ namespace libfreenect2
 namespace usb
 {
 
+    /** Reference returning a buffer kept by the callback to the available buffers. */
+    class TransferPool::BufferReference : public DataReference
+    {
+    public:
+        BufferReference(const std::shared_ptr<SyncBufferQueue> &queue, std::unique_ptr<Buffer> buffer) :
+            _queue(queue),
+            _buffer(std::move(buffer))
+        {}
+        
+        virtual void release()
+        {
+            _queue->push_back_move(std::move(_buffer));
+            delete this;
+        }
+        
+    private:
+        std::shared_ptr<SyncBufferQueue> _queue;
+        std::unique_ptr<Buffer> _buffer;
+    };
+    
+    
     TransferPool::TransferPool(libusb_device_handle* deviceHandle, unsigned char deviceEndpoint) :
         _enableSubmit(false),
         _enableThreads(false),
         _callback(nullptr),
+        _avalaibleBuffers(std::make_shared<SyncBufferQueue>()),
         _deviceHandle(deviceHandle),
         _deviceEndpoint(deviceEndpoint),
         _proccessThread(nullptr),
@@ -72,7 +94,7 @@ namespace usb
     {
         for (size_t i = 0; i < (10 * num_transfers); ++i)
         {
-            _avalaibleBuffers.push_back_move(allocateBuffer());
+            _avalaibleBuffers->push_back_move(allocateBuffer());
         }
         
         for (size_t i = 0; i < num_transfers; ++i)
@@ -173,7 +195,7 @@ namespace usb
 
         _submitTransfers.clear();
         _proccessBuffers.clear();
-        _avalaibleBuffers.clear();
+        _avalaibleBuffers->clear();
         
         if (_proccessThread != nullptr)
         {
@@ -230,14 +252,14 @@ namespace usb
             
             if (_enableSubmit)
             {
-                if (_avalaibleBuffers.empty())
+                if (_avalaibleBuffers->empty())
                 {
-                    _avalaibleBuffers.push_back_move(allocateBuffer());
+                    _avalaibleBuffers->push_back_move(allocateBuffer());
                     LOG_INFO << "need more memory!!!!";
                 }
                 
                 {
-                    auto pointerBuffer = _avalaibleBuffers.pop_front_out();
+                    auto pointerBuffer = _avalaibleBuffers->pop_front_out();
                     pointer->transfer->buffer = pointerBuffer->buffer;
                     pointer->buffer = std::move(pointerBuffer);
                 }
@@ -267,8 +289,9 @@ namespace usb
         {
             auto pointer = _proccessBuffers.pop_front_out();
 
-            proccessBuffer(pointer.get());
-            _avalaibleBuffers.push_back_move(std::move(pointer));
+            proccessBuffer(pointer);
+            if (pointer)
+                _avalaibleBuffers->push_back_move(std::move(pointer));
         }
         LOG_INFO << "execute thread exit";
     }
@@ -306,12 +329,21 @@ namespace usb
     }
 
     
-    void BulkTransferPool::proccessBuffer(libfreenect2::usb::TransferPool::Buffer *buffer)
+    void BulkTransferPool::proccessBuffer(std::unique_ptr<Buffer> &buffer)
     {
         if (!buffer->actualStatusCompleted[0]) return;
 
         if (_callback)
-            _callback->onDataReceived(buffer->buffer, buffer->actualLength[0]);
+        {
+            unsigned char *data = buffer->buffer;
+            size_t length = buffer->actualLength[0];
+            
+            // a reference is only needed by callbacks keeping the buffer
+            if (_callback->keepsBuffers())
+                _callback->onBufferReceived(data, length, new BufferReference(_avalaibleBuffers, std::move(buffer)));
+            else
+                _callback->onDataReceived(data, length);
+        }
     }
 
 
@@ -356,7 +388,7 @@ namespace usb
     }
 
     
-    void IsoTransferPool::proccessBuffer(libfreenect2::usb::TransferPool::Buffer *buffer)
+    void IsoTransferPool::proccessBuffer(std::unique_ptr<Buffer> &buffer)
     {
         unsigned char *ptr = buffer->buffer;
         for(size_t i = 0; i < _numPackets; ++i)
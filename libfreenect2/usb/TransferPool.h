@@ -28,6 +28,7 @@
 #define TRANSFER_POOL_H_
 
 #include <atomic>
+#include <memory>
 #include <vector>
 #include <queue>
 #include <string>
@@ -140,7 +141,10 @@ namespace usb {
         
         typedef Collection<std::deque<std::unique_ptr<Buffer>>> SyncBufferQueue;
         SyncBufferQueue _proccessBuffers;
-        SyncBufferQueue _avalaibleBuffers;
+        /** Shared with the references of buffers kept by the callback, which may outlive the pool. */
+        std::shared_ptr<SyncBufferQueue> _avalaibleBuffers;
+        
+        class BufferReference;
         
         
         void allocate(size_t numTransfers, size_t transferSize);
@@ -148,7 +152,11 @@ namespace usb {
         virtual std::unique_ptr<Transfer> allocateTransfer() = 0;
         virtual std::unique_ptr<Buffer> allocateBuffer() = 0;
         virtual void processTransfer(Transfer *transfer) = 0;
-        virtual void proccessBuffer(Buffer* buffer) = 0;
+        /**
+         * Pass the data of a completed transfer to the callback.
+         * @param buffer Buffer of the transfer, moved out if the callback keeps it.
+         */
+        virtual void proccessBuffer(std::unique_ptr<Buffer> &buffer) = 0;
         
         virtual const char *poolName(std::string suffix) = 0;
         
@@ -183,7 +191,7 @@ namespace usb {
         virtual std::unique_ptr<Buffer> allocateBuffer();
         
         virtual void processTransfer(Transfer *transfer);
-        virtual void proccessBuffer(Buffer* buffer);
+        virtual void proccessBuffer(std::unique_ptr<Buffer> &buffer);
         
         
         virtual const char *poolName(std::string suffix) { return (std::string("BULK USB ") + suffix).c_str(); };
@@ -210,7 +218,7 @@ namespace usb {
         virtual std::unique_ptr<Buffer> allocateBuffer();
         
         virtual void processTransfer(Transfer *transfer);
-        virtual void proccessBuffer(Buffer* buffer);
+        virtual void proccessBuffer(std::unique_ptr<Buffer> &buffer);
         
         virtual const char *poolName(std::string suffix) { return (std::string("ISO USB ") + suffix).c_str(); };
         
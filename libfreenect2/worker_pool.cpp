@@ -0,0 +1,133 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+/** @file worker_pool.cpp Pool of threads for data-parallel processing. */
+
+#include <libfreenect2/worker_pool.h>
+
+namespace libfreenect2
+{
+
+WorkerPool::WorkerPool(size_t num_threads) :
+    task_(0),
+    num_tasks_(0),
+    next_task_(0),
+    unfinished_(0),
+    shutdown_(false)
+{
+  if(num_threads == 0)
+    num_threads = libfreenect2::thread::hardware_concurrency();
+
+  // the calling thread takes part in every job
+  for(size_t i = 1; i < num_threads; ++i)
+    threads_.push_back(new libfreenect2::thread(&WorkerPool::static_execute, this));
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    libfreenect2::lock_guard l(mutex_);
+    shutdown_ = true;
+  }
+  work_condition_.notify_all();
+
+  for(size_t i = 0; i < threads_.size(); ++i)
+  {
+    threads_[i]->join();
+    delete threads_[i];
+  }
+}
+
+size_t WorkerPool::size() const
+{
+  return threads_.size() + 1;
+}
+
+void WorkerPool::run(size_t num_tasks, const Task &task)
+{
+  if(threads_.empty() || num_tasks < 2)
+  {
+    for(size_t i = 0; i < num_tasks; ++i)
+      task(i);
+    return;
+  }
+
+  libfreenect2::unique_lock l(mutex_);
+  task_ = &task;
+  num_tasks_ = num_tasks;
+  next_task_ = 0;
+  unfinished_ = num_tasks;
+  work_condition_.notify_all();
+
+  while(executeNext(l)) {}
+
+  while(unfinished_ != 0)
+    WAIT_CONDITION(done_condition_, mutex_, l);
+
+  task_ = 0;
+}
+
+/**
+ * Claim and execute one task of the current job.
+ * @param l Lock on #mutex_, released while the task executes.
+ * @return false if there was no unclaimed task.
+ */
+bool WorkerPool::executeNext(libfreenect2::unique_lock &l)
+{
+  if(task_ == 0 || next_task_ >= num_tasks_)
+    return false;
+
+  const Task &task = *task_;
+  size_t i = next_task_++;
+
+  l.unlock();
+  task(i);
+  l.lock();
+
+  if(--unfinished_ == 0)
+    done_condition_.notify_one();
+
+  return true;
+}
+
+void WorkerPool::static_execute(void *data)
+{
+  static_cast<WorkerPool *>(data)->execute();
+}
+
+void WorkerPool::execute()
+{
+  this_thread::set_name("WorkerPool");
+  libfreenect2::unique_lock l(mutex_);
+
+  while(!shutdown_)
+  {
+    if(!executeNext(l))
+      WAIT_CONDITION(work_condition_, mutex_, l);
+  }
+}
+
+} /* namespace libfreenect2 */
@@ -0,0 +1,93 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+/** @file worker_pool.h Pool of threads for data-parallel processing. */
+
+#ifndef WORKER_POOL_H_
+#define WORKER_POOL_H_
+
+#include <stddef.h>
+#include <functional>
+#include <vector>
+
+#include <libfreenect2/threading.h>
+
+namespace libfreenect2
+{
+
+/**
+ * Fixed set of threads executing data-parallel jobs.
+ *
+ * A job is split into independent tasks identified by their index. run()
+ * distributes the tasks to the worker threads and the calling thread, and
+ * returns only after all tasks are finished, so consecutive jobs are
+ * separated by a barrier.
+ */
+class WorkerPool
+{
+public:
+  typedef std::function<void(size_t)> Task;
+
+  /**
+   * @param num_threads Total number of threads including the calling thread.
+   * 0 uses one thread per hardware thread.
+   */
+  WorkerPool(size_t num_threads);
+  ~WorkerPool();
+
+  /** Number of threads executing tasks, including the calling thread. */
+  size_t size() const;
+
+  /**
+   * Execute task(0) ... task(num_tasks - 1) and wait for all of them.
+   * Must not be called from within a task.
+   */
+  void run(size_t num_tasks, const Task &task);
+
+private:
+  std::vector<libfreenect2::thread *> threads_;
+
+  libfreenect2::mutex mutex_;
+  libfreenect2::condition_variable work_condition_; ///< Signals workers that tasks are available.
+  libfreenect2::condition_variable done_condition_; ///< Signals run() that the last task finished.
+
+  const Task *task_;   ///< Current job, NULL when idle.
+  size_t num_tasks_;   ///< Number of tasks in the current job.
+  size_t next_task_;   ///< Index of the next unclaimed task.
+  size_t unfinished_;  ///< Number of tasks not yet finished.
+  bool shutdown_;
+
+  static void static_execute(void *data);
+  void execute();
+  bool executeNext(libfreenect2::unique_lock &l);
+
+  /* Disable copy and assignment constructors */
+  WorkerPool(const WorkerPool&);
+  WorkerPool& operator=(const WorkerPool&);
+};
+
+} /* namespace libfreenect2 */
+#endif /* WORKER_POOL_H_ */
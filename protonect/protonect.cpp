@@ -92,6 +92,7 @@ int main(int argc, char *argv[])
     std::cerr << "Usage: " << program_path << " [<device serial>]" << std::endl;
     std::cerr << "        [-norgb | -nodepth] [-help] [-version]" << std::endl;
     std::cerr << "        [-frames <number of frames to process>]" << std::endl;
+    std::cerr << "        [-threads <number of depth processing threads, 0 for all>]" << std::endl;
     std::cerr << "To pause and unpause: pkill -USR1 protonect" << std::endl;
     size_t executable_name_idx = program_path.rfind("protonect");
 
@@ -119,6 +120,7 @@ int main(int argc, char *argv[])
     bool enable_depth = true;
     bool enable_registration = true;
     size_t framemax = -1;
+    size_t num_threads = 1;
     
     for(int argI = 1; argI < argc; ++argI)
     {
@@ -158,6 +160,11 @@ int main(int argc, char *argv[])
                 return -1;
             }
         }
+        else if(arg == "-threads")
+        {
+            ++argI;
+            num_threads = strtol(argv[argI], NULL, 0);
+        }
         else
         {
             std::cout << "Unknown argument: " << arg << std::endl;
@@ -216,6 +223,13 @@ int main(int argc, char *argv[])
     dev->setIrAndDepthFrameListener(&listener);
     /// [listeners]
     
+    libfreenect2::Freenect2Device::Config config;
+    config.NumThreads = num_threads;
+    dev->setConfiguration(config);
+    
+    // start-up time, the first frames include the depth frame unless it is disabled
+    auto startTime = std::chrono::high_resolution_clock::now();
+    
     /// [start]
     if (enable_rgb && enable_depth)
     {
@@ -228,6 +242,8 @@ int main(int argc, char *argv[])
             return -1;
     }
     
+    auto startedTime = std::chrono::high_resolution_clock::now();
+    
     std::cout << "device serial: " << dev->getSerialNumber() << std::endl;
     std::cout << "device firmware: " << dev->getFirmwareVersion() << std::endl;
     /// [start]
@@ -272,6 +288,13 @@ int main(int argc, char *argv[])
         libfreenect2::Frame *depth = frames[libfreenect2::Frame::Depth];
         /// [loop start]
         
+        if (framecount == 0)
+        {
+            auto firstFrameTime = std::chrono::high_resolution_clock::now();
+            std::cout << "Time of start() in milliseconds :: " << std::chrono::duration_cast<std::chrono::milliseconds>(startedTime - startTime).count() << std::endl;
+            std::cout << "Time from start() to first frames in milliseconds :: " << std::chrono::duration_cast<std::chrono::milliseconds>(firstFrameTime - startTime).count() << std::endl;
+        }
+        
         if (enable_rgb && enable_depth && enable_registration)
         {
             /// [registration]
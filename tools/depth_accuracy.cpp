@@ -0,0 +1,246 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+/** @file depth_accuracy.cpp Depth error of the approximations of the CPU depth processor. */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <include/libfreenect2.h>
+#include <libfreenect2/depth_packet_processor.h>
+#include <libfreenect2/logging.h>
+
+#include "recording.h"
+
+/** Depth differences of an approximated processor to the exact one, over all packets. */
+struct DepthError
+{
+    float max;
+    double sum;
+    size_t valid_pixels;        ///< Pixels valid in both outputs.
+    size_t validity_mismatches; ///< Pixels valid in only one output.
+    size_t pixels;
+
+    DepthError() : max(0.0f), sum(0.0), valid_pixels(0), validity_mismatches(0), pixels(0) {}
+
+    void add(const std::vector<float> &approx, const std::vector<float> &exact)
+    {
+        for(size_t i = 0; i < exact.size(); ++i)
+        {
+            if((approx[i] > 0.0f) != (exact[i] > 0.0f))
+            {
+                ++validity_mismatches;
+            }
+            else if(exact[i] > 0.0f)
+            {
+                const float error = std::abs(approx[i] - exact[i]);
+                max = std::max(max, error);
+                sum += error;
+                ++valid_pixels;
+            }
+        }
+        pixels += exact.size();
+    }
+};
+
+static double milliseconds(std::chrono::high_resolution_clock::duration d)
+{
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+int main(int argc, char *argv[])
+{
+    std::string program_path(argv[0]);
+    std::cerr << "Usage: " << program_path << " <table cache file> <depth packet files...>" << std::endl;
+    std::cerr << "        [-fastmath] [-dealiaslut] [-fixed]" << std::endl;
+    std::cerr << "        [-kernels auto|scalar|sse4.1|avx2|neon] [-bilateral] [-edge]" << std::endl;
+    std::cerr << "        [-threads <number of threads, 0 for all>]" << std::endl;
+    std::cerr << "Compares the depth computed with the selected approximations to the exact computation." << std::endl;
+
+    libfreenect2::setGlobalLogger(libfreenect2::createConsoleLogger(libfreenect2::Logger::Warning));
+
+    typedef libfreenect2::Freenect2Device::Config Config;
+    Config config;
+    bool fast_math = false, dealias_lut = false, fixed_point = false;
+    std::vector<std::string> files;
+
+    for(int argI = 1; argI < argc; ++argI)
+    {
+        const std::string arg(argv[argI]);
+
+        if(arg == "-help" || arg == "--help" || arg == "-h")
+        {
+            return 0;
+        }
+        else if(arg == "-fastmath")
+        {
+            fast_math = true;
+        }
+        else if(arg == "-dealiaslut")
+        {
+            dealias_lut = true;
+        }
+        else if(arg == "-fixed")
+        {
+            fixed_point = true;
+        }
+        else if(arg == "-kernels" && argI + 1 < argc)
+        {
+            const std::string name(argv[++argI]);
+            if(name == "auto")
+                config.DepthKernels = Config::AutoKernels;
+            else if(name == "scalar")
+                config.DepthKernels = Config::ScalarKernels;
+            else if(name == "sse4.1")
+                config.DepthKernels = Config::Sse41Kernels;
+            else if(name == "avx2")
+                config.DepthKernels = Config::Avx2Kernels;
+            else if(name == "neon")
+                config.DepthKernels = Config::NeonKernels;
+            else
+            {
+                std::cerr << "unknown kernels '" << name << "'" << std::endl;
+                return -1;
+            }
+        }
+        else if(arg == "-bilateral")
+        {
+            config.EnableBilateralFilter = true;
+        }
+        else if(arg == "-edge")
+        {
+            config.EnableEdgeAwareFilter = true;
+        }
+        else if(arg == "-threads" && argI + 1 < argc)
+        {
+            config.NumThreads = strtol(argv[++argI], NULL, 0);
+        }
+        else if(arg[0] == '-')
+        {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            return -1;
+        }
+        else
+        {
+            files.push_back(arg);
+        }
+    }
+
+    if(files.size() < 2)
+    {
+        std::cerr << "a table cache file and at least one depth packet file are needed" << std::endl;
+        return -1;
+    }
+    if(!fast_math && !dealias_lut && !fixed_point)
+    {
+        std::cerr << "no approximation selected" << std::endl;
+        return -1;
+    }
+    if(fixed_point && (fast_math || dealias_lut))
+    {
+        std::cerr << "the fixed-point processor is compared on its own" << std::endl;
+        return -1;
+    }
+
+    Recording recording;
+    if(!recording.load(files[0], std::vector<std::string>(files.begin() + 1, files.end())))
+        return -1;
+
+    // only the per-pixel stage 2 takes the dealiasing table, the SIMD kernels keep computing
+    if(dealias_lut && config.DepthKernels != Config::ScalarKernels)
+    {
+        std::cerr << "the dealiasing table is compared with scalar kernels" << std::endl;
+        config.DepthKernels = Config::ScalarKernels;
+    }
+
+    // the fixed-point processor has no filters
+    if(fixed_point && (config.EnableBilateralFilter || config.EnableEdgeAwareFilter))
+    {
+        std::cerr << "the fixed-point processor is compared without filters" << std::endl;
+        config.EnableBilateralFilter = false;
+        config.EnableEdgeAwareFilter = false;
+    }
+
+    Config approx_config = config;
+    approx_config.EnableFastMath = fast_math;
+    approx_config.EnableDealiasingLut = dealias_lut;
+
+    libfreenect2::CpuDepthPacketProcessor exact;
+    libfreenect2::DepthPacketProcessor *approx;
+    if(fixed_point)
+        approx = new libfreenect2::CpuFixedDepthPacketProcessor();
+    else
+        approx = new libfreenect2::CpuDepthPacketProcessor();
+    DepthCapture exact_depth, approx_depth;
+
+    exact.setFrameListener(&exact_depth);
+    exact.setConfiguration(config);
+    recording.loadTables(exact);
+
+    approx->setFrameListener(&approx_depth);
+    approx->setConfiguration(approx_config);
+    recording.loadTables(*approx);
+
+    DepthError error;
+    std::chrono::high_resolution_clock::duration exact_time(0), approx_time(0);
+
+    for(size_t i = 0; i < recording.size(); ++i)
+    {
+        const libfreenect2::DepthPacket packet = recording.packet(i);
+
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        exact.process(packet);
+        std::chrono::high_resolution_clock::time_point middle = std::chrono::high_resolution_clock::now();
+        approx->process(packet);
+        std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+
+        exact_time += middle - start;
+        approx_time += end - middle;
+        if(exact_depth.depth.size() != approx_depth.depth.size())
+        {
+            std::cerr << "packet " << i << " was not processed" << std::endl;
+            delete approx;
+            return -1;
+        }
+        error.add(approx_depth.depth, exact_depth.depth);
+    }
+
+    std::cout << "packets: " << recording.size() << std::endl;
+    std::cout << "exact: " << milliseconds(exact_time) / recording.size() << "ms per packet" << std::endl;
+    std::cout << "approximated: " << milliseconds(approx_time) / recording.size() << "ms per packet" << std::endl;
+    std::cout << "depth error: max " << error.max << "mm, mean "
+              << (error.valid_pixels > 0 ? error.sum / error.valid_pixels : 0.0) << "mm, "
+              << 100.0 * error.validity_mismatches / error.pixels << "% pixels valid in only one output" << std::endl;
+
+    delete approx;
+
+    return 0;
+}
@@ -0,0 +1,317 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+/** @file depth_benchmark.cpp Timing of the CPU depth processor and its parts on recorded packets. */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <include/libfreenect2.h>
+#include <libfreenect2/depth_packet_processor.h>
+#include <libfreenect2/cpu_depth_kernels.h>
+#include <libfreenect2/logging.h>
+
+#include "recording.h"
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double milliseconds(Clock::duration d)
+{
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+/** Sub-images of a packet used by the processor; the 10th is not used. */
+static const int NUM_MEASUREMENTS = 9;
+
+/**
+ * Decode one measurement of a packet on its own, the way the first CPU
+ * processor did. Reference for the bulk unpacker.
+ */
+static int16_t decodePixelMeasurement(const unsigned char *data, const short *lut11to16, int sub, int x, int y)
+{
+    if(x < 1 || y < 0 || 510 < x || 423 < y)
+    {
+        return lut11to16[0];
+    }
+
+    int r1zi = (x >> 2) + ((x & 0x3) << 7); // Range 1..510
+    r1zi = r1zi * 11L; // Range 11..5610
+
+    // 298496 = 512 * 424 * 11 / 8 = number of bytes per sub image
+    const uint16_t *ptr = reinterpret_cast<const uint16_t *>(data + 298496 * sub);
+    int i = y < 212 ? y + 212 : 423 - y;
+    ptr += 352*i;
+
+    int r1yi = r1zi >> 4; // Range 0..350
+    r1zi = r1zi & 15;
+
+    int i1 = ptr[r1yi];
+    int i2 = ptr[r1yi + 1];
+    i1 = i1 >> r1zi;
+    i2 = i2 << (16 - r1zi);
+
+    return lut11to16[((i1 | i2) & 2047)];
+}
+
+/**
+ * Time unpackDepthRow() against decodePixelMeasurement() on all packets,
+ * both decoding whole packets serially.
+ * @return false if they disagree.
+ */
+static bool benchmarkUnpacker(Recording &recording)
+{
+    const short *lut = recording.tables().lookupTable();
+    const int16_t *lut11to16 = reinterpret_cast<const int16_t *>(lut);
+    std::vector<int16_t> bulk(NUM_MEASUREMENTS * 424 * 512), per_pixel(bulk.size());
+    Clock::duration bulk_time(0), per_pixel_time(0);
+    bool equal = true;
+
+    for(size_t i = 0; i < recording.size(); ++i)
+    {
+        const unsigned char *data = recording.packet(i).buffer;
+
+        Clock::time_point start = Clock::now();
+        for(int sub = 0; sub < NUM_MEASUREMENTS; ++sub)
+            for(int y = 0; y < 424; ++y)
+                libfreenect2::unpackDepthRow(data + 298496 * sub + 704 * (y < 212 ? y + 212 : 423 - y), lut11to16, &bulk[(sub * 424 + y) * 512]);
+        Clock::time_point middle = Clock::now();
+        for(int sub = 0; sub < NUM_MEASUREMENTS; ++sub)
+            for(int y = 0; y < 424; ++y)
+                for(int x = 0; x < 512; ++x)
+                    per_pixel[(sub * 424 + y) * 512 + x] = decodePixelMeasurement(data, lut, sub, x, y);
+        Clock::time_point end = Clock::now();
+
+        bulk_time += middle - start;
+        per_pixel_time += end - middle;
+        equal = equal && bulk == per_pixel;
+    }
+
+    std::cout << "bulk unpacker: " << milliseconds(bulk_time) / recording.size() << "ms per packet" << std::endl;
+    std::cout << "per-pixel decoder: " << milliseconds(per_pixel_time) / recording.size() << "ms per packet" << std::endl;
+    if(!equal)
+        std::cerr << "bulk unpacker and per-pixel decoder disagree" << std::endl;
+    return equal;
+}
+
+/**
+ * Get the minor page faults of the process so far (all threads).
+ * @return Number of page faults, or 0 if not supported.
+ */
+static long minorPageFaults()
+{
+#ifndef _WIN32
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) == 0)
+        return usage.ru_minflt;
+#endif
+    return 0;
+}
+
+/** Listener dropping the depth frames, so the timing does not include copies. */
+class DiscardDepth : public libfreenect2::FrameListener
+{
+public:
+    virtual bool onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame *frame) { return false; }
+    virtual unsigned int frameTypes() const { return libfreenect2::Frame::Depth; }
+};
+
+/**
+ * Time the processing of all packets with a configuration, and count the
+ * page faults of the processing with the persistent intermediate buffers.
+ */
+static void benchmarkProcessing(Recording &recording, const libfreenect2::Freenect2Device::Config &config, int repeat)
+{
+    libfreenect2::CpuDepthPacketProcessor processor;
+    DiscardDepth depth;
+
+    processor.setFrameListener(&depth);
+    processor.setConfiguration(config);
+    recording.loadTables(processor);
+
+    // cos and sin of the P0 offsets, or of the 3 phase sums, for each frequency
+    const size_t trig_table_size = (config.EnableCompactTrigTables ? 2 : 6) * 3 * 512 * 424 * sizeof(float);
+    std::cout << (config.EnableCompactTrigTables ? "compact" : "full") << " trigonometry tables: "
+              << trig_table_size / 1024 << "KB read per packet" << std::endl;
+
+    // the first packet warms up the caches and the threads
+    processor.process(recording.packet(0));
+
+    const long faults_before = minorPageFaults();
+    Clock::time_point start = Clock::now();
+    for(int r = 0; r < repeat; ++r)
+        for(size_t i = 0; i < recording.size(); ++i)
+            processor.process(recording.packet(i));
+    Clock::duration time = Clock::now() - start;
+    const double packets = double(repeat * recording.size());
+
+    std::cout << "processing: " << milliseconds(time) / packets << "ms, "
+              << (minorPageFaults() - faults_before) / packets << " page faults per packet" << std::endl;
+}
+
+/**
+ * Time allocating, touching and freeing buffers of the size of the
+ * intermediate buffers of the processor, what processing would cost in
+ * addition if it allocated them for each packet instead of once.
+ */
+static void benchmarkAllocation(const libfreenect2::Freenect2Device::Config &config, int packets)
+{
+    // IR a, IR b and amplitude of each frequency, the filtered IR a and IR b, raw depth and IR sum
+    const size_t num_planes = 9 + (config.EnableBilateralFilter ? 6 : 0) + (config.EnableEdgeAwareFilter ? 3 : 0);
+
+    // read back, so the compiler keeps the allocations
+    volatile float sink = 0.0f;
+
+    const long faults_before = minorPageFaults();
+    Clock::time_point start = Clock::now();
+    for(int i = 0; i < packets; ++i)
+    {
+        std::vector<float> planes(num_planes * 512 * 424);
+        std::vector<unsigned char> max_edge_test(512 * 424);
+        sink = sink + planes.back() + max_edge_test.back();
+    }
+    Clock::duration time = Clock::now() - start;
+
+    std::cout << "per-packet buffer allocation: " << milliseconds(time) / packets << "ms, "
+              << double(minorPageFaults() - faults_before) / packets << " page faults per packet more" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string program_path(argv[0]);
+    std::cerr << "Usage: " << program_path << " <table cache file> <depth packet files...>" << std::endl;
+    std::cerr << "        [-unpacker | -allocation] [-trig compact|full]" << std::endl;
+    std::cerr << "        [-kernels auto|scalar|sse4.1|avx2|neon] [-bilateral] [-edge]" << std::endl;
+    std::cerr << "        [-threads <number of threads, 0 for all>] [-repeat <number of passes>]" << std::endl;
+    std::cerr << "Times the CPU depth processing of recorded packets, or one of its parts." << std::endl;
+
+    libfreenect2::setGlobalLogger(libfreenect2::createConsoleLogger(libfreenect2::Logger::Warning));
+
+    typedef libfreenect2::Freenect2Device::Config Config;
+    Config config;
+    bool unpacker = false, allocation = false;
+    int repeat = 10;
+    std::vector<std::string> files;
+
+    for(int argI = 1; argI < argc; ++argI)
+    {
+        const std::string arg(argv[argI]);
+
+        if(arg == "-help" || arg == "--help" || arg == "-h")
+        {
+            return 0;
+        }
+        else if(arg == "-unpacker")
+        {
+            unpacker = true;
+        }
+        else if(arg == "-allocation")
+        {
+            allocation = true;
+        }
+        else if(arg == "-trig" && argI + 1 < argc)
+        {
+            const std::string layout(argv[++argI]);
+            if(layout != "compact" && layout != "full")
+            {
+                std::cerr << "unknown trigonometry table layout '" << layout << "'" << std::endl;
+                return -1;
+            }
+            config.EnableCompactTrigTables = layout == "compact";
+        }
+        else if(arg == "-kernels" && argI + 1 < argc)
+        {
+            const std::string name(argv[++argI]);
+            if(name == "auto")
+                config.DepthKernels = Config::AutoKernels;
+            else if(name == "scalar")
+                config.DepthKernels = Config::ScalarKernels;
+            else if(name == "sse4.1")
+                config.DepthKernels = Config::Sse41Kernels;
+            else if(name == "avx2")
+                config.DepthKernels = Config::Avx2Kernels;
+            else if(name == "neon")
+                config.DepthKernels = Config::NeonKernels;
+            else
+            {
+                std::cerr << "unknown kernels '" << name << "'" << std::endl;
+                return -1;
+            }
+        }
+        else if(arg == "-bilateral")
+        {
+            config.EnableBilateralFilter = true;
+        }
+        else if(arg == "-edge")
+        {
+            config.EnableEdgeAwareFilter = true;
+        }
+        else if(arg == "-threads" && argI + 1 < argc)
+        {
+            config.NumThreads = strtol(argv[++argI], NULL, 0);
+        }
+        else if(arg == "-repeat" && argI + 1 < argc)
+        {
+            repeat = std::max(int(strtol(argv[++argI], NULL, 0)), 1);
+        }
+        else if(arg[0] == '-')
+        {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            return -1;
+        }
+        else
+        {
+            files.push_back(arg);
+        }
+    }
+
+    if(files.size() < 2)
+    {
+        std::cerr << "a table cache file and at least one depth packet file are needed" << std::endl;
+        return -1;
+    }
+
+    Recording recording;
+    if(!recording.load(files[0], std::vector<std::string>(files.begin() + 1, files.end())))
+        return -1;
+
+    std::cout << "packets: " << recording.size() << std::endl;
+
+    if(unpacker)
+        return benchmarkUnpacker(recording) ? 0 : -1;
+
+    benchmarkProcessing(recording, config, repeat);
+    if(allocation)
+        benchmarkAllocation(config, repeat * int(recording.size()));
+    return 0;
+}
@@ -0,0 +1,103 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+/** @file recording.cpp Recorded depth packets for the offline tools. */
+
+#include "recording.h"
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+// 298496 = 512 * 424 * 11 / 8 = number of bytes per sub image
+static const size_t PACKET_SIZE = 10 * 298496;
+
+Recording::Recording() :
+    tables_(0)
+{
+}
+
+Recording::~Recording()
+{
+    delete tables_;
+}
+
+bool Recording::load(const std::string &table_cache, const std::vector<std::string> &packet_files)
+{
+    delete tables_;
+    tables_ = new libfreenect2::TableCache(table_cache);
+    if(!tables_->load())
+    {
+        std::cerr << "cannot load table cache '" << table_cache << "'" << std::endl;
+        return false;
+    }
+
+    packets_.clear();
+    for(size_t i = 0; i < packet_files.size(); ++i)
+    {
+        std::ifstream file(packet_files[i].c_str(), std::ios::binary);
+        std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        if(data.size() < PACKET_SIZE)
+        {
+            std::cerr << "'" << packet_files[i] << "' is not a depth packet" << std::endl;
+            return false;
+        }
+        packets_.push_back(data);
+    }
+    return true;
+}
+
+void Recording::loadTables(libfreenect2::DepthPacketProcessor &processor) const
+{
+    processor.loadXZTables(tables_->xTable(), tables_->zTable());
+    processor.loadLookupTable(tables_->lookupTable());
+    processor.loadP0TablesFromCommandResponse(const_cast<unsigned char *>(tables_->p0Tables()), tables_->p0TablesSize());
+}
+
+libfreenect2::DepthPacket Recording::packet(size_t i)
+{
+    libfreenect2::DepthPacket packet;
+    packet.sequence = uint32_t(i);
+    packet.timestamp = uint32_t(i * 266);
+    packet.buffer = &packets_[i][0];
+    packet.buffer_length = packets_[i].size();
+    packet.lost_subsequences = 0;
+    packet.memory = 0;
+    return packet;
+}
+
+bool DepthCapture::onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame *frame)
+{
+    if(type != libfreenect2::Frame::Depth || frame->format != libfreenect2::Frame::Float)
+        return false;
+
+    const float *data = reinterpret_cast<const float *>(frame->data);
+    width = frame->width;
+    height = frame->height;
+    depth.assign(data, data + width * height);
+    return false;
+}
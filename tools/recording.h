@@ -0,0 +1,90 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+/** @file recording.h Recorded depth packets for the offline tools. */
+
+#ifndef RECORDING_H_
+#define RECORDING_H_
+
+#include <string>
+#include <vector>
+
+#include <include/libfreenect2.h>
+#include <libfreenect2/depth_packet_processor.h>
+#include <libfreenect2/table_cache.h>
+
+/**
+ * Depth packets recorded from a device, with the tables to process them.
+ *
+ * The tables come from a table cache file, which the library writes when
+ * `LIBFREENECT2_TABLE_CACHE_DIR` is set. Each packet file holds the data
+ * of one depth frame of the DumpPacketPipeline, the raw packet of 10
+ * sub-images.
+ */
+class Recording
+{
+public:
+    Recording();
+    ~Recording();
+
+    /**
+     * Load the tables and the packets.
+     * @param table_cache Table cache file.
+     * @param packet_files Packet files.
+     * @return false if a file is missing or invalid, after printing why.
+     */
+    bool load(const std::string &table_cache, const std::vector<std::string> &packet_files);
+
+    /** Load the tables into a processor, like the device does at start. */
+    void loadTables(libfreenect2::DepthPacketProcessor &processor) const;
+
+    /** Tables of the recording, after load(). */
+    const libfreenect2::TableCache &tables() const { return *tables_; }
+
+    size_t size() const { return packets_.size(); }
+
+    /** Get a packet, pointing into the recording. */
+    libfreenect2::DepthPacket packet(size_t i);
+
+private:
+    libfreenect2::TableCache *tables_;
+    std::vector<std::vector<unsigned char> > packets_;
+};
+
+/** Listener keeping a copy of the last depth frame, so the processor reuses its own. */
+class DepthCapture : public libfreenect2::FrameListener
+{
+public:
+    DepthCapture() : width(0), height(0) {}
+
+    virtual bool onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame *frame);
+    virtual unsigned int frameTypes() const { return libfreenect2::Frame::Depth; }
+
+    size_t width, height;
+    std::vector<float> depth; ///< Depth in millimeters, row major.
+};
+
+#endif /* RECORDING_H_ */